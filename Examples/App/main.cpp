@@ -47,6 +47,7 @@ app::app() : rfw::app(512, 512, "RenderingFW", VULKANRTX)
 
 void app::init(std::unique_ptr<rfw::system> &rs)
 {
+	rs->set_bvh_cache_directory("cache/bvh");
 	rs->set_skybox("envmaps/sky_15.hdr");
 	cesiumMan = rs->add_object("models/CesiumMan/CesiumMan.gltf", false, glm::scale(glm::mat4(1.0f), vec3(1.5)));
 	pica = rs->add_object("models/pica/scene.gltf");
@@ -295,6 +295,30 @@ void app::post_render(std::unique_ptr<rfw::system> &rs)
 	ImGui::Text("Render %2.2f ms", stats.renderTime);
 	ImGui::Text("FPS %4.1f", 1000.0f / stats.renderTime);
 
+#if BVH_STATS
+	ImGui::Separator();
+	ImGui::Text("BVH");
+	ImGui::Text("Top level SAH %4.2f", stats.topLevelSAH);
+	ImGui::Text("Bottom level SAH %4.2f, EPO %4.3f", stats.bottomLevelSAH, stats.bottomLevelEPO);
+	ImGui::Text("Max depth %u", stats.bvhMaxDepth);
+	ImGui::Text("# Node visits: %6.1fM (%3.1f/pixel)", stats.nodeVisits / 1000000.0,
+				stats.nodeVisits / max(1.0, double(stats.primaryCount)));
+	ImGui::Text("# Primitive tests: %6.1fM (%3.1f/pixel)", stats.primitiveTests / 1000000.0,
+				stats.primitiveTests / max(1.0, double(stats.primaryCount)));
+
+	float depthHistogram[rfw::RenderStats::BVH_HISTOGRAM_SIZE];
+	float leafSizeHistogram[rfw::RenderStats::BVH_HISTOGRAM_SIZE];
+	for (int i = 0; i < rfw::RenderStats::BVH_HISTOGRAM_SIZE; i++)
+	{
+		depthHistogram[i] = static_cast<float>(stats.bvhDepthHistogram[i]);
+		leafSizeHistogram[i] = static_cast<float>(stats.bvhLeafSizeHistogram[i]);
+	}
+	ImGui::PlotHistogram("Leaf depth", depthHistogram, rfw::RenderStats::BVH_HISTOGRAM_SIZE, 0, nullptr, 0.0f,
+						 FLT_MAX, ImVec2(0, 60));
+	ImGui::PlotHistogram("Leaf size", leafSizeHistogram, rfw::RenderStats::BVH_HISTOGRAM_SIZE, 0, nullptr, 0.0f,
+						 FLT_MAX, ImVec2(0, 60));
+#endif
+
 	ImGui::Separator();
 	ImGui::BeginGroup();
 	ImGui::Text("Camera");
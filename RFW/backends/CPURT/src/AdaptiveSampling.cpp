@@ -0,0 +1,128 @@
+#include "PCH.h"
+
+using namespace rfw;
+
+static constexpr int ADAPTIVE_TILE_SIZE = 16;
+// Error estimates are only trusted once every pixel of a tile took this many samples
+static constexpr int ADAPTIVE_MIN_SAMPLES = 16;
+// Upper bound of the samples per pixel a tile takes in a single frame
+static constexpr int ADAPTIVE_MAX_PASSES = 8;
+
+static inline float luminance(const glm::vec3 &color) { return dot(color, vec3(0.2126f, 0.7152f, 0.0722f)); }
+
+int Context::tile_index(int x, int y) const { return (y / ADAPTIVE_TILE_SIZE) * m_TilesX + x / ADAPTIVE_TILE_SIZE; }
+
+void Context::accumulate(unsigned int pixelID, const glm::vec3 &sample)
+{
+	// A single invalid sample would otherwise persist until the accumulator is reset
+	if (any(isnan(sample)) || any(isinf(sample)))
+		return;
+
+	const float L = luminance(sample);
+	m_Accumulator[pixelID] += vec4(sample, L * L);
+}
+
+void Context::reset_tiles()
+{
+	m_TilesX = (m_Width + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+	m_TilesY = (m_Height + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+
+	const int tileCount = m_TilesX * m_TilesY;
+	m_TileSamples.assign(tileCount, 0);
+	m_ActiveTiles.resize(tileCount);
+	for (int i = 0; i < tileCount; i++)
+		m_ActiveTiles[i] = i;
+	m_TilePasses = 1;
+
+	gather_active_pixels();
+}
+
+/*
+ * A tile converged once the relative standard error of the mean luminance of all its pixels is below the threshold.
+ * The samples converged tiles no longer take are spent on the remaining tiles, every frame takes roughly the same
+ * number of samples as a frame without adaptive sampling.
+ */
+void Context::update_tiles()
+{
+	const int tileCount = m_TilesX * m_TilesY;
+	std::vector<char> converged(tileCount, 0);
+
+	if (m_AdaptiveThreshold > 0.0f)
+	{
+		tbb::parallel_for(0, tileCount, [&](int tile) {
+			const int samples = m_TileSamples[tile];
+			if (samples < ADAPTIVE_MIN_SAMPLES)
+				return;
+
+			const int x0 = (tile % m_TilesX) * ADAPTIVE_TILE_SIZE;
+			const int y0 = (tile / m_TilesX) * ADAPTIVE_TILE_SIZE;
+			const int x1 = glm::min(x0 + ADAPTIVE_TILE_SIZE, m_Width);
+			const int y1 = glm::min(y0 + ADAPTIVE_TILE_SIZE, m_Height);
+
+			const float n = static_cast<float>(samples);
+			float error = 0.0f;
+			for (int y = y0; y < y1; y++)
+			{
+				for (int x = x0; x < x1; x++)
+				{
+					const vec4 &acc = m_Accumulator[y * m_Width + x];
+					const float mean = luminance(vec3(acc)) / n;
+					const float variance = glm::max(acc.w / n - mean * mean, 0.0f) * n / (n - 1.0f);
+					// Dark pixels are weighted less, absolute noise in them is less visible
+					error = glm::max(error, sqrt(variance / n) / (mean + 0.1f));
+				}
+			}
+
+			converged[tile] = error < m_AdaptiveThreshold ? 1 : 0;
+		});
+	}
+
+	m_ActiveTiles.clear();
+	for (int tile = 0; tile < tileCount; tile++)
+	{
+		if (!converged[tile])
+			m_ActiveTiles.push_back(tile);
+	}
+
+	if (m_ActiveTiles.empty())
+		m_TilePasses = 0;
+	else
+		m_TilePasses = glm::clamp(tileCount / static_cast<int>(m_ActiveTiles.size()), 1, ADAPTIVE_MAX_PASSES);
+
+	gather_active_pixels();
+}
+
+void Context::gather_active_pixels()
+{
+	m_ActivePixels.clear();
+	for (const int tile : m_ActiveTiles)
+	{
+		const int x0 = (tile % m_TilesX) * ADAPTIVE_TILE_SIZE;
+		const int y0 = (tile / m_TilesX) * ADAPTIVE_TILE_SIZE;
+		const int x1 = glm::min(x0 + ADAPTIVE_TILE_SIZE, m_Width);
+		const int y1 = glm::min(y0 + ADAPTIVE_TILE_SIZE, m_Height);
+
+		for (int y = y0; y < y1; y++)
+		{
+			for (int x = x0; x < x1; x++)
+				m_ActivePixels.push_back(static_cast<unsigned int>(y * m_Width + x));
+		}
+	}
+}
+
+// Counts the samples of this frame and writes the averages to the render target
+void Context::resolve_tiles()
+{
+	for (const int tile : m_ActiveTiles)
+		m_TileSamples[tile] += m_TilePasses;
+
+	tbb::parallel_for(0, m_Height, [&](int y) {
+		for (int x = 0; x < m_Width; x++)
+		{
+			const int pixelID = y * m_Width + x;
+			const int samples = m_TileSamples[tile_index(x, y)];
+			const float scale = samples > 0 ? 1.0f / static_cast<float>(samples) : 0.0f;
+			m_Pixels[pixelID] = vec4(vec3(m_Accumulator[pixelID]) * scale, 1.0f);
+		}
+	});
+}
@@ -22,9 +22,9 @@ rfw::RenderContext *createRenderContext() { return new Context(); }
 
 void destroyRenderContext(rfw::RenderContext *ptr) { ptr->cleanup(), delete ptr; }
 
-Context::~Context() { glDeleteBuffers(1, &m_PboID); }
+Context::~Context() = default;
 
-std::vector<rfw::RenderTarget> Context::get_supported_targets() const { return {OPENGL_TEXTURE}; }
+std::vector<rfw::RenderTarget> Context::get_supported_targets() const { return {OPENGL_TEXTURE, BUFFER}; }
 
 void Context::init(std::shared_ptr<rfw::utils::window> &window) { throw std::runtime_error("Not supported (yet)."); }
 
@@ -32,32 +32,26 @@ void Context::init(GLuint *glTextureID, uint width, uint height)
 {
 	if (!m_InitializedGlew)
 	{
-		m_Handles.resize(m_Pool.size());
-		m_RNGs.resize(m_Pool.size());
-		for (int i = 0, s = static_cast<int>(m_Pool.size()); i < s; i++)
-			m_RNGs[i] = utils::xor128(i + 1);
-
 		const auto error = glewInit();
 		if (error != GLEW_NO_ERROR)
 			throw std::runtime_error("Could not init GLEW.");
 		m_InitializedGlew = true;
 		CheckGL();
-		glGenBuffers(1, &m_PboID);
 	}
 
 	m_Width = static_cast<int>(width);
 	m_Height = static_cast<int>(height);
 	m_TargetID = *glTextureID;
+	m_TargetBuffer = nullptr;
+
+	m_PixelBuffers.resize(static_cast<size_t>(m_Width) * static_cast<size_t>(m_Height) * sizeof(glm::vec4));
+}
 
-	CheckGL();
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, m_PboID);
-	CheckGL();
-	std::vector<glm::vec4> dummyData(m_Width * m_Height, glm::vec4(0));
-	glBufferData(GL_PIXEL_UNPACK_BUFFER_ARB, m_Width * m_Height * sizeof(glm::vec4), dummyData.data(),
-				 GL_STREAM_DRAW_ARB);
-	CheckGL();
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
-	CheckGL();
+void Context::init(glm::vec4 *buffer, uint width, uint height)
+{
+	m_Width = static_cast<int>(width);
+	m_Height = static_cast<int>(height);
+	m_TargetBuffer = buffer;
 }
 
 void Context::cleanup() {}
@@ -65,22 +59,45 @@ void Context::cleanup() {}
 void Context::render_frame(const rfw::Camera &camera, rfw::RenderStatus status)
 {
 	if (status == Reset)
+		m_SamplesTaken = 0;
+
+	if (m_TargetBuffer)
 	{
-		for (int i = 0, s = static_cast<int>(m_Pool.size()); i < s; i++)
-			m_RNGs[i] = utils::xor128(i + 1);
+		m_Pixels = m_TargetBuffer;
+	}
+	else
+	{
+		m_Pixels = static_cast<glm::vec4 *>(m_PixelBuffers.acquire());
+		if (m_Pixels == nullptr)
+			throw std::runtime_error("Could not obtain pointer to pixel buffer.");
 	}
-
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, m_PboID);
-	m_Pixels = static_cast<glm::vec4 *>(glMapBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, GL_WRITE_ONLY_ARB));
-	if (m_Pixels == nullptr)
-		throw std::runtime_error("Could not obtain pointer to pixel buffer.");
-
-	const auto camParams = cpurt::Ray::CameraParams(camera.get_view(), 0, 1e-5f, m_Width, m_Height);
 
 	m_Stats.clear();
 	m_Stats.primaryCount = m_Width * m_Height;
+#if BVH_STATS
+	bvh::stats::reset();
+#endif
 
 	const auto timer = utils::timer();
+	if (m_PathTracing)
+		render_paths(camera, status);
+	else
+		render_direct(camera);
+
+	m_Stats.primaryTime = timer.elapsed();
+#if BVH_STATS
+	gather_bvh_stats();
+#endif
+
+	if (m_TargetBuffer)
+		return;
+
+	m_PixelBuffers.upload(m_TargetID, m_Width, m_Height, GL_RGBA, GL_FLOAT);
+}
+
+void Context::render_direct(const rfw::Camera &camera)
+{
+	const auto camParams = cpurt::Ray::CameraParams(camera.get_view(), 0, 1e-5f, m_Width, m_Height);
 
 #if PACKET_WIDTH == 4
 	constexpr int TILE_WIDTH = 4;
@@ -107,7 +124,21 @@ void Context::render_frame(const rfw::Camera &camera, rfw::RenderStatus status)
 					const int x4[4] = {x, x + 1, x + 2, x + 3};
 					const int y4[4] = {y, y, y, y};
 
-					auto packet = cpurt::Ray::generate_ray4(camParams, x4, y4, &m_RNGs[x_4 % m_Pool.size()]);
+					// Every packet gets its own generator, seeded by its first pixel and the frame's sample index
+					auto rng = utils::sample_rng(y * m_Width + x, m_SamplesTaken);
+
+#if BLUENOISE
+					float samples[4][4];
+					for (int i = 0; i < 4; i++)
+					{
+						const auto sampler = rfw::BlueNoiseSampler(x4[i], y4[i], m_SamplesTaken);
+						for (int dimension = 0; dimension < 4; dimension++)
+							samples[dimension][i] = sampler.get(dimension);
+					}
+					auto packet = cpurt::Ray::generate_ray4(camParams, x4, y4, samples);
+#else
+					auto packet = cpurt::Ray::generate_ray4(camParams, x4, y4, &rng);
+#endif
 
 					if (m_packet_traversal)
 					{
@@ -119,14 +150,9 @@ void Context::render_frame(const rfw::Camera &camera, rfw::RenderStatus status)
 							{
 								if (packet.pixelID[instance] >= maxPixelID)
 									continue;
-								const vec2 uv = vec2(
-									0.5f * (1.0f + atan(packet.direction_x[instance], -packet.direction_z[instance]) *
-													   glm::one_over_pi<float>()),
-									acos(packet.direction_y[instance]) * glm::one_over_pi<float>());
-								const uvec2 pUv = uvec2(uv.x * static_cast<float>(m_SkyboxWidth - 1),
-														uv.y * static_cast<float>(m_SkyboxHeight - 1));
-								m_Pixels[packet.pixelID[instance]] =
-									glm::vec4(m_Skybox[pUv.y * m_SkyboxWidth + pUv.x], 0.0f);
+								const vec3 direction = vec3(packet.direction_x[instance], packet.direction_y[instance],
+															packet.direction_z[instance]);
+								m_Pixels[packet.pixelID[instance]] = glm::vec4(sample_sky(direction), 0.0f);
 							}
 
 							continue;
@@ -146,6 +172,10 @@ void Context::render_frame(const rfw::Camera &camera, rfw::RenderStatus status)
 						}
 					}
 
+					// Lanes are shaded first so the shadow rays of the whole packet can be tested together
+					vec3 positions[4], normals[4], colors[4];
+					int shadedMask = 0;
+
 					for (int packet_id = 0, s = TILE_WIDTH * TILE_HEIGHT; packet_id < s; packet_id++)
 					{
 						const int pixelID = packet.pixelID[packet_id];
@@ -167,12 +197,7 @@ void Context::render_frame(const rfw::Camera &camera, rfw::RenderStatus status)
 
 						if (packet.instID[packet_id] < 0)
 						{
-							const vec2 uv =
-								vec2(0.5f * (1.0f + atan(direction.x, -direction.z) * glm::one_over_pi<float>()),
-									 acos(direction.y) * glm::one_over_pi<float>());
-							const uvec2 pUv = uvec2(uv.x * static_cast<float>(m_SkyboxWidth - 1),
-													uv.y * static_cast<float>(m_SkyboxHeight - 1));
-							m_Pixels[pixelID] = glm::vec4(m_Skybox[pUv.y * m_SkyboxWidth + pUv.x], 0.0f);
+							m_Pixels[pixelID] = glm::vec4(sample_sky(direction), 0.0f);
 							continue;
 						}
 
@@ -196,62 +221,79 @@ void Context::render_frame(const rfw::Camera &camera, rfw::RenderStatus status)
 							continue;
 						}
 
-						vec3 contrib = vec3(0.1f);
-						for (const auto &l : m_AreaLights)
+						positions[packet_id] = p;
+						normals[packet_id] = shading_data.iN;
+						colors[packet_id] = shading_data.color;
+						shadedMask |= 1 << packet_id;
+					}
+
+					vec3 contrib[4] = {vec3(0.1f), vec3(0.1f), vec3(0.1f), vec3(0.1f)};
+					for (int i = 0; i < m_ShadowRays && shadedMask != 0; i++)
+					{
+						float shadow_x[4], shadow_y[4], shadow_z[4];
+						float shadow_dx[4], shadow_dy[4], shadow_dz[4];
+						float shadow_t[4];
+						vec3 shadow_contrib[4];
+						int shadowMask = 0;
+
+						for (int lane = 0; lane < 4; lane++)
 						{
-							vec3 L = l.position - p;
-							const float sq_dist = dot(L, L);
-							const float dist = sqrt(sq_dist);
-							L = L / dist;
-							const float NdotL = dot(shading_data.iN, L);
-							const float LNdotL = -dot(l.normal, L);
-
-							if (NdotL <= 0 || LNdotL <= 0)
+							if ((shadedMask & (1 << lane)) == 0)
 								continue;
 
-							if (!topLevelBVH.is_occluded(p, L, dist - 2.0f * 1e-5f, 1e-4f))
-								contrib += l.radiance * l.area / sq_dist * NdotL * LNdotL;
-						}
+							const vec3 &p = positions[lane];
+							float pickProb;
+							const int light = m_Lights.pick(p, rng.rand(), &pickProb);
+							if (light < 0 || pickProb <= 0.0f)
+								continue;
 
-						for (const auto &l : m_PointLights)
-						{
-							vec3 L = l.position - p;
-							const float sq_dist = dot(L, L);
-							const float dist = sqrt(sq_dist);
-							L = L / dist;
-							const float NdotL = dot(shading_data.iN, L);
-							if (NdotL <= 0)
+							vec3 L, radiance;
+							float dist;
+							if (!m_Lights.connect(light, p, normals[lane], &L, &dist, &radiance))
 								continue;
 
-							if (!topLevelBVH.is_occluded(p, L, dist - 2.0f * 1e-5f, 1e-4f))
-								contrib += l.radiance / sq_dist * NdotL;
+							shadow_contrib[lane] = radiance / (pickProb * static_cast<float>(m_ShadowRays));
+
+							shadow_x[lane] = p.x;
+							shadow_y[lane] = p.y;
+							shadow_z[lane] = p.z;
+							shadow_dx[lane] = L.x;
+							shadow_dy[lane] = L.y;
+							shadow_dz[lane] = L.z;
+							shadow_t[lane] = dist - 2.0f * 1e-5f;
+							shadowMask |= 1 << lane;
 						}
 
-						// for (const auto &l : m_DirectionalLights)
-						//{
-						//}
+						if (shadowMask == 0)
+							continue;
 
-						// for (const auto &l : m_SpotLights)
-						//{
-						//}
+						const int occluded = topLevelBVH.is_occluded4(shadow_x, shadow_y, shadow_z, shadow_dx, shadow_dy,
+																	  shadow_dz, shadow_t, 1e-4f, shadowMask);
+						for (int lane = 0; lane < 4; lane++)
+						{
+							if ((shadowMask & ~occluded) & (1 << lane))
+								contrib[lane] += shadow_contrib[lane];
+						}
+					}
 
-						m_Pixels[pixelID] = vec4(shading_data.color * contrib, 1.0f);
+					// for (const auto &l : m_DirectionalLights)
+					//{
+					//}
+
+					// for (const auto &l : m_SpotLights)
+					//{
+					//}
+
+					for (int lane = 0; lane < 4; lane++)
+					{
+						if (shadedMask & (1 << lane))
+							m_Pixels[packet.pixelID[lane]] = vec4(colors[lane] * contrib[lane], 1.0f);
 					}
 				}
 			}
 		});
 
-	m_Stats.primaryTime = timer.elapsed();
-
-	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER_ARB);
-	CheckGL();
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, m_PboID);
-	CheckGL();
-	glBindTexture(GL_TEXTURE_2D, m_TargetID);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_Width, m_Height, GL_RGBA, GL_FLOAT, nullptr);
-	CheckGL();
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
-	CheckGL();
+	m_SamplesTaken++;
 }
 
 void Context::set_materials(const std::vector<rfw::DeviceMaterial> &materials,
@@ -259,10 +301,61 @@ void Context::set_materials(const std::vector<rfw::DeviceMaterial> &materials,
 {
 	m_Materials.resize(materials.size());
 	memcpy(m_Materials.data(), materials.data(), materials.size() * sizeof(Material));
+
+	for (auto &mesh : m_Meshes)
+		update_alpha_test(mesh);
 }
 
 void Context::set_textures(const std::vector<rfw::TextureData> &textures) { m_Textures = textures; }
 
+#if BVH_STATS
+// Reports the tree that is used to traverse a mesh
+static bvh::BVHStats get_mesh_stats(const bvh::rfwMesh &mesh)
+{
+	if (mesh.mbvh8)
+		return mesh.mbvh8->get_stats();
+	if (mesh.mbvh)
+		return mesh.mbvh->get_stats();
+	return mesh.bvh->get_stats();
+}
+
+void Context::gather_bvh_stats()
+{
+	const bvh::stats::TraversalCounters counters = bvh::stats::collect();
+	m_Stats.nodeVisits = counters.node_visits;
+	m_Stats.primitiveTests = counters.prim_tests;
+	m_Stats.topLevelSAH = m_TopLevelStats.sah_cost;
+
+	const auto add_histogram = [](unsigned int *histogram, const std::vector<int> &values) {
+		for (size_t i = 0; i < values.size(); i++)
+			histogram[glm::min(i, size_t(RenderStats::BVH_HISTOGRAM_SIZE - 1))] += values[i];
+	};
+
+	double sah = 0.0, epo = 0.0, triangles = 0.0;
+	for (size_t i = 0; i < m_MeshStats.size(); i++)
+	{
+		const bvh::BVHStats &stats = m_MeshStats[i];
+		if (stats.node_count == 0)
+			continue;
+
+		const double weight = m_Meshes[i].triangleCount;
+		sah += stats.sah_cost * weight;
+		epo += stats.epo * weight;
+		triangles += weight;
+
+		m_Stats.bvhMaxDepth = glm::max(m_Stats.bvhMaxDepth, static_cast<unsigned int>(stats.max_depth));
+		add_histogram(m_Stats.bvhDepthHistogram, stats.depth_histogram);
+		add_histogram(m_Stats.bvhLeafSizeHistogram, stats.leaf_size_histogram);
+	}
+
+	if (triangles > 0.0)
+	{
+		m_Stats.bottomLevelSAH = static_cast<float>(sah / triangles);
+		m_Stats.bottomLevelEPO = static_cast<float>(epo / triangles);
+	}
+}
+#endif
+
 void Context::set_mesh(size_t index, const rfw::Mesh &mesh)
 {
 	if (index >= m_Meshes.size())
@@ -271,7 +364,14 @@ void Context::set_mesh(size_t index, const rfw::Mesh &mesh)
 			m_Meshes.emplace_back();
 	}
 
+	m_Meshes[index].compressed = m_CompressedBVH;
 	m_Meshes[index].set_geometry(mesh);
+	update_alpha_test(m_Meshes[index]);
+
+#if BVH_STATS
+	m_MeshStats.resize(m_Meshes.size());
+	m_MeshStats[index] = get_mesh_stats(m_Meshes[index]);
+#endif
 }
 
 void Context::set_instance(size_t i, size_t meshIdx, const mat4 &transform, const mat3 &inverse_transform)
@@ -290,23 +390,7 @@ void Context::set_lights(rfw::LightCount lightCount, const rfw::DeviceAreaLight
 						 const rfw::DevicePointLight *pointLights, const rfw::DeviceSpotLight *spotLights,
 						 const rfw::DeviceDirectionalLight *directionalLights)
 {
-	m_LightCount = lightCount;
-
-	m_AreaLights.resize(lightCount.areaLightCount);
-	if (!m_AreaLights.empty())
-		memcpy(m_AreaLights.data(), areaLights, m_AreaLights.size() * sizeof(AreaLight));
-
-	m_PointLights.resize(lightCount.pointLightCount);
-	if (!m_PointLights.empty())
-		memcpy(m_PointLights.data(), pointLights, m_PointLights.size() * sizeof(PointLight));
-
-	m_DirectionalLights.resize(lightCount.directionalLightCount);
-	if (!m_DirectionalLights.empty())
-		memcpy(m_DirectionalLights.data(), directionalLights, m_DirectionalLights.size() * sizeof(DirectionalLight));
-
-	m_SpotLights.resize(lightCount.spotLightCount);
-	if (!m_SpotLights.empty())
-		memcpy(m_SpotLights.data(), spotLights, m_SpotLights.size() * sizeof(SpotLight));
+	m_Lights.set_lights(lightCount, areaLights, pointLights, spotLights, directionalLights);
 }
 
 void Context::get_probe_results(unsigned int *instanceIndex, unsigned int *primitiveIndex, float *distance) const
@@ -319,23 +403,84 @@ void Context::get_probe_results(unsigned int *instanceIndex, unsigned int *primi
 rfw::AvailableRenderSettings Context::get_settings() const
 {
 	auto settings = rfw::AvailableRenderSettings();
-	settings.settingKeys = {"packet_traversal"};
-	settings.settingValues = {{"1", "0"}};
+	settings.settingKeys = {"path_tracing", "wavefront", "adaptive_threshold", "packet_traversal",
+							"compressed_bvh", "shadow_rays", "light_selection"};
+	settings.settingValues = {{"1", "0"}, {"1", "0"}, {"0.01", "0.005", "0.02", "0.05", "0"}, {"1", "0"},
+							  {"0", "1"}, {"1", "2", "4", "8"}, {"bvh", "power", "uniform"}};
 	return settings;
 }
 
 void Context::set_setting(const rfw::RenderSetting &setting)
 {
-	if (setting.name == "packet_traversal")
+	if (setting.name == "path_tracing")
+	{
+		m_PathTracing = setting.value == "1";
+		m_SamplesTaken = 0;
+	}
+	else if (setting.name == "wavefront")
+	{
+		m_Wavefront = setting.value == "1";
+		m_SamplesTaken = 0;
+	}
+	else if (setting.name == "shadow_rays")
+	{
+		m_ShadowRays = std::stoi(setting.value);
+	}
+	else if (setting.name == "light_selection")
+	{
+		if (setting.value == "uniform")
+			m_Lights.set_selection(bvh::LightSampler::Selection::Uniform);
+		else if (setting.value == "power")
+			m_Lights.set_selection(bvh::LightSampler::Selection::Power);
+		else
+			m_Lights.set_selection(bvh::LightSampler::Selection::Hierarchy);
+		m_SamplesTaken = 0;
+	}
+	else if (setting.name == "adaptive_threshold")
+	{
+		// Tiles are re-evaluated every frame, a lower threshold reactivates converged tiles
+		m_AdaptiveThreshold = std::stof(setting.value);
+	}
+	else if (setting.name == "packet_traversal")
 		m_packet_traversal = setting.value == "1" ? true : false;
+	else if (setting.name == "compressed_bvh")
+	{
+		m_CompressedBVH = setting.value == "1";
+		for (auto &mesh : m_Meshes)
+			mesh.set_compressed(m_CompressedBVH);
+#if BVH_STATS
+		for (size_t i = 0; i < m_Meshes.size(); i++)
+		{
+			if (m_Meshes[i].bvh)
+				m_MeshStats[i] = get_mesh_stats(m_Meshes[i]);
+		}
+#endif
+	}
+	else if (setting.name == "bvh_cache_directory")
+		bvh::cache::set_directory(setting.value);
 }
 
-void Context::update() { topLevelBVH.construct_bvh(); }
+void Context::update()
+{
+	topLevelBVH.refit();
+#if BVH_STATS
+	m_TopLevelStats = topLevelBVH.get_stats();
+#endif
+}
 
 void Context::set_probe_index(glm::uvec2 probePos) { m_ProbePos = probePos; }
 
 rfw::RenderStats Context::get_stats() const { return m_Stats; }
 
+glm::vec3 Context::sample_sky(const glm::vec3 &direction) const
+{
+	const vec2 uv = vec2(0.5f * (1.0f + atan(direction.x, -direction.z) * glm::one_over_pi<float>()),
+						 acos(direction.y) * glm::one_over_pi<float>());
+	const uvec2 pUv =
+		uvec2(uv.x * static_cast<float>(m_SkyboxWidth - 1), uv.y * static_cast<float>(m_SkyboxHeight - 1));
+	return m_Skybox[pUv.y * m_SkyboxWidth + pUv.x];
+}
+
 Context::ShadingData Context::retrieve_material(const Triangle &tri, const Material &material, const glm::vec3 &p,
 												const simd::matrix4 &matrix, const simd::matrix4 &normal_matrix) const
 {
@@ -356,7 +501,7 @@ Context::ShadingData Context::retrieve_material(const Triangle &tri, const Mater
 	const simd::vector4 vN_4 = normal_matrix * simd::vector4(iN.x, iN.y, iN.z, 0.0f);
 	data.iN = normalize(vec3(vN_4.vec));
 
-	createTangentSpace(iN, data.T, data.B);
+	createTangentSpace(data.iN, data.T, data.B);
 
 	data.color = material.getColor();
 
@@ -406,3 +551,17 @@ Context::ShadingData Context::retrieve_material(const Triangle &tri, const Mater
 
 	return data;
 }
+
+void Context::update_alpha_test(rfw::bvh::rfwMesh &mesh) const
+{
+	mesh.alpha_test = nullptr;
+	mesh.alpha_user_data = nullptr;
+	if (!uses_alpha_test(m_Materials, mesh.triangles, mesh.triangleCount))
+		return;
+
+	mesh.alpha_test = [](const void *context, const Triangle &tri, float u, float v) {
+		const auto *ctx = static_cast<const Context *>(context);
+		return is_transparent(ctx->m_Materials, ctx->m_Textures, tri, u, v);
+	};
+	mesh.alpha_user_data = this;
+}
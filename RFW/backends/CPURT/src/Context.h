@@ -8,6 +8,7 @@
 #include <rfw/utils/lib_export.h>
 #include <rfw/utils/thread_pool.h>
 #include <rfw/utils/xor128.h>
+#include <rfw/utils/gl/pixel_buffer_ring.h>
 
 #include <GL/glew.h>
 
@@ -24,6 +25,7 @@ class Context : public RenderContext
 
 	void init(std::shared_ptr<rfw::utils::window> &window) override;
 	void init(GLuint *glTextureID, uint width, uint height) override;
+	void init(glm::vec4 *buffer, uint width, uint height) override;
 
 	void cleanup() override;
 	void render_frame(const rfw::Camera &camera, rfw::RenderStatus status) override;
@@ -53,21 +55,63 @@ class Context : public RenderContext
 		glm::vec3 B;
 	};
 
+	struct LightSample
+	{
+		glm::vec3 L;		// Normalized direction towards the light
+		float dist;			// Distance to the sampled point, shadow rays are shortened by an epsilon
+		glm::vec3 radiance; // Radiance arriving at the shading point, distance falloff of point lights included
+		float pdf;			// Pick probability, area lights include the solid angle density. 0 if nothing was sampled
+		bool area;			// Area lights can be hit by BSDF samples and are combined using MIS
+	};
+
+	struct PathCounters
+	{
+		unsigned int extensions = 0;
+		unsigned int shadows = 0;
+	};
+
 	ShadingData retrieve_material(const Triangle &tri, const Material &material, const glm::vec3 &p,
 								  const simd::matrix4 &matrix, const simd::matrix4 &normal_matrix) const;
+	glm::vec3 sample_sky(const glm::vec3 &direction) const;
+	// Installs the alpha test on meshes that use alpha tested materials and removes it from all others
+	void update_alpha_test(rfw::bvh::rfwMesh &mesh) const;
+
+	// Direct lighting of primary hits, traced in packets
+	void render_direct(const rfw::Camera &camera);
+
+	// Progressive path tracing, defined in PathTracer.cpp
+	void render_paths(const rfw::Camera &camera, rfw::RenderStatus status);
+	cpurt::PathVertex primary_path(const cpurt::Ray::CameraParams &camParams, int x, int y, int pass) const;
+	glm::vec3 trace_path(cpurt::PathVertex path, bool probe, PathCounters &counters);
+	bool shade_path(cpurt::PathVertex &path, const Triangle &tri, int instID, float t, int pathLength,
+					glm::vec3 &radiance, cpurt::ShadowRay &shadow) const;
+	LightSample sample_light(const glm::vec3 &I, uint &seed) const;
+	// Pdf of sampling a point on an emissive triangle from origin with next event estimation
+	float area_light_pdf(const glm::vec3 &origin, const Triangle &tri, float sq_dist, float cos_light) const;
+
+	// Wavefront path tracing, defined in Wavefront.cpp
+	void render_wavefront(const cpurt::Ray::CameraParams &camParams, int probe_id, int pass);
+	void generate(const cpurt::Ray::CameraParams &camParams, int pass, int probe_id);
+	void extend(cpurt::PathStream &paths);
+	void sort_by_material(const cpurt::PathStream &paths);
+	void shade(const cpurt::PathStream &paths, int pathLength, cpurt::PathStream &next);
+	void connect();
+
+	// Adaptive sampling, defined in AdaptiveSampling.cpp
+	void reset_tiles();
+	void update_tiles();
+	void gather_active_pixels();
+	void resolve_tiles();
+	void accumulate(unsigned int pixelID, const glm::vec3 &sample);
+	[[nodiscard]] int tile_index(int x, int y) const;
 
 	rfw::RenderStats m_Stats;
-	LightCount m_LightCount;
-	std::vector<PointLight> m_PointLights;
-	std::vector<AreaLight> m_AreaLights;
-	std::vector<DirectionalLight> m_DirectionalLights;
-	std::vector<SpotLight> m_SpotLights;
+	rfw::bvh::LightSampler m_Lights;
+	int m_ShadowRays = 1; // Shadow rays per shading point of the direct renderer
 	std::vector<Material> m_Materials;
 	std::vector<TextureData> m_Textures;
 
 	utils::thread_pool m_Pool = {};
-	std::vector<std::future<void>> m_Handles;
-	std::vector<utils::xor128> m_RNGs;
 
 #if PACKET_WIDTH == 4
 	std::vector<cpurt::RayPacket4> m_Packets;
@@ -80,14 +124,42 @@ class Context : public RenderContext
 	int m_SkyboxWidth = 0, m_SkyboxHeight = 0;
 	std::vector<glm::vec3> m_Skybox = {glm::vec3(0)};
 	glm::vec4 *m_Pixels = nullptr;
-	GLuint m_TargetID = 0, m_PboID = 0;
+	glm::vec4 *m_TargetBuffer = nullptr; // Host memory target, pixels are written directly when set
+	GLuint m_TargetID = 0;
+	utils::pixel_buffer_ring m_PixelBuffers;
 	int m_Width, m_Height;
 	glm::uvec2 m_ProbePos = glm::uvec2(0);
 	unsigned int m_ProbedInstance = 0;
 	unsigned int m_ProbedTriangle = 0;
 	float m_ProbedDist = -1.0f;
 
+	std::vector<glm::vec4> m_Accumulator; // Radiance in xyz, squared luminance in w
+	int m_SamplesTaken = 0;
+
+	int m_TilesX = 0, m_TilesY = 0;
+	std::vector<int> m_TileSamples;			   // Samples taken by every pixel of a tile
+	std::vector<int> m_ActiveTiles;			   // Tiles that did not reach the error threshold yet
+	std::vector<unsigned int> m_ActivePixels; // Pixels of the active tiles, ordered by tile
+	int m_TilePasses = 1;					   // Samples per pixel active tiles take this frame
+	float m_AdaptiveThreshold = 0.01f;
+
+	cpurt::PathStream m_PathStreams[2];
+	cpurt::ShadowStream m_ShadowStream;
+	std::vector<uint64_t> m_ShadeOrder;
+	std::vector<glm::vec3> m_SampleRadiance; // Radiance of the current sample of every pixel
+	int m_ProbePath = -1;
+
+#if BVH_STATS
+	void gather_bvh_stats();
+
+	std::vector<rfw::bvh::BVHStats> m_MeshStats;
+	rfw::bvh::BVHStats m_TopLevelStats;
+#endif
+
 	bool m_packet_traversal = true;
+	bool m_PathTracing = true;
+	bool m_Wavefront = true;
+	bool m_CompressedBVH = false;
 	bool m_InitializedGlew = false;
 };
 
@@ -16,6 +16,8 @@
 
 #include <rfw/context/context.h>
 #include <rfw/context/export.h>
+#include <rfw/context/sampler.h>
+#include <rfw/context/alpha_test.h>
 
 #include <rfw/utils/gl/check.h>
 #include <rfw/math.h>
@@ -36,5 +38,8 @@
 #include <bvh/mbvh_node.h>
 #include <bvh/mbvh_tree.h>
 #include <bvh/top_level_bvh.h>
+#include <bvh/light_sampler.h>
+#include <bvh/bvh_cache.h>
 
+#include "PathState.h"
 #include "Context.h"
\ No newline at end of file
@@ -0,0 +1,54 @@
+#include "PCH.h"
+
+namespace cpurt
+{
+
+void PathStream::resize(size_t count)
+{
+	rays.resize(count);
+	hits.resize(count);
+
+	throughput.resize(count);
+	bsdf_pdf.resize(count);
+	seed.resize(count);
+	specular.resize(count);
+	pixel_id.resize(count);
+}
+
+void PathStream::set(size_t idx, unsigned int pixelID, const PathVertex &path)
+{
+	rays.set(idx, path.origin, path.direction);
+	throughput[idx] = path.throughput;
+	bsdf_pdf[idx] = path.bsdfPdf;
+	seed[idx] = path.seed;
+	specular[idx] = path.specular ? 1 : 0;
+	pixel_id[idx] = pixelID;
+}
+
+PathVertex PathStream::get(size_t idx) const
+{
+	PathVertex path;
+	path.origin = glm::vec3(rays.origin_x[idx], rays.origin_y[idx], rays.origin_z[idx]);
+	path.direction = glm::vec3(rays.dir_x[idx], rays.dir_y[idx], rays.dir_z[idx]);
+	path.throughput = throughput[idx];
+	path.bsdfPdf = bsdf_pdf[idx];
+	path.seed = seed[idx];
+	path.specular = specular[idx] != 0;
+	return path;
+}
+
+void ShadowStream::resize(size_t count)
+{
+	rays.resize(count);
+	contribution.resize(count);
+	pixel_id.resize(count);
+}
+
+void ShadowStream::set(size_t idx, unsigned int pixelID, const ShadowRay &ray)
+{
+	rays.set(idx, ray.origin, ray.direction, ray.dist);
+	contribution[idx] = ray.contribution;
+	pixel_id[idx] = pixelID;
+}
+
+} // namespace cpurt
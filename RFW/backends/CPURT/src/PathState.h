@@ -0,0 +1,64 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <bvh/ray_stream.h>
+
+#include <vector>
+
+namespace cpurt
+{
+
+// State of a path in between two bounces
+struct PathVertex
+{
+	glm::vec3 origin;
+	glm::vec3 direction;
+	glm::vec3 throughput;
+	float bsdfPdf;	   // Pdf of the bounce that generated direction, used for MIS when a light is hit
+	unsigned int seed;
+	bool specular;	   // Camera rays and specular bounces add the emission they hit without MIS
+};
+
+// Light sample that still needs to be tested for occlusion, dist is 0 when no sample was generated
+struct ShadowRay
+{
+	glm::vec3 origin;
+	glm::vec3 direction;
+	float dist;
+	glm::vec3 contribution;
+};
+
+// Structure of arrays buffer of paths for the wavefront renderer, rays and hits are passed to the BVH as a stream
+struct PathStream
+{
+	void resize(size_t count);
+	void set(size_t idx, unsigned int pixelID, const PathVertex &path);
+	[[nodiscard]] PathVertex get(size_t idx) const;
+
+	[[nodiscard]] size_t size() const { return rays.size(); }
+
+	rfw::bvh::RayStreamSoA rays;
+	rfw::bvh::HitStreamSoA hits;
+
+	std::vector<glm::vec3> throughput;
+	std::vector<float> bsdf_pdf;
+	std::vector<unsigned int> seed;
+	std::vector<unsigned char> specular;
+	std::vector<unsigned int> pixel_id;
+};
+
+// Structure of arrays buffer of shadow rays, their contribution is added to the pixel when they are not occluded
+struct ShadowStream
+{
+	void resize(size_t count);
+	void set(size_t idx, unsigned int pixelID, const ShadowRay &ray);
+
+	[[nodiscard]] size_t size() const { return rays.size(); }
+
+	rfw::bvh::RayStreamSoA rays;
+	std::vector<glm::vec3> contribution;
+	std::vector<unsigned int> pixel_id;
+};
+
+} // namespace cpurt
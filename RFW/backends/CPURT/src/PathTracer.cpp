@@ -0,0 +1,318 @@
+#include "PCH.h"
+
+// The BSDF headers are shared with the GPU backends, they define global helpers and macros and are therefore only
+// included in this translation unit
+#include <rfw/bsdf/bsdf.h>
+
+using namespace rfw;
+
+// Offset along the geometric normal to prevent self intersections of extension and shadow rays
+static constexpr float GEOMETRY_EPSILON = 1e-4f;
+
+void Context::render_paths(const rfw::Camera &camera, rfw::RenderStatus status)
+{
+	const size_t pixelCount = static_cast<size_t>(m_Width) * static_cast<size_t>(m_Height);
+	if (status == Reset || m_Accumulator.size() != pixelCount || m_SamplesTaken == 0)
+	{
+		m_Accumulator.assign(pixelCount, glm::vec4(0.0f));
+		m_SamplesTaken = 0;
+		reset_tiles();
+	}
+	else
+	{
+		update_tiles();
+	}
+
+	const auto camParams = cpurt::Ray::CameraParams(camera.get_view(), m_SamplesTaken, 1e-5f, m_Width, m_Height);
+	const int probe_id = static_cast<int>(m_ProbePos.y * m_Width + m_ProbePos.x);
+	m_Stats.primaryCount = 0;
+
+	// Every pass takes a single sample for each pixel of the active tiles
+	for (int pass = 0; pass < m_TilePasses; pass++)
+	{
+		if (m_Wavefront)
+		{
+			render_wavefront(camParams, probe_id, pass);
+		}
+		else
+		{
+			std::atomic<unsigned int> extensions = 0;
+			std::atomic<unsigned int> shadows = 0;
+
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, m_ActivePixels.size()),
+							  [&](const tbb::blocked_range<size_t> &r) {
+								  PathCounters counters = {};
+								  for (size_t i = r.begin(), s = r.end(); i < s; i++)
+								  {
+									  const unsigned int pixelID = m_ActivePixels[i];
+									  const int x = static_cast<int>(pixelID % m_Width);
+									  const int y = static_cast<int>(pixelID / m_Width);
+
+									  const cpurt::PathVertex path = primary_path(camParams, x, y, pass);
+									  accumulate(pixelID, trace_path(path, pixelID == probe_id, counters));
+								  }
+
+								  extensions += counters.extensions;
+								  shadows += counters.shadows;
+							  });
+
+			m_Stats.secondaryCount += extensions.load();
+			m_Stats.shadowCount += shadows.load();
+		}
+
+		m_Stats.primaryCount += static_cast<unsigned int>(m_ActivePixels.size());
+	}
+
+	resolve_tiles();
+	m_SamplesTaken++;
+}
+
+cpurt::PathVertex Context::primary_path(const cpurt::Ray::CameraParams &camParams, int x, int y, int pass) const
+{
+	const int sample = m_TileSamples[tile_index(x, y)] + pass;
+
+	cpurt::PathVertex path;
+	path.seed = WangHash((y * m_Width + x) * 16789 + sample * 1791);
+
+#if BLUENOISE
+	// Camera dimensions use the blue noise sequence, bounces keep using the path's seed
+	const auto sampler = rfw::BlueNoiseSampler(x, y, static_cast<unsigned int>(sample));
+	const float r0 = sampler.get(0);
+	const float r1 = sampler.get(1);
+	const float r2 = sampler.get(2);
+	const float r3 = sampler.get(3);
+#else
+	const float r0 = RandomFloat(path.seed);
+	const float r1 = RandomFloat(path.seed);
+	const float r2 = RandomFloat(path.seed);
+	const float r3 = RandomFloat(path.seed);
+#endif
+	const cpurt::Ray ray = cpurt::Ray::generateFromView(camParams, x, y, r0, r1, r2, r3);
+
+	path.origin = ray.origin;
+	path.direction = ray.direction;
+	path.throughput = vec3(1.0f);
+	path.bsdfPdf = 1.0f;
+	path.specular = true;
+	return path;
+}
+
+glm::vec3 Context::trace_path(cpurt::PathVertex path, bool probe, PathCounters &counters)
+{
+	vec3 radiance = vec3(0.0f);
+
+	for (int pathLength = 0;; pathLength++)
+	{
+		float t = 1e34f;
+		int primID = -1, instID = -1;
+		const Triangle *tri = topLevelBVH.intersect(path.origin, path.direction, &t, &primID, &instID);
+
+		if (probe && pathLength == 0)
+		{
+			m_ProbedDist = t;
+			m_ProbedInstance = instID;
+			m_ProbedTriangle = primID;
+		}
+
+		if (!tri || instID < 0)
+		{
+			radiance += path.throughput * sample_sky(path.direction);
+			break;
+		}
+
+		cpurt::ShadowRay shadow;
+		const bool extend = shade_path(path, *tri, instID, t, pathLength, radiance, shadow);
+
+		if (shadow.dist > 0.0f)
+		{
+			counters.shadows++;
+			if (!topLevelBVH.is_occluded(shadow.origin, shadow.direction, shadow.dist))
+				radiance += shadow.contribution;
+		}
+
+		if (!extend)
+			break;
+		counters.extensions++;
+	}
+
+	return radiance;
+}
+
+bool Context::shade_path(cpurt::PathVertex &path, const Triangle &tri, int instID, float t, int pathLength,
+						 glm::vec3 &radiance, cpurt::ShadowRay &shadow) const
+{
+	shadow.dist = 0.0f;
+
+	const vec3 I = path.origin + path.direction * t;
+	const simd::matrix4 &matrix = topLevelBVH.get_instance_matrix(instID);
+	const simd::matrix4 &normal_matrix = topLevelBVH.get_normal_matrix(instID);
+	const Material &material = m_Materials[tri.material];
+	const auto data = retrieve_material(tri, material, I, matrix, normal_matrix);
+
+	::ShadingData shadingData{};
+	shadingData.color = data.color;
+	shadingData.flags = material.flags;
+	shadingData.absorption = material.getAbsorption();
+	shadingData.matID = tri.material;
+	shadingData.parameters = material.parameters;
+
+	if (shadingData.isEmissive())
+	{
+		// Lights only emit from their front side
+		const float cos_light = -dot(path.direction, data.N);
+		if (cos_light > 0.0f)
+		{
+			if (path.specular)
+			{
+				radiance += path.throughput * shadingData.color;
+			}
+			else
+			{
+				const float lightPdf = area_light_pdf(path.origin, tri, t * t, cos_light);
+				radiance += path.throughput * shadingData.color * (path.bsdfPdf / (path.bsdfPdf + lightPdf));
+			}
+		}
+		return false;
+	}
+
+	const bool backfacing = dot(path.direction, data.N) > 0.0f;
+	const float flip = backfacing ? -1.0f : 1.0f;
+	const vec3 N = data.N * flip;
+	const vec3 iN = data.iN * flip;
+	const vec3 wo = -path.direction;
+
+	path.specular = shadingData.getRoughness() < MIN_ROUGHNESS;
+
+	// Next event estimation
+	if (!path.specular)
+	{
+		const LightSample light = sample_light(I, path.seed);
+		const float NdotL = dot(iN, light.L);
+		if (light.pdf > 0.0f && NdotL > 0.0f && dot(N, light.L) > 0.0f)
+		{
+			float shadowPdf = 0.0f;
+			const vec3 bsdf = EvaluateBSDF(shadingData, iN, data.T, data.B, wo, light.L, shadowPdf, path.seed);
+			const float pdf = light.area ? light.pdf + shadowPdf : light.pdf;
+
+			if (any(greaterThan(bsdf, vec3(0.0f))))
+			{
+				shadow.origin = I + N * GEOMETRY_EPSILON;
+				shadow.direction = light.L;
+				shadow.dist = light.dist - 2.0f * GEOMETRY_EPSILON;
+				shadow.contribution = path.throughput * bsdf * light.radiance * (NdotL / pdf);
+			}
+		}
+	}
+
+	if (pathLength >= MAX_PATH_LENGTH)
+		return false;
+
+	vec3 R;
+	float newBsdfPdf = 0.0f;
+	const vec3 bsdf = SampleBSDF(shadingData, iN, N, data.T, data.B, wo, t, backfacing, R, newBsdfPdf, path.seed);
+	if (newBsdfPdf < 1e-6f || any(isnan(bsdf)))
+		return false;
+
+	path.throughput *= bsdf * (abs(dot(iN, R)) / newBsdfPdf);
+
+	// Russian roulette
+	const float survival = SurvivalProbability(path.throughput);
+	if (survival <= 0.0f || RandomFloat(path.seed) > survival)
+		return false;
+	path.throughput *= 1.0f / survival;
+
+	path.bsdfPdf = newBsdfPdf;
+	path.origin = I + N * (dot(N, R) > 0.0f ? GEOMETRY_EPSILON : -GEOMETRY_EPSILON);
+	path.direction = R;
+	return true;
+}
+
+Context::LightSample Context::sample_light(const glm::vec3 &I, uint &seed) const
+{
+	LightSample sample{};
+
+	float pickProb;
+	const int light = m_Lights.pick(I, RandomFloat(seed), &pickProb);
+	if (light < 0 || pickProb <= 0.0f)
+		return sample;
+
+	const auto &areaLights = m_Lights.get_area_lights();
+	const auto &pointLights = m_Lights.get_point_lights();
+	const auto &spotLights = m_Lights.get_spot_lights();
+
+	auto index = static_cast<size_t>(light);
+	const float r0 = RandomFloat(seed);
+	const float r1 = RandomFloat(seed);
+
+	const auto set_direction = [&sample, &I](const vec3 &position) {
+		const vec3 L = position - I;
+		const float sq_dist = dot(L, L);
+		sample.dist = sqrt(sq_dist);
+		sample.L = L / sample.dist;
+		return sq_dist;
+	};
+
+	if (index < areaLights.size())
+	{
+		const AreaLight &light = areaLights[index];
+
+		// Uniformly distributed point on the triangle
+		const float su = sqrt(r0);
+		const float b0 = 1.0f - su;
+		const float b1 = r1 * su;
+		const vec3 P = b0 * light.vertex0 + b1 * light.vertex1 + (1.0f - b0 - b1) * light.vertex2;
+
+		const float sq_dist = set_direction(P);
+		const float cos_light = -dot(light.normal, sample.L);
+		if (cos_light <= 0.0f)
+			return sample;
+
+		sample.radiance = light.radiance;
+		sample.pdf = pickProb * sq_dist / (cos_light * light.area);
+		sample.area = true;
+		return sample;
+	}
+	index -= areaLights.size();
+
+	if (index < pointLights.size())
+	{
+		const PointLight &light = pointLights[index];
+		const float sq_dist = set_direction(light.position);
+		sample.radiance = light.radiance / sq_dist;
+		sample.pdf = pickProb;
+		return sample;
+	}
+	index -= pointLights.size();
+
+	if (index < spotLights.size())
+	{
+		const SpotLight &light = spotLights[index];
+		const float sq_dist = set_direction(light.position);
+		const float cos_angle = -dot(light.direction, sample.L);
+		const float falloff = clamp((cos_angle - light.cosOuter) / (light.cosInner - light.cosOuter), 0.0f, 1.0f);
+		if (falloff <= 0.0f)
+			return sample;
+
+		sample.radiance = light.radiance * falloff / sq_dist;
+		sample.pdf = pickProb;
+		return sample;
+	}
+	index -= spotLights.size();
+
+	const DirectionalLight &light = m_Lights.get_directional_lights()[index];
+	sample.L = -light.direction;
+	sample.dist = 1e34f;
+	sample.radiance = light.radiance;
+	sample.pdf = pickProb;
+	return sample;
+}
+
+float Context::area_light_pdf(const glm::vec3 &origin, const Triangle &tri, float sq_dist, float cos_light) const
+{
+	const auto &areaLights = m_Lights.get_area_lights();
+	if (tri.lightTriIdx < 0 || tri.lightTriIdx >= static_cast<int>(areaLights.size()))
+		return 0.0f;
+
+	const float pickProb = m_Lights.pdf(origin, tri.lightTriIdx);
+	return pickProb * sq_dist / (cos_light * areaLights[tri.lightTriIdx].area);
+}
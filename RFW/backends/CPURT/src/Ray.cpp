@@ -47,6 +47,19 @@ cpurt::Ray cpurt::Ray::generateFromView(const cpurt::Ray::CameraParams &camera,
 }
 
 cpurt::RayPacket4 cpurt::Ray::generate_ray4(const CameraParams &camera, const int x[4], const int y[4], rfw::utils::rng *rng)
+{
+	float samples[4][4];
+	for (auto &dimension : samples)
+	{
+		for (float &sample : dimension)
+			sample = rng->rand();
+	}
+
+	return generate_ray4(camera, x, y, samples);
+}
+
+cpurt::RayPacket4 cpurt::Ray::generate_ray4(const CameraParams &camera, const int x[4], const int y[4],
+											 const float samples[4][4])
 {
 	cpurt::RayPacket4 query = {};
 
@@ -55,10 +68,10 @@ cpurt::RayPacket4 cpurt::Ray::generate_ray4(const CameraParams &camera, const in
 
 	static const __m128 one4 = _mm_set1_ps(1.0f);
 
-	const __m128 r04 = _mm_set_ps(rng->rand(), rng->rand(), rng->rand(), rng->rand());
-	const __m128 r14 = _mm_set_ps(rng->rand(), rng->rand(), rng->rand(), rng->rand());
-	__m128 r24 = _mm_set_ps(rng->rand(), rng->rand(), rng->rand(), rng->rand());
-	__m128 r34 = _mm_set_ps(rng->rand(), rng->rand(), rng->rand(), rng->rand());
+	const __m128 r04 = _mm_loadu_ps(samples[0]);
+	const __m128 r14 = _mm_loadu_ps(samples[1]);
+	__m128 r24 = _mm_loadu_ps(samples[2]);
+	__m128 r34 = _mm_loadu_ps(samples[3]);
 
 	const __m128 blade4 = _mm_mul_ps(r04, _mm_set1_ps(9.0f));
 
@@ -165,6 +178,19 @@ cpurt::RayPacket4 cpurt::Ray::generate_ray4(const CameraParams &camera, const in
 }
 
 cpurt::RayPacket8 cpurt::Ray::generate_ray8(const CameraParams &camera, const int x[8], const int y[8], rfw::utils::rng *rng)
+{
+	float samples[4][8];
+	for (auto &dimension : samples)
+	{
+		for (float &sample : dimension)
+			sample = rng->rand();
+	}
+
+	return generate_ray8(camera, x, y, samples);
+}
+
+cpurt::RayPacket8 cpurt::Ray::generate_ray8(const CameraParams &camera, const int x[8], const int y[8],
+											 const float samples[4][8])
 {
 	cpurt::RayPacket8 query = {};
 
@@ -190,10 +216,10 @@ cpurt::RayPacket8 cpurt::Ray::generate_ray8(const CameraParams &camera, const in
 		float r3[8];
 	};
 
-	r04 = _mm256_set_ps(rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand());
-	r14 = _mm256_set_ps(rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand());
-	r24 = _mm256_set_ps(rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand());
-	r34 = _mm256_set_ps(rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand(), rng->rand());
+	r04 = _mm256_loadu_ps(samples[0]);
+	r14 = _mm256_loadu_ps(samples[1]);
+	r24 = _mm256_loadu_ps(samples[2]);
+	r34 = _mm256_loadu_ps(samples[3]);
 
 	const __m256 blade4 = _mm256_mul_ps(r04, _mm256_set1_ps(9.0f));
 
@@ -125,5 +125,10 @@ struct Ray
 									rfw::utils::rng *rng);
 	static RayPacket8 generate_ray8(const CameraParams &camera, const int x[8], const int y[8],
 									rfw::utils::rng *rng);
+	// Samples hold the 4 random numbers of every ray, dimension by dimension
+	static RayPacket4 generate_ray4(const CameraParams &camera, const int x[4], const int y[4],
+									const float samples[4][4]);
+	static RayPacket8 generate_ray8(const CameraParams &camera, const int x[8], const int y[8],
+									const float samples[4][8]);
 };
 } // namespace cpurt
\ No newline at end of file
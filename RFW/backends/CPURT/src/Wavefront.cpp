@@ -0,0 +1,201 @@
+#include "PCH.h"
+
+using namespace rfw;
+
+// Number of paths shaded by a single task, output slots are reserved once per batch
+static constexpr size_t SHADE_BATCH_SIZE = 256;
+
+/*
+ * Paths are traced in stages over all paths of a pass at once: generate creates a primary path for every active pixel,
+ * extend traces the rays of all paths as a single stream, shade evaluates the hits grouped by material and writes
+ * the surviving paths and light samples to new streams, connect traces the light samples. Extend and shade are
+ * repeated until no paths are left. Contributions are gathered per pixel and accumulated once all paths finished.
+ */
+void Context::render_wavefront(const cpurt::Ray::CameraParams &camParams, int probe_id, int pass)
+{
+	generate(camParams, pass, probe_id);
+
+	unsigned int extensions = 0, shadows = 0;
+	for (int pathLength = 0;; pathLength++)
+	{
+		cpurt::PathStream &paths = m_PathStreams[pathLength & 1];
+		cpurt::PathStream &next = m_PathStreams[(pathLength + 1) & 1];
+		if (paths.size() == 0)
+			break;
+
+		auto timer = utils::timer();
+		extend(paths);
+		if (pathLength > 0)
+			m_Stats.secondaryTime += timer.elapsed();
+
+		if (pathLength == 0 && m_ProbePath >= 0)
+		{
+			m_ProbedDist = paths.hits.t[m_ProbePath];
+			m_ProbedInstance = paths.hits.inst_id[m_ProbePath];
+			m_ProbedTriangle = paths.hits.prim_id[m_ProbePath];
+		}
+
+		timer.reset();
+		sort_by_material(paths);
+		shade(paths, pathLength, next);
+		m_Stats.shadeTime += timer.elapsed();
+
+		timer.reset();
+		connect();
+		m_Stats.shadowTime += timer.elapsed();
+
+		extensions += static_cast<unsigned int>(next.size());
+		shadows += static_cast<unsigned int>(m_ShadowStream.size());
+	}
+
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, m_ActivePixels.size()), [&](const tbb::blocked_range<size_t> &r) {
+		for (size_t i = r.begin(), s = r.end(); i < s; i++)
+			accumulate(m_ActivePixels[i], m_SampleRadiance[m_ActivePixels[i]]);
+	});
+
+	m_Stats.secondaryCount += extensions;
+	m_Stats.shadowCount += shadows;
+}
+
+void Context::generate(const cpurt::Ray::CameraParams &camParams, int pass, int probe_id)
+{
+	cpurt::PathStream &paths = m_PathStreams[0];
+	paths.resize(m_ActivePixels.size());
+	m_SampleRadiance.resize(static_cast<size_t>(m_Width) * static_cast<size_t>(m_Height));
+	m_ProbePath = -1;
+
+	// Active pixels are ordered by tile, which keeps primary rays coherent
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, m_ActivePixels.size()), [&](const tbb::blocked_range<size_t> &r) {
+		for (size_t i = r.begin(), s = r.end(); i < s; i++)
+		{
+			const unsigned int pixelID = m_ActivePixels[i];
+			const int x = static_cast<int>(pixelID % m_Width);
+			const int y = static_cast<int>(pixelID / m_Width);
+
+			paths.set(i, pixelID, primary_path(camParams, x, y, pass));
+			m_SampleRadiance[pixelID] = vec3(0.0f);
+			if (static_cast<int>(pixelID) == probe_id)
+				m_ProbePath = static_cast<int>(i);
+		}
+	});
+}
+
+void Context::extend(cpurt::PathStream &paths) { topLevelBVH.intersect_stream(paths.rays, paths.hits); }
+
+void Context::sort_by_material(const cpurt::PathStream &paths)
+{
+	// Keys hold the material in the upper and the path index in the lower 32 bits, misses are shaded last
+	const size_t count = paths.size();
+	m_ShadeOrder.resize(count);
+
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, count), [&](const tbb::blocked_range<size_t> &r) {
+		for (size_t i = r.begin(), s = r.end(); i < s; i++)
+		{
+			const int instID = paths.hits.inst_id[i];
+			const uint64_t material =
+				instID < 0 ? 0xFFFFFFFFull : topLevelBVH.get_triangle(instID, paths.hits.prim_id[i]).material;
+			m_ShadeOrder[i] = (material << 32u) | static_cast<uint64_t>(i);
+		}
+	});
+
+	tbb::parallel_sort(m_ShadeOrder.begin(), m_ShadeOrder.end());
+}
+
+void Context::shade(const cpurt::PathStream &paths, int pathLength, cpurt::PathStream &next)
+{
+	// Every path produces at most one extension and one shadow ray
+	const size_t count = paths.size();
+	next.resize(count);
+	m_ShadowStream.resize(count);
+
+	std::atomic<size_t> nextCount = 0;
+	std::atomic<size_t> shadowCount = 0;
+
+	tbb::parallel_for(
+		tbb::blocked_range<size_t>(0, count, SHADE_BATCH_SIZE), [&](const tbb::blocked_range<size_t> &r) {
+			std::vector<std::pair<unsigned int, cpurt::PathVertex>> extended;
+			std::vector<std::pair<unsigned int, cpurt::ShadowRay>> shadowRays;
+			extended.reserve(r.size());
+			shadowRays.reserve(r.size());
+
+			for (size_t i = r.begin(), s = r.end(); i < s; i++)
+			{
+				const size_t idx = m_ShadeOrder[i] & 0xFFFFFFFFull;
+				const unsigned int pixelID = paths.pixel_id[idx];
+				const int instID = paths.hits.inst_id[idx];
+
+				cpurt::PathVertex path = paths.get(idx);
+				vec3 radiance = vec3(0.0f);
+
+				if (instID < 0)
+				{
+					radiance = path.throughput * sample_sky(path.direction);
+				}
+				else
+				{
+					const Triangle &tri = topLevelBVH.get_triangle(instID, paths.hits.prim_id[idx]);
+					cpurt::ShadowRay shadow;
+					if (shade_path(path, tri, instID, paths.hits.t[idx], pathLength, radiance, shadow))
+						extended.emplace_back(pixelID, path);
+					if (shadow.dist > 0.0f)
+						shadowRays.emplace_back(pixelID, shadow);
+				}
+
+				// Every pixel has at most a single path in the stream
+				m_SampleRadiance[pixelID] += radiance;
+			}
+
+			const size_t firstPath = nextCount.fetch_add(extended.size());
+			for (size_t i = 0, s = extended.size(); i < s; i++)
+				next.set(firstPath + i, extended[i].first, extended[i].second);
+
+			const size_t firstShadow = shadowCount.fetch_add(shadowRays.size());
+			for (size_t i = 0, s = shadowRays.size(); i < s; i++)
+				m_ShadowStream.set(firstShadow + i, shadowRays[i].first, shadowRays[i].second);
+		});
+
+	next.resize(nextCount.load());
+	m_ShadowStream.resize(shadowCount.load());
+}
+
+void Context::connect()
+{
+	const cpurt::ShadowStream &shadows = m_ShadowStream;
+	const bvh::RayStreamSoA &rays = shadows.rays;
+	const size_t count = shadows.size();
+
+	// Consecutive shadow rays were produced by paths with the same material and are tested as packets of 4
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, (count + 3) / 4), [&](const tbb::blocked_range<size_t> &r) {
+		for (size_t packet = r.begin(), s = r.end(); packet < s; packet++)
+		{
+			const size_t first = packet * 4;
+			float origin_x[4], origin_y[4], origin_z[4];
+			float dir_x[4], dir_y[4], dir_z[4];
+			float t_max[4];
+			int activeMask = 0;
+
+			for (int lane = 0; lane < 4; lane++)
+			{
+				const size_t i = glm::min(first + lane, count - 1);
+				origin_x[lane] = rays.origin_x[i];
+				origin_y[lane] = rays.origin_y[i];
+				origin_z[lane] = rays.origin_z[i];
+				dir_x[lane] = rays.dir_x[i];
+				dir_y[lane] = rays.dir_y[i];
+				dir_z[lane] = rays.dir_z[i];
+				t_max[lane] = rays.t_max[i];
+				if (first + lane < count)
+					activeMask |= 1 << lane;
+			}
+
+			// All shadow rays of a pass share the same minimum distance
+			const int occluded = topLevelBVH.is_occluded4(origin_x, origin_y, origin_z, dir_x, dir_y, dir_z, t_max,
+														  rays.t_min[first], activeMask);
+			for (int lane = 0; lane < 4; lane++)
+			{
+				if ((activeMask & ~occluded) & (1 << lane))
+					m_SampleRadiance[shadows.pixel_id[first + lane]] += shadows.contribution[first + lane];
+			}
+		}
+	});
+}
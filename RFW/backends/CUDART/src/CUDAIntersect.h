@@ -2,12 +2,25 @@
 
 #include <cuda_runtime.h>
 
+#include <cassert>
+
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
 #include "bvh/BVHNode.h"
 #include "bvh/MBVHNode.h"
 
+// Binary traversal keeps at most one pending sibling per level of a tree of BVH_MAX_DEPTH, 4-wide nodes up to three.
+// Deeper trees are rejected when meshes are uploaded, see CUDAContext::set_mesh.
+constexpr int BVH_STACK_SIZE = rfw::bvh::BVH_MAX_DEPTH + 1;
+constexpr int MBVH_STACK_SIZE = 3 * rfw::bvh::BVH_MAX_DEPTH + 1;
+
+template <typename T, int N> inline __host__ __device__ void push_node(T (&todo)[N], int &stackPtr, const T &entry)
+{
+	assert(stackPtr + 1 < N);
+	todo[++stackPtr] = entry;
+}
+
 inline __host__ __device__ bool intersect_triangle(const glm::vec3 &org, const glm::vec3 &dir, float tmin, float *rayt,
 												   const glm::vec4 &p04, const glm::vec4 &p14, const glm::vec4 &p24,
 												   const float epsilon = 1e-8f)
@@ -202,7 +215,7 @@ __host__ __device__ bool intersect_bvh(const glm::vec3 &org, const glm::vec3 &di
 									   const FUNC &intersection)
 {
 	bool valid = false;
-	rfw::bvh::BVHTraversal todo[32];
+	rfw::bvh::BVHTraversal todo[BVH_STACK_SIZE];
 	int stackPtr = 0;
 	float tNear1, tFar1;
 	float tNear2, tFar2;
@@ -238,28 +251,22 @@ __host__ __device__ bool intersect_bvh(const glm::vec3 &org, const glm::vec3 &di
 			{
 				if (tNear1 < tNear2)
 				{
-					stackPtr++;
-					todo[stackPtr] = {node.get_left_first()};
-					stackPtr++;
-					todo[stackPtr] = {node.get_left_first() + 1};
+					push_node(todo, stackPtr, rfw::bvh::BVHTraversal(node.get_left_first()));
+					push_node(todo, stackPtr, rfw::bvh::BVHTraversal(node.get_left_first() + 1));
 				}
 				else
 				{
-					stackPtr++;
-					todo[stackPtr] = {node.get_left_first() + 1};
-					stackPtr++;
-					todo[stackPtr] = {node.get_left_first()};
+					push_node(todo, stackPtr, rfw::bvh::BVHTraversal(node.get_left_first() + 1));
+					push_node(todo, stackPtr, rfw::bvh::BVHTraversal(node.get_left_first()));
 				}
 			}
 			else if (hit_left)
 			{
-				stackPtr++;
-				todo[stackPtr] = {node.get_left_first()};
+				push_node(todo, stackPtr, rfw::bvh::BVHTraversal(node.get_left_first()));
 			}
 			else if (hit_right)
 			{
-				stackPtr++;
-				todo[stackPtr] = {node.get_left_first() + 1};
+				push_node(todo, stackPtr, rfw::bvh::BVHTraversal(node.get_left_first() + 1));
 			}
 		}
 	}
@@ -273,7 +280,7 @@ __host__ __device__ bool intersect_mbvh(const glm::vec3 &org, const glm::vec3 &d
 										const FUNC &intersection)
 {
 	bool valid = false;
-	rfw::bvh::MBVHTraversal todo[32];
+	rfw::bvh::MBVHTraversal todo[MBVH_STACK_SIZE];
 	int stackptr = 0;
 
 	todo[0].leftFirst = 0;
@@ -310,9 +317,7 @@ __host__ __device__ bool intersect_mbvh(const glm::vec3 &org, const glm::vec3 &d
 				const int left_first = nodes[leftFirst].childs[idx];
 				if (left_first >= 0)
 				{
-					stackptr++;
-					todo[stackptr].leftFirst = left_first;
-					todo[stackptr].count = nodes[leftFirst].counts[idx];
+					push_node(todo, stackptr, rfw::bvh::MBVHTraversal{left_first, nodes[leftFirst].counts[idx]});
 				}
 			}
 		}
@@ -326,7 +331,7 @@ __host__ __device__ bool intersect_bvh_shadow(const glm::vec3 &org, const glm::v
 											  const rfw::bvh::BVHNode *nodes, const unsigned int *primIndices,
 											  const FUNC &intersection)
 {
-	rfw::bvh::BVHTraversal todo[32];
+	rfw::bvh::BVHTraversal todo[BVH_STACK_SIZE];
 	int stackPtr = 0;
 	float tNear1, tFar1;
 	float tNear2, tFar2;
@@ -359,28 +364,22 @@ __host__ __device__ bool intersect_bvh_shadow(const glm::vec3 &org, const glm::v
 			{
 				if (tNear1 < tNear2)
 				{
-					stackPtr++;
-					todo[stackPtr] = {node.get_left_first()};
-					stackPtr++;
-					todo[stackPtr] = {node.get_left_first() + 1};
+					push_node(todo, stackPtr, rfw::bvh::BVHTraversal(node.get_left_first()));
+					push_node(todo, stackPtr, rfw::bvh::BVHTraversal(node.get_left_first() + 1));
 				}
 				else
 				{
-					stackPtr++;
-					todo[stackPtr] = {node.get_left_first() + 1};
-					stackPtr++;
-					todo[stackPtr] = {node.get_left_first()};
+					push_node(todo, stackPtr, rfw::bvh::BVHTraversal(node.get_left_first() + 1));
+					push_node(todo, stackPtr, rfw::bvh::BVHTraversal(node.get_left_first()));
 				}
 			}
 			else if (hit_left)
 			{
-				stackPtr++;
-				todo[stackPtr] = {node.get_left_first()};
+				push_node(todo, stackPtr, rfw::bvh::BVHTraversal(node.get_left_first()));
 			}
 			else if (hit_right)
 			{
-				stackPtr++;
-				todo[stackPtr] = {node.get_left_first() + 1};
+				push_node(todo, stackPtr, rfw::bvh::BVHTraversal(node.get_left_first() + 1));
 			}
 		}
 	}
@@ -393,7 +392,7 @@ __host__ __device__ bool intersect_mbvh_shadow(const glm::vec3 &org, const glm::
 											   const rfw::bvh::MBVHNode *nodes, const unsigned int *primIndices,
 											   const FUNC &intersection)
 {
-	rfw::bvh::MBVHTraversal todo[32];
+	rfw::bvh::MBVHTraversal todo[MBVH_STACK_SIZE];
 	int stackptr = 0;
 
 	todo[0].leftFirst = 0;
@@ -427,9 +426,7 @@ __host__ __device__ bool intersect_mbvh_shadow(const glm::vec3 &org, const glm::
 				const int left_first = nodes[leftFirst].childs[idx];
 				if (left_first >= 0)
 				{
-					stackptr++;
-					todo[stackptr].leftFirst = left_first;
-					todo[stackptr].count = nodes[leftFirst].counts[idx];
+					push_node(todo, stackptr, rfw::bvh::MBVHTraversal{left_first, nodes[leftFirst].counts[idx]});
 				}
 			}
 		}
@@ -283,31 +283,38 @@ void rfw::CUDAContext::set_mesh(size_t index, const rfw::Mesh &mesh)
 
 	std::unique_ptr<bvh::rfwMesh> &m = m_Meshes[index];
 
+	const bvh::BVHTree *previous = m->bvh.get();
 	m->set_geometry(mesh);
 
-	if (m_MeshBVHs[index]->size() != m->bvh->instance.value().node_count)
+	// Traversal stacks are sized for BVH_MAX_DEPTH, builders without a depth limit can produce deeper trees. Refits
+	// keep the tree and thus its depth.
+	if (m->bvh.get() != previous)
+	{
+		const int depth =
+			glm::max(bvh::stats::compute(m->bvh->nodes).max_depth, bvh::stats::compute(m->mbvh->nodes).max_depth);
+		if (depth > bvh::BVH_MAX_DEPTH)
+			FAILURE("BVH of mesh %zu is %i levels deep, CUDART traverses at most %i levels.", index, depth,
+					bvh::BVH_MAX_DEPTH);
+	}
+
+	if (m_MeshBVHs[index]->size() != m->bvh->nodes.size())
 	{
 		m_MeshVertices[index] = std::make_unique<CUDABuffer<glm::vec4>>(m->vertexCount);
 		m_MeshIndices[index] = std::make_unique<CUDABuffer<glm::uvec3>>(m->triangleCount);
 		m_MeshTriangles[index] = std::make_unique<CUDABuffer<rfw::DeviceTriangle>>(m->triangleCount);
-		m_MeshBVHs[index] = std::make_unique<CUDABuffer<bvh::BVHNode>>(m->bvh->instance.value().node_count, ON_DEVICE);
-		m_MeshMBVHs[index] =
-			std::make_unique<CUDABuffer<bvh::MBVHNode>>(m->mbvh->instance.value().node_count, ON_DEVICE);
+		m_MeshBVHs[index] = std::make_unique<CUDABuffer<bvh::BVHNode>>(m->bvh->nodes.size(), ON_DEVICE);
+		m_MeshMBVHs[index] = std::make_unique<CUDABuffer<bvh::MBVHNode>>(m->mbvh->nodes.size(), ON_DEVICE);
 		m_MeshBVHPrimIndices[index] =
-			std::make_unique<CUDABuffer<unsigned int>>(m->bvh->instance.value().index_count, ON_DEVICE);
+			std::make_unique<CUDABuffer<unsigned int>>(m->bvh->prim_indices.size(), ON_DEVICE);
 	}
 
 	m_MeshVertices[index]->copy_to_device_async(m->vertices, m->vertexCount);
 	if (m->indices)
 		m_MeshIndices[index]->copy_to_device_async(m->indices, m->triangleCount);
 	m_MeshTriangles[index]->copy_to_device_async((rfw::DeviceTriangle *)(m->triangles), m->triangleCount);
-	m_MeshBVHs[index]->copy_to_device_async(reinterpret_cast<const rfw::bvh::BVHNode *>(m->bvh->instance.value().nodes),
-											m->bvh->instance.value().node_count);
-	m_MeshMBVHs[index]->copy_to_device_async(
-		reinterpret_cast<const rfw::bvh::MBVHNode *>(m->mbvh->instance.value().nodes),
-		m->mbvh->instance.value().node_count);
-	m_MeshBVHPrimIndices[index]->copy_to_device_async(m->bvh->instance.value().indices,
-													  m->bvh->instance.value().index_count);
+	m_MeshBVHs[index]->copy_to_device_async(m->bvh->nodes.data(), m->bvh->nodes.size());
+	m_MeshMBVHs[index]->copy_to_device_async(m->mbvh->nodes.data(), m->mbvh->nodes.size());
+	m_MeshBVHPrimIndices[index]->copy_to_device_async(m->bvh->prim_indices.data(), m->bvh->prim_indices.size());
 }
 
 void rfw::CUDAContext::set_instance(size_t i, size_t meshIdx, const mat4 &transform, const mat3 &inverse_transform)
@@ -389,11 +396,15 @@ void rfw::CUDAContext::get_probe_results(unsigned int *instanceIndex, unsigned i
 
 rfw::AvailableRenderSettings rfw::CUDAContext::get_settings() const { return {}; }
 
-void rfw::CUDAContext::set_setting(const rfw::RenderSetting &setting) {}
+void rfw::CUDAContext::set_setting(const rfw::RenderSetting &setting)
+{
+	if (setting.name == "bvh_cache_directory")
+		bvh::cache::set_directory(setting.value);
+}
 
 void rfw::CUDAContext::update()
 {
-	auto build_handle = std::async([&]() { m_TopLevelBVH.construct_bvh(); });
+	auto build_handle = std::async([&]() { m_TopLevelBVH.refit(); });
 	if (!m_InstanceDescriptors || m_InstanceDescriptors->size() < m_InstanceMeshIDs.size())
 		m_InstanceDescriptors = std::make_unique<CUDABuffer<InstanceBVHDescriptor>>(m_InstanceMeshIDs.size(), ON_ALL);
 
@@ -421,26 +432,22 @@ void rfw::CUDAContext::update()
 	m_InstanceDescriptors->copy_to_device_async();
 	build_handle.get();
 
-	if (!m_TopLevelCUDABVH || m_TopLevelCUDABVH->size() < m_TopLevelBVH.bvh.value().node_count)
-		m_TopLevelCUDABVH = std::make_unique<CUDABuffer<bvh::BVHNode>>(m_TopLevelBVH.bvh.value().node_count, ON_DEVICE);
-	if (!m_TopLevelCUDAMBVH || m_TopLevelCUDAMBVH->size() < m_TopLevelBVH.mbvh.value().node_count)
-		m_TopLevelCUDAMBVH =
-			std::make_unique<CUDABuffer<bvh::MBVHNode>>(m_TopLevelBVH.mbvh.value().node_count, ON_DEVICE);
-	if (!m_TopLevelCUDAPrimIndices || m_TopLevelCUDAPrimIndices->size() < m_TopLevelBVH.bvh.value().index_count)
-		m_TopLevelCUDAPrimIndices =
-			std::make_unique<CUDABuffer<uint>>(m_TopLevelBVH.bvh.value().index_count, ON_DEVICE);
+	if (!m_TopLevelCUDABVH || m_TopLevelCUDABVH->size() < m_TopLevelBVH.bvh_nodes.size())
+		m_TopLevelCUDABVH = std::make_unique<CUDABuffer<bvh::BVHNode>>(m_TopLevelBVH.bvh_nodes.size(), ON_DEVICE);
+	if (!m_TopLevelCUDAMBVH || m_TopLevelCUDAMBVH->size() < m_TopLevelBVH.mbvh_nodes.size())
+		m_TopLevelCUDAMBVH = std::make_unique<CUDABuffer<bvh::MBVHNode>>(m_TopLevelBVH.mbvh_nodes.size(), ON_DEVICE);
+	if (!m_TopLevelCUDAPrimIndices || m_TopLevelCUDAPrimIndices->size() < m_TopLevelBVH.prim_indices.size())
+		m_TopLevelCUDAPrimIndices = std::make_unique<CUDABuffer<uint>>(m_TopLevelBVH.prim_indices.size(), ON_DEVICE);
 	if (!m_CUDAInstanceTransforms || m_CUDAInstanceTransforms->size() < m_TopLevelBVH.matrices.size())
 	{
 		m_CUDAInstanceTransforms = std::make_unique<CUDABuffer<glm::mat4>>(m_TopLevelBVH.matrices.size(), ON_DEVICE);
 		m_CUDAInverseTransforms = std::make_unique<CUDABuffer<glm::mat4>>(m_TopLevelBVH.matrices.size(), ON_DEVICE);
 	}
 
-	m_TopLevelCUDABVH->copy_to_device_async(reinterpret_cast<const bvh::BVHNode *>(m_TopLevelBVH.bvh.value().nodes),
-											m_TopLevelBVH.bvh.value().node_count);
-	m_TopLevelCUDAMBVH->copy_to_device_async(reinterpret_cast<const bvh::MBVHNode *>(m_TopLevelBVH.mbvh.value().nodes),
-											 m_TopLevelBVH.mbvh.value().node_count);
-	m_TopLevelCUDAPrimIndices->copy_to_device_async(m_TopLevelBVH.bvh.value().indices,
-													m_TopLevelBVH.bvh.value().index_count);
+	m_TopLevelCUDABVH->copy_to_device_async(m_TopLevelBVH.bvh_nodes.data(), m_TopLevelBVH.bvh_nodes.size());
+	m_TopLevelCUDAMBVH->copy_to_device_async(m_TopLevelBVH.mbvh_nodes.data(), m_TopLevelBVH.mbvh_nodes.size());
+	m_TopLevelCUDAPrimIndices->copy_to_device_async(m_TopLevelBVH.prim_indices.data(),
+													m_TopLevelBVH.prim_indices.size());
 
 	m_CUDAInstanceTransforms->copy_to_device_async((glm::mat4 *)m_TopLevelBVH.matrices.data(),
 												   m_TopLevelBVH.matrices.size());
@@ -18,6 +18,82 @@ void createTangentSpace(const vec3 N, vec3 &T, vec3 &B)
 
 vec3 tangentToWorld(const vec3 s, const vec3 N, const vec3 T, const vec3 B) { return T * s.x + B * s.y + N * s.z; }
 
+// Shadow rays of a tile use the native packet types, wider tiles are traced as a stream
+template <int N> struct ShadowPacket
+{
+	using type = RTCRayNt<N>;
+};
+template <> struct ShadowPacket<4>
+{
+	using type = RTCRay4;
+};
+template <> struct ShadowPacket<8>
+{
+	using type = RTCRay8;
+};
+template <> struct ShadowPacket<16>
+{
+	using type = RTCRay16;
+};
+
+template <int N> static RTCRayNp stream_of(RTCRayNt<N> &rays)
+{
+	RTCRayNp stream;
+	stream.org_x = rays.org_x;
+	stream.org_y = rays.org_y;
+	stream.org_z = rays.org_z;
+	stream.tnear = rays.tnear;
+	stream.dir_x = rays.dir_x;
+	stream.dir_y = rays.dir_y;
+	stream.dir_z = rays.dir_z;
+	stream.time = rays.time;
+	stream.tfar = rays.tfar;
+	stream.mask = rays.mask;
+	stream.id = rays.id;
+	stream.flags = rays.flags;
+	return stream;
+}
+
+template <int N> static RTCRayHitNp stream_of(RTCRayHitNt<N> &packet)
+{
+	RTCRayHitNp stream;
+	stream.ray = stream_of(packet.ray);
+	stream.hit.Ng_x = packet.hit.Ng_x;
+	stream.hit.Ng_y = packet.hit.Ng_y;
+	stream.hit.Ng_z = packet.hit.Ng_z;
+	stream.hit.u = packet.hit.u;
+	stream.hit.v = packet.hit.v;
+	stream.hit.primID = packet.hit.primID;
+	stream.hit.geomID = packet.hit.geomID;
+	for (int i = 0; i < RTC_MAX_INSTANCE_LEVEL_COUNT; i++)
+		stream.hit.instID[i] = packet.hit.instID[i];
+	return stream;
+}
+
+// Streams have no valid mask, their inactive rays are disabled by a negative tfar
+template <int N>
+static void trace_occlusion(const int *valid, RTCScene scene, RTCIntersectContext *context,
+							typename ShadowPacket<N>::type *rays)
+{
+	if constexpr (N == 4)
+	{
+		rtcOccluded4(valid, scene, context, rays);
+	}
+	else if constexpr (N == 8)
+	{
+		rtcOccluded8(valid, scene, context, rays);
+	}
+	else if constexpr (N == 16)
+	{
+		rtcOccluded16(valid, scene, context, rays);
+	}
+	else
+	{
+		const RTCRayNp stream = stream_of(*rays);
+		rtcOccludedNp(scene, context, &stream, N);
+	}
+}
+
 vec3 worldToTangent(const vec3 s, const vec3 N, const vec3 T, const vec3 B)
 {
 	return vec3(dot(T, s), dot(B, s), dot(N, s));
@@ -31,14 +107,16 @@ void destroyRenderContext(rfw::RenderContext *ptr) { ptr->cleanup(), delete ptr;
 
 Context::~Context()
 {
-	glDeleteBuffers(1, &m_PboID);
 	rtcReleaseScene(m_Scene);
 	m_Scene = nullptr;
 	rtcReleaseDevice(m_Device);
 	m_Device = nullptr;
 }
 
-std::vector<rfw::RenderTarget> Context::get_supported_targets() const { return {rfw::RenderTarget::OPENGL_TEXTURE}; }
+std::vector<rfw::RenderTarget> Context::get_supported_targets() const
+{
+	return {rfw::RenderTarget::OPENGL_TEXTURE, rfw::RenderTarget::BUFFER};
+}
 
 void Context::init(std::shared_ptr<rfw::utils::window> &window) { utils::logger::err("Window not supported (yet)."); }
 
@@ -64,16 +142,23 @@ void rtcErrorFunc(void *userPtr, enum RTCError code, const char *str)
 	}
 }
 
+void Context::init_device()
+{
+	if (m_Device)
+		return;
+
+	std::vector<char> config(512, 0);
+	utils::string::format(config.data(), "threads=%ul", std::thread::hardware_concurrency());
+	m_Device = rtcNewDevice(config.data());
+	m_Scene = rtcNewScene(m_Device);
+	rtcSetDeviceErrorFunction(m_Device, rtcErrorFunc, nullptr);
+}
+
 void Context::init(GLuint *glTextureID, uint width, uint height)
 {
+	init_device();
 	if (!m_InitializedGlew)
 	{
-		std::vector<char> config(512, 0);
-		utils::string::format(config.data(), "threads=%ul", std::thread::hardware_concurrency());
-		m_Device = rtcNewDevice(config.data());
-		m_Scene = rtcNewScene(m_Device);
-		rtcSetDeviceErrorFunction(m_Device, rtcErrorFunc, nullptr);
-
 		const auto error = glewInit();
 		if (error != GLEW_NO_ERROR)
 		{
@@ -81,33 +166,41 @@ void Context::init(GLuint *glTextureID, uint width, uint height)
 		}
 		m_InitializedGlew = true;
 		CheckGL();
-		glGenBuffers(1, &m_PboID);
 	}
 
 	m_Width = static_cast<int>(width);
 	m_Height = static_cast<int>(height);
 	m_TargetID = *glTextureID;
+	m_TargetBuffer = nullptr;
+
+	m_PixelBuffers.resize(static_cast<size_t>(m_Width) * static_cast<size_t>(m_Height) * sizeof(glm::vec4));
+}
+
+void Context::init(glm::vec4 *buffer, uint width, uint height)
+{
+	init_device();
 
-	CheckGL();
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, m_PboID);
-	CheckGL();
-	std::vector<glm::vec4> dummyData(m_Width * m_Height, glm::vec4(0));
-	glBufferData(GL_PIXEL_UNPACK_BUFFER_ARB, m_Width * m_Height * sizeof(glm::vec4), dummyData.data(),
-				 GL_STREAM_DRAW_ARB);
-	CheckGL();
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
-	CheckGL();
+	m_Width = static_cast<int>(width);
+	m_Height = static_cast<int>(height);
+	m_TargetBuffer = buffer;
 }
 
 void Context::cleanup() {}
 
 void Context::render_frame(const rfw::Camera &camera, rfw::RenderStatus status)
 {
-	glFinish();
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, m_PboID);
-	m_Pixels = static_cast<glm::vec4 *>(glMapBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, GL_WRITE_ONLY_ARB));
-	assert(m_Pixels);
-	CheckGL();
+	if (status == Reset)
+		m_SampleIndex = 0;
+
+	if (m_TargetBuffer)
+	{
+		m_Pixels = m_TargetBuffer;
+	}
+	else
+	{
+		m_Pixels = static_cast<glm::vec4 *>(m_PixelBuffers.acquire());
+		assert(m_Pixels);
+	}
 
 	const auto camParams = Ray::CameraParams(camera.get_view(), 0, 1e-5f, m_Width, m_Height);
 
@@ -116,26 +209,57 @@ void Context::render_frame(const rfw::Camera &camera, rfw::RenderStatus status)
 
 	auto timer = utils::timer();
 
-	const int maxPixelID = m_Width * m_Height;
-	const __m128i maxPixelID4 = _mm_set1_epi32(maxPixelID - 1);
-	const __m256i maxPixelID8 = _mm256_set1_epi32(maxPixelID - 1);
-	const int probe_id = m_ProbePos.y * m_Width + m_ProbePos.x;
-
+	switch (m_TraceMode)
+	{
+	case TraceMode::Packet16:
+		render_tiles<4, 4>(camParams);
+		break;
+	case TraceMode::Stream:
+		render_tiles<STREAM_TILE_SIZE, STREAM_TILE_SIZE>(camParams);
+		break;
+	case TraceMode::Packet:
+	default:
 #if PACKET_WIDTH == 4
-	constexpr int TILE_WIDTH = 4;
-	constexpr int TILE_HEIGHT = 1;
-	const int x_offs[4] = {0, 1, 0, 1};
-	const int y_offs[4] = {0, 0, 1, 1};
+		render_tiles<4, 1>(camParams);
 #elif PACKET_WIDTH == 8
-	constexpr int TILE_WIDTH = 4;
-	constexpr int TILE_HEIGHT = 2;
-
-	const int x_offs[8] = {0, 1, 2, 3, 0, 1, 2, 3};
-	const int y_offs[8] = {0, 0, 0, 0, 1, 1, 1, 1};
+		render_tiles<4, 2>(camParams);
 #endif
+		break;
+	}
+
+	m_Stats.primaryTime = timer.elapsed();
+	m_SampleIndex++;
+
+	if (m_TargetBuffer)
+		return;
+
+	m_PixelBuffers.upload(m_TargetID, m_Width, m_Height, GL_RGBA, GL_FLOAT);
+}
+
+template <int WIDTH, int HEIGHT> void Context::render_tiles(const Ray::CameraParams &camParams)
+{
+	constexpr int N = WIDTH * HEIGHT;
+	const int probe_id = m_ProbePos.y * m_Width + m_ProbePos.x;
+	const int maxPixelID = m_Width * m_Height;
+
+	// Tiles on the right and bottom edge may extend past the target, their outside lanes are disabled
+	const int tile_rows = (m_Height + HEIGHT - 1) / HEIGHT;
+	const int tile_cols = (m_Width + WIDTH - 1) / WIDTH;
+
+	// Inactive lanes are skipped by packet traversal through valid, by stream traversal because tnear > tfar and by
+	// shading because their id is out of range
+	const auto disable_lanes = [&](auto &packet, const int *valid) {
+		for (int i = 0; i < N; i++)
+		{
+			if (valid[i])
+				continue;
+			packet.ray.tfar[i] = -1.0f;
+			packet.ray.id[i] = maxPixelID;
+		}
+	};
 
 	tbb::parallel_for(
-		tbb::blocked_range2d<int, int>(0, m_Height / TILE_HEIGHT, 0, m_Width / TILE_WIDTH),
+		tbb::blocked_range2d<int, int>(0, tile_rows, 0, tile_cols),
 		[&](const tbb::blocked_range2d<int, int> &r) {
 			const auto rows = r.rows();
 			const auto cols = r.cols();
@@ -145,7 +269,7 @@ void Context::render_frame(const rfw::Camera &camera, rfw::RenderStatus status)
 			rtcInitIntersectContext(&shadow_context);
 			context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
 			shadow_context.flags = RTC_INTERSECT_CONTEXT_FLAG_INCOHERENT;
-			int valid[PACKET_WIDTH];
+			alignas(64) int valid[N];
 
 			for (int y_l = rows.begin(); y_l < rows.end(); y_l++)
 			{
@@ -153,150 +277,204 @@ void Context::render_frame(const rfw::Camera &camera, rfw::RenderStatus status)
 				{
 					memset(valid, -1, sizeof(valid));
 
-					const int x = x_l * TILE_WIDTH;
-					const int y = y_l * TILE_HEIGHT;
+					const int x = x_l * WIDTH;
+					const int y = y_l * HEIGHT;
 
-					int xs[PACKET_WIDTH];
-					int ys[PACKET_WIDTH];
+					int xs[N];
+					int ys[N];
 
-					for (int i = 0; i < PACKET_WIDTH; i++)
+					for (int i = 0; i < N; i++)
 					{
-						xs[i] = x + x_offs[i];
-						ys[i] = y + y_offs[i];
+						xs[i] = x + i % WIDTH;
+						ys[i] = y + i / WIDTH;
+						if (xs[i] >= m_Width || ys[i] >= m_Height)
+							valid[i] = 0;
 					}
 
-#if PACKET_WIDTH == 4
-					auto packet = Ray::GenerateRay4(camParams, xs, ys, &m_Rng);
-#elif PACKET_WIDTH == 8
-					auto packet = Ray::GenerateRay8(camParams, xs, ys, m_Rng);
-#endif
+					// Every tile gets its own generator, seeded by its first pixel and the frame's sample index
+					auto rng = utils::sample_rng(y * m_Width + x, m_SampleIndex);
 
-#if PACKET_WIDTH == 4
-					rtcIntersect4(valid, m_Scene, &context, &packet);
-#elif PACKET_WIDTH == 8
-					rtcIntersect8(valid, m_Scene, &context, &packet);
+					// The fifth dimension is the time of the ray within the frame when motion blur is enabled
+					float samples[4][N];
+					float times[N];
+					for (int i = 0; i < N; i++)
+					{
+#if BLUENOISE
+						const auto sampler = rfw::BlueNoiseSampler(xs[i], ys[i], m_SampleIndex);
+						for (int dimension = 0; dimension < 4; dimension++)
+							samples[dimension][i] = sampler.get(dimension);
+						times[i] = m_MotionBlur ? sampler.get(4) : 1.0f;
+#else
+						for (int dimension = 0; dimension < 4; dimension++)
+							samples[dimension][i] = rng.rand();
+						times[i] = m_MotionBlur ? rng.rand() : 1.0f;
 #endif
-					for (int j = 0; j < PACKET_WIDTH; j++)
+					}
+
+					if constexpr (N == 4)
+					{
+						auto packet = Ray::GenerateRay4(camParams, xs, ys, samples);
+						memcpy(packet.ray.time, times, sizeof(times));
+						disable_lanes(packet, valid);
+						rtcIntersect4(valid, m_Scene, &context, &packet);
+						shade_tile<N>(packet, rng, probe_id, &shadow_context);
+					}
+					else if constexpr (N == 8)
+					{
+						auto packet = Ray::GenerateRay8(camParams, xs, ys, samples);
+						memcpy(packet.ray.time, times, sizeof(times));
+						disable_lanes(packet, valid);
+						rtcIntersect8(valid, m_Scene, &context, &packet);
+						shade_tile<N>(packet, rng, probe_id, &shadow_context);
+					}
+					else if constexpr (N == 16)
 					{
-						const vec3 origin = vec3(packet.ray.org_x[j], packet.ray.org_y[j], packet.ray.org_z[j]);
-						const vec3 direction = vec3(packet.ray.dir_x[j], packet.ray.dir_y[j], packet.ray.dir_z[j]);
-
-						const int &pixel_id = packet.ray.id[j];
-						if (pixel_id >= maxPixelID)
-							continue;
-						if (packet.hit.geomID[j] == RTC_INVALID_GEOMETRY_ID)
-						{
-							const vec2 uv =
-								vec2(0.5f * (1.0f + atan(direction.x, -direction.z) * glm::one_over_pi<float>()),
-									 acos(direction.y) * glm::one_over_pi<float>());
-							const uvec2 pUv = uvec2(uv.x * static_cast<float>(m_SkyboxWidth - 1),
-													uv.y * static_cast<float>(m_SkyboxHeight - 1));
-							m_Pixels[pixel_id] = glm::vec4(m_Skybox[pUv.y * m_SkyboxWidth + pUv.x], 0.0f);
-							continue;
-						}
-
-						const int &instID = packet.hit.instID[0][j];
-						const int &primID = packet.hit.primID[j];
-
-						if (pixel_id == probe_id)
-						{
-							m_ProbedDist = packet.ray.tfar[j];
-							m_ProbedInstance = instID;
-							m_ProbedTriangle = primID;
-						}
-
-						const simd::matrix4 &normal_matrix = m_InverseMatrices[instID];
-						const Triangle &tri = m_Meshes[m_InstanceMesh[instID]].triangles[primID];
-						const vec3 bary =
-							vec3(1.0f - packet.hit.u[j] - packet.hit.v[j], packet.hit.u[j], packet.hit.v[j]);
-						const vec3 p = origin + direction * packet.ray.tfar[j];
-
-						const auto &material = m_Materials[tri.material];
-						const auto shading_data = retrieve_material(tri, material, p, bary, normal_matrix);
-						if (any(greaterThan(shading_data.color, vec3(1))))
-						{
-							m_Pixels[pixel_id] = vec4(shading_data.color, 1.0f);
-							continue;
-						}
-
-						RTCRay ray{};
-						ray.tnear = 1e-4f;
-						ray.org_x = p.x;
-						ray.org_y = p.y;
-						ray.org_z = p.z;
-
-						vec3 contrib = vec3(0.1f);
-						for (const auto &l : m_AreaLights)
-						{
-							vec3 L = l.position - p;
-							const float sq_dist = dot(L, L);
-							const float dist = sqrt(sq_dist);
-							L = L / dist;
-							const float NdotL = dot(shading_data.iN, L);
-							const float LNdotL = -dot(l.normal, L);
-
-							if (NdotL <= 0 || LNdotL <= 0)
-								continue;
-
-							ray.tfar = dist;
-							ray.flags = 0;
-							ray.dir_x = L.x;
-							ray.dir_y = L.y;
-							ray.dir_z = L.z;
-
-							rtcOccluded1(m_Scene, &shadow_context, &ray);
-							if (ray.tfar > 0)
-								contrib += l.radiance * l.area / sq_dist * NdotL * LNdotL;
-						}
-
-						for (const auto &l : m_PointLights)
-						{
-							vec3 L = l.position - p;
-							const float sq_dist = dot(L, L);
-							const float dist = sqrt(sq_dist);
-							L = L / dist;
-							const float NdotL = dot(shading_data.iN, L);
-							if (NdotL <= 0)
-								continue;
-
-							ray.tfar = dist;
-							ray.flags = 0;
-							ray.dir_x = L.x;
-							ray.dir_y = L.y;
-							ray.dir_z = L.z;
-
-							rtcOccluded1(m_Scene, &shadow_context, &ray);
-							if (ray.tfar > 0)
-								contrib += l.radiance / sq_dist * NdotL;
-						}
-
-						// for (const auto &l : m_DirectionalLights)
-						//{
-						//}
-
-						// for (const auto &l : m_SpotLights)
-						//{
-						//}
-
-						m_Pixels[pixel_id] = vec4(shading_data.color * contrib, 1.0f);
+						auto packet = Ray::GenerateRay16(camParams, xs, ys, samples);
+						memcpy(packet.ray.time, times, sizeof(times));
+						disable_lanes(packet, valid);
+						rtcIntersect16(valid, m_Scene, &context, &packet);
+						shade_tile<N>(packet, rng, probe_id, &shadow_context);
+					}
+					else
+					{
+						// Tiles wider than a packet are traced as a single stream, Embree splits it into packets
+						auto stream = Ray::GenerateRayN<N>(camParams, xs, ys, samples);
+						memcpy(stream.ray.time, times, sizeof(times));
+						disable_lanes(stream, valid);
+						const RTCRayHitNp rays = stream_of(stream);
+						rtcIntersectNp(m_Scene, &context, &rays, N);
+						shade_tile<N>(stream, rng, probe_id, &shadow_context);
 					}
 				}
 			}
 		});
+}
 
-	m_Stats.primaryTime = timer.elapsed();
+template <int N, typename Packet>
+void Context::shade_tile(const Packet &packet, utils::sample_rng &rng, int probe_id,
+						 RTCIntersectContext *shadow_context)
+{
+	const int maxPixelID = m_Width * m_Height;
+
+	// Lanes are shaded first so the shadow rays of the whole packet can be traced together
+	vec3 positions[N], normals[N], colors[N];
+	bool shaded[N] = {};
+
+	for (int j = 0; j < N; j++)
+	{
+		const vec3 origin = vec3(packet.ray.org_x[j], packet.ray.org_y[j], packet.ray.org_z[j]);
+		const vec3 direction = vec3(packet.ray.dir_x[j], packet.ray.dir_y[j], packet.ray.dir_z[j]);
+
+		const int &pixel_id = packet.ray.id[j];
+		if (pixel_id >= maxPixelID)
+			continue;
+		if (packet.hit.geomID[j] == RTC_INVALID_GEOMETRY_ID)
+		{
+			const vec2 uv = vec2(0.5f * (1.0f + atan(direction.x, -direction.z) * glm::one_over_pi<float>()),
+								 acos(direction.y) * glm::one_over_pi<float>());
+			const uvec2 pUv =
+				uvec2(uv.x * static_cast<float>(m_SkyboxWidth - 1), uv.y * static_cast<float>(m_SkyboxHeight - 1));
+			m_Pixels[pixel_id] = glm::vec4(m_Skybox[pUv.y * m_SkyboxWidth + pUv.x], 0.0f);
+			continue;
+		}
+
+		const int &instID = packet.hit.instID[0][j];
+		const int &primID = packet.hit.primID[j];
+
+		if (pixel_id == probe_id)
+		{
+			m_ProbedDist = packet.ray.tfar[j];
+			m_ProbedInstance = instID;
+			m_ProbedTriangle = primID;
+		}
+
+		const simd::matrix4 &normal_matrix = m_InverseMatrices[instID];
+		const Triangle &tri = m_Meshes[m_InstanceMesh[instID]].triangles[primID];
+		const vec3 bary = vec3(1.0f - packet.hit.u[j] - packet.hit.v[j], packet.hit.u[j], packet.hit.v[j]);
+		const vec3 p = origin + direction * packet.ray.tfar[j];
+
+		const auto &material = m_Materials[tri.material];
+		const auto shading_data = retrieve_material(tri, material, p, bary, normal_matrix);
+		if (any(greaterThan(shading_data.color, vec3(1))))
+		{
+			m_Pixels[pixel_id] = vec4(shading_data.color, 1.0f);
+			continue;
+		}
+
+		positions[j] = p;
+		normals[j] = shading_data.iN;
+		colors[j] = shading_data.color;
+		shaded[j] = true;
+	}
 
-	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER_ARB);
-	CheckGL();
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, m_PboID);
-	CheckGL();
-	glBindTexture(GL_TEXTURE_2D, m_TargetID);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_Width, m_Height, GL_RGBA, GL_FLOAT, 0);
-	CheckGL();
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
-	CheckGL();
-
-	glFinish();
+	vec3 contrib[N];
+	for (int j = 0; j < N; j++)
+		contrib[j] = vec3(0.1f);
+
+	for (int i = 0; i < m_ShadowRays; i++)
+	{
+		typename ShadowPacket<N>::type shadow{};
+		alignas(64) int shadow_valid[N] = {};
+		for (int j = 0; j < N; j++)
+			shadow.tfar[j] = -1.0f;
+		vec3 radiance[N];
+		bool any_valid = false;
+
+		for (int j = 0; j < N; j++)
+		{
+			if (!shaded[j])
+				continue;
+
+			const vec3 &p = positions[j];
+			float pickProb;
+			const int light = m_Lights.pick(p, rng.rand(), &pickProb);
+			if (light < 0 || pickProb <= 0.0f)
+				continue;
+
+			vec3 L;
+			float dist;
+			if (!m_Lights.connect(light, p, normals[j], &L, &dist, &radiance[j]))
+				continue;
+			radiance[j] /= pickProb * static_cast<float>(m_ShadowRays);
+
+			shadow.org_x[j] = p.x;
+			shadow.org_y[j] = p.y;
+			shadow.org_z[j] = p.z;
+			shadow.tnear[j] = 1e-4f;
+			shadow.dir_x[j] = L.x;
+			shadow.dir_y[j] = L.y;
+			shadow.dir_z[j] = L.z;
+			shadow.tfar[j] = dist;
+			shadow.time[j] = packet.ray.time[j];
+			shadow_valid[j] = -1;
+			any_valid = true;
+		}
+
+		if (!any_valid)
+			continue;
+
+		// Occluded rays get their tfar set to -inf
+		trace_occlusion<N>(shadow_valid, m_Scene, shadow_context, &shadow);
+		for (int j = 0; j < N; j++)
+		{
+			if (shadow_valid[j] && shadow.tfar[j] > 0)
+				contrib[j] += radiance[j];
+		}
+	}
+
+	// for (const auto &l : m_DirectionalLights)
+	//{
+	//}
+
+	// for (const auto &l : m_SpotLights)
+	//{
+	//}
+
+	for (int j = 0; j < N; j++)
+	{
+		if (shaded[j])
+			m_Pixels[packet.ray.id[j]] = vec4(colors[j] * contrib[j], 1.0f);
+	}
 }
 
 void Context::set_materials(const std::vector<rfw::DeviceMaterial> &materials,
@@ -304,6 +482,9 @@ void Context::set_materials(const std::vector<rfw::DeviceMaterial> &materials,
 {
 	m_Materials.resize(materials.size());
 	memcpy(m_Materials.data(), materials.data(), materials.size() * sizeof(Material));
+
+	for (size_t i = 0, s = m_Meshes.size(); i < s; i++)
+		update_alpha_test(i, m_Meshes[i].triangles, m_Meshes[i].getTriangleCount());
 }
 
 void Context::set_textures(const std::vector<rfw::TextureData> &textures) { m_Textures = textures; }
@@ -320,6 +501,9 @@ void Context::set_mesh(size_t index, const rfw::Mesh &mesh)
 	}
 
 	m_MeshChanged[index] = true;
+	m_Meshes[index].motionBlur = m_MotionBlur;
+	// Filter functions of new meshes are installed before their first build
+	update_alpha_test(index, mesh.triangles, int(mesh.triangleCount));
 	m_Meshes[index].setGeometry(mesh);
 }
 
@@ -330,25 +514,24 @@ void Context::set_instance(const size_t i, const size_t meshIdx, const mat4 &tra
 		m_Instances.emplace_back(0);
 		m_InstanceMesh.emplace_back(0);
 		m_InstanceMatrices.emplace_back();
+		m_PreviousMatrices.emplace_back(transform);
 		m_InverseMatrices.emplace_back();
+		m_InstanceChanged.emplace_back(false);
+		m_InstanceBlurred.emplace_back(false);
 
 		const auto instance = rtcNewGeometry(m_Device, RTC_GEOMETRY_TYPE_INSTANCE);
-		rtcSetGeometryInstancedScene(instance, m_Meshes[meshIdx].scene);
 		rtcSetGeometryTimeStepCount(instance, 1);
-		rtcSetGeometryTransform(instance, 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR, value_ptr(transform));
-		rtcCommitGeometry(instance);
 		m_Instances[i] = rtcAttachGeometry(m_Scene, instance);
+		m_InstanceChanged[i] = true;
 	}
-	else
+	else if (m_InstanceMesh[i] != meshIdx || m_InstanceMatrices[i].matrix != transform)
 	{
-		auto instance = rtcGetGeometry(m_Scene, m_Instances[i]);
-		rtcSetGeometryInstancedScene(instance, m_Meshes[meshIdx].scene);
-		rtcSetGeometryTimeStepCount(instance, 1);
-		rtcSetGeometryTransform(rtcGetGeometry(m_Scene, m_Instances[i]), 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR,
-								value_ptr(transform));
-		rtcCommitGeometry(instance);
+		// Transforms of existing instances changing between frames means the scene is animated
+		m_InstancesMoved = true;
+		m_InstanceChanged[i] = true;
 	}
 
+	// Geometries are updated and committed once per frame in update()
 	m_InstanceMesh[i] = uint(meshIdx);
 	m_InstanceMatrices[i] = transform;
 	m_InverseMatrices[i] = mat4(inverse_transform);
@@ -365,23 +548,7 @@ void Context::set_lights(rfw::LightCount lightCount, const rfw::DeviceAreaLight
 						 const rfw::DevicePointLight *pointLights, const rfw::DeviceSpotLight *spotLights,
 						 const rfw::DeviceDirectionalLight *directionalLights)
 {
-	m_LightCount = lightCount;
-
-	m_AreaLights.resize(lightCount.areaLightCount);
-	if (!m_AreaLights.empty())
-		memcpy(m_AreaLights.data(), areaLights, m_AreaLights.size() * sizeof(AreaLight));
-
-	m_PointLights.resize(lightCount.pointLightCount);
-	if (!m_PointLights.empty())
-		memcpy(m_PointLights.data(), pointLights, m_PointLights.size() * sizeof(PointLight));
-
-	m_DirectionalLights.resize(lightCount.directionalLightCount);
-	if (!m_DirectionalLights.empty())
-		memcpy(m_DirectionalLights.data(), directionalLights, m_DirectionalLights.size() * sizeof(DirectionalLight));
-
-	m_SpotLights.resize(lightCount.spotLightCount);
-	if (!m_SpotLights.empty())
-		memcpy(m_SpotLights.data(), spotLights, m_SpotLights.size() * sizeof(SpotLight));
+	m_Lights.set_lights(lightCount, areaLights, pointLights, spotLights, directionalLights);
 }
 
 void Context::get_probe_results(unsigned int *instanceIndex, unsigned int *primitiveIndex, float *distance) const
@@ -391,22 +558,105 @@ void Context::get_probe_results(unsigned int *instanceIndex, unsigned int *primi
 	*distance = m_ProbedDist;
 }
 
-rfw::AvailableRenderSettings Context::get_settings() const { return {}; }
+rfw::AvailableRenderSettings Context::get_settings() const
+{
+	auto settings = rfw::AvailableRenderSettings();
+	// motion_blur blurs visibility only, shading uses the triangles and instance transforms of the current frame
+	settings.settingKeys = {"shadow_rays", "light_selection", "trace_mode", "motion_blur"};
+	settings.settingValues = {
+		{"1", "2", "4", "8"}, {"bvh", "power", "uniform"}, {"packet", "packet16", "stream"}, {"off", "on"}};
+	return settings;
+}
 
-void Context::set_setting(const rfw::RenderSetting &setting) {}
+void Context::set_setting(const rfw::RenderSetting &setting)
+{
+	if (setting.name == "shadow_rays")
+	{
+		m_ShadowRays = std::stoi(setting.value);
+	}
+	else if (setting.name == "light_selection")
+	{
+		if (setting.value == "uniform")
+			m_Lights.set_selection(bvh::LightSampler::Selection::Uniform);
+		else if (setting.value == "power")
+			m_Lights.set_selection(bvh::LightSampler::Selection::Power);
+		else
+			m_Lights.set_selection(bvh::LightSampler::Selection::Hierarchy);
+	}
+	else if (setting.name == "motion_blur")
+	{
+		m_MotionBlur = setting.value == "on";
+		for (auto &mesh : m_Meshes)
+			mesh.motionBlur = m_MotionBlur;
+	}
+	else if (setting.name == "trace_mode")
+	{
+		if (setting.value == "packet16")
+			m_TraceMode = TraceMode::Packet16;
+		else if (setting.value == "stream")
+			m_TraceMode = TraceMode::Stream;
+		else
+			m_TraceMode = TraceMode::Packet;
+	}
+}
 
 void Context::update()
 {
+	// Meshes that finished a background rebuild replace their scene, meshes that stopped moving stop blurring
+	for (size_t i = 0, s = m_Meshes.size(); i < s; i++)
+	{
+		if (m_Meshes[i].update())
+			m_MeshChanged[i] = true;
+	}
+
+	bool changed = false;
 	for (int i = 0, s = static_cast<int>(m_Instances.size()); i < s; i++)
 	{
-		if (!m_MeshChanged[i])
+		const uint meshIdx = m_InstanceMesh[i];
+		// Blurred instances are updated every frame, the previous transform is the one of the last frame
+		if (!m_InstanceChanged[i] && !m_MeshChanged[meshIdx] && !m_InstanceBlurred[i])
 			continue;
 
+		// Instances of changed meshes are committed as well, their scene may have been replaced by a rebuild
 		auto instance = rtcGetGeometry(m_Scene, m_Instances[i]);
-		rtcSetGeometryInstancedScene(instance, m_Meshes[m_InstanceMesh[i]].scene);
+		rtcSetGeometryInstancedScene(instance, m_Meshes[meshIdx].scene);
+
+		const bool blur = m_MotionBlur && m_PreviousMatrices[i].matrix != m_InstanceMatrices[i].matrix;
+		if (blur)
+		{
+			rtcSetGeometryTimeStepCount(instance, 2);
+			rtcSetGeometryTransform(instance, 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR,
+									value_ptr(m_PreviousMatrices[i].matrix));
+			rtcSetGeometryTransform(instance, 1, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR,
+									value_ptr(m_InstanceMatrices[i].matrix));
+		}
+		else
+		{
+			rtcSetGeometryTimeStepCount(instance, 1);
+			rtcSetGeometryTransform(instance, 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR,
+									value_ptr(m_InstanceMatrices[i].matrix));
+		}
+
 		rtcCommitGeometry(instance);
+		m_InstanceChanged[i] = false;
+		m_InstanceBlurred[i] = blur;
+		m_PreviousMatrices[i] = m_InstanceMatrices[i];
+		changed = true;
 	}
 
+	std::fill(m_MeshChanged.begin(), m_MeshChanged.end(), false);
+	if (!changed)
+		return;
+
+	// Animated top levels are rebuilt every frame, trade traversal speed for a fast build
+	if (m_InstancesMoved && !m_DynamicScene)
+	{
+		rtcSetSceneFlags(m_Scene, RTC_SCENE_FLAG_DYNAMIC);
+		rtcSetSceneBuildQuality(m_Scene, RTC_BUILD_QUALITY_LOW);
+		m_DynamicScene = true;
+	}
+	m_InstancesMoved = false;
+
 	rtcCommitScene(m_Scene);
 }
 
@@ -474,3 +724,18 @@ Context::ShadingData Context::retrieve_material(const Triangle &tri, const Mater
 
 	return data;
 }
+
+void Context::update_alpha_test(size_t meshIdx, const Triangle *triangles, int triangleCount)
+{
+	CPUMesh::AlphaTest test = nullptr;
+	if (uses_alpha_test(m_Materials, triangles, triangleCount))
+	{
+		test = [](const void *context, const Triangle &tri, float u, float v) {
+			const auto *ctx = static_cast<const Context *>(context);
+			return is_transparent(ctx->m_Materials, ctx->m_Textures, tri, u, v);
+		};
+	}
+
+	if (m_Meshes[meshIdx].setAlphaTest(test, this))
+		m_MeshChanged[meshIdx] = true;
+}
@@ -14,6 +14,7 @@ class Context : public RenderContext
 
 	void init(std::shared_ptr<rfw::utils::window> &window) override;
 	void init(GLuint *glTextureID, uint width, uint height) override;
+	void init(glm::vec4 *buffer, uint width, uint height) override;
 
 	void cleanup() override;
 	void render_frame(const rfw::Camera &camera, rfw::RenderStatus status) override;
@@ -41,33 +42,59 @@ class Context : public RenderContext
 		glm::vec3 B;
 	};
 	
+	// Primary rays are traced as PACKET_WIDTH packets, 16-wide packets or as a stream per tile
+	enum class TraceMode
+	{
+		Packet,
+		Packet16,
+		Stream
+	};
+	// Width and height of the tiles traced as a single stream
+	static constexpr int STREAM_TILE_SIZE = 8;
+
+	void init_device();
+	template <int WIDTH, int HEIGHT> void render_tiles(const Ray::CameraParams &camParams);
+	// Shades the N hits of a tile, the shadow rays of all lanes are traced together
+	template <int N, typename Packet>
+	void shade_tile(const Packet &packet, utils::sample_rng &rng, int probe_id, RTCIntersectContext *shadow_context);
+
 	ShadingData retrieve_material(const Triangle &tri, const Material &material, const glm::vec3 &p,
 								  const glm::vec3 bary, const simd::matrix4 &normal_matrix) const;
+	// Installs the alpha filter on a mesh whose triangles use alpha tested materials and removes it otherwise
+	void update_alpha_test(size_t meshIdx, const Triangle *triangles, int triangleCount);
 	
 	rfw::RenderStats m_Stats;
-	LightCount m_LightCount;
-	std::vector<PointLight> m_PointLights;
-	std::vector<AreaLight> m_AreaLights;
-	std::vector<DirectionalLight> m_DirectionalLights;
-	std::vector<SpotLight> m_SpotLights;
+	rfw::bvh::LightSampler m_Lights;
+	TraceMode m_TraceMode = TraceMode::Packet;
+	// Moving geometry has a time step for the previous and the current frame. Only visibility is blurred, hits are
+	// shaded with the triangles and instance transforms of the current frame.
+	bool m_MotionBlur = false;
+	int m_ShadowRays = 1; // Shadow rays per shading point
 	std::vector<Material> m_Materials;
 	std::vector<TextureData> m_Textures;
 
 	std::vector<CPUMesh> m_Meshes;
 
-	RTCDevice m_Device;
-	RTCScene m_Scene;
+	RTCDevice m_Device = nullptr;
+	RTCScene m_Scene = nullptr;
 
-	std::vector<bool> m_MeshChanged;
+	std::vector<bool> m_MeshChanged;	 // Indexed by mesh, set when its geometry changed since the last update
+	std::vector<bool> m_InstanceChanged; // Indexed by instance, set when its mesh or transform changed
+	std::vector<bool> m_InstanceBlurred; // Indexed by instance, set when it has two time steps
+	bool m_InstancesMoved = false;
+	bool m_DynamicScene = false; // Top level uses dynamic, low quality builds once instances animate
 	std::vector<uint> m_Instances;
 	std::vector<uint> m_InstanceMesh;
 	std::vector<simd::matrix4> m_InstanceMatrices;
+	std::vector<simd::matrix4> m_PreviousMatrices; // Transforms of the last update, first time step when blurred
 	std::vector<simd::matrix4> m_InverseMatrices;
 
 	int m_SkyboxWidth = 0, m_SkyboxHeight = 0;
 	std::vector<glm::vec3> m_Skybox = {glm::vec3(0)};
 	glm::vec4 *m_Pixels = nullptr;
-	GLuint m_TargetID = 0, m_PboID = 0;
+	glm::vec4 *m_TargetBuffer = nullptr; // Host memory target, pixels are written directly when set
+	GLuint m_TargetID = 0;
+	utils::pixel_buffer_ring m_PixelBuffers;
 	int m_Width, m_Height;
 	glm::uvec2 m_ProbePos = glm::uvec2(0);
 	unsigned int m_ProbedInstance = 0;
@@ -75,7 +102,7 @@ class Context : public RenderContext
 	float m_ProbedDist = -1.0f;
 	bool m_InitializedGlew = false;
 
-	utils::xor128 m_Rng = {};
+	unsigned int m_SampleIndex = 0;
 
 #if PACKET_WIDTH == 4
 	const int TILE_WIDTH = 2;
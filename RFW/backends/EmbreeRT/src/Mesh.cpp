@@ -2,57 +2,310 @@
 
 using namespace rfw;
 
+// A deforming mesh is rebuilt after this many refits
+static constexpr int MAX_REFITS = 64;
+// or once the surface area of its bounds grew by this factor since the last build
+static constexpr float MAX_AREA_GROWTH = 1.5f;
+
+static float bounds_area(RTCScene scene)
+{
+	RTCBounds bounds;
+	rtcGetSceneBounds(scene, &bounds);
+	const vec3 extent = max(vec3(bounds.upper_x - bounds.lower_x, bounds.upper_y - bounds.lower_y,
+								 bounds.upper_z - bounds.lower_z),
+							vec3(0.0f));
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+// Rejects hits on transparent texels, used as both intersection and occlusion filter of alpha tested meshes
+static void alpha_filter(const RTCFilterFunctionNArguments *args)
+{
+	const auto *filter = static_cast<const CPUMesh::AlphaFilter *>(args->geometryUserPtr);
+	for (unsigned int i = 0; i < args->N; i++)
+	{
+		if (args->valid[i] != -1)
+			continue;
+
+		const uint primID = RTCHitN_primID(args->hit, args->N, i);
+		const float u = RTCHitN_u(args->hit, args->N, i);
+		const float v = RTCHitN_v(args->hit, args->N, i);
+		if (filter->test(filter->userData, filter->triangles[primID], u, v))
+			args->valid[i] = 0;
+	}
+}
+
+// Vertices and indices are copied into Embree owned buffers when the host may change them while the scene is built.
+// Passing the vertices of the previous pose builds a scene with two time steps.
+static std::pair<RTCScene, uint> create_scene(RTCDevice device, const glm::vec4 *vertices, int vertexCount,
+											  const glm::uvec3 *indices, int triangleCount, RTCBuildQuality quality,
+											  bool copyBuffers, const CPUMesh::AlphaFilter *alphaFilter = nullptr,
+											  const glm::vec4 *previousVertices = nullptr)
+{
+	auto geometry = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
+	rtcSetGeometryVertexAttributeCount(geometry, 1);
+
+	// Time steps in order, the current pose is the last one
+	const glm::vec4 *poses[2] = {previousVertices, vertices};
+	const uint timeSteps = previousVertices ? 2 : 1;
+	rtcSetGeometryTimeStepCount(geometry, timeSteps);
+	for (uint step = 0; step < timeSteps; step++)
+	{
+		const glm::vec4 *pose = poses[step + 2 - timeSteps];
+		if (copyBuffers)
+		{
+			void *buffer = rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, step, RTC_FORMAT_FLOAT3, sizeof(vec4), vertexCount);
+			memcpy(buffer, pose, vertexCount * sizeof(vec4));
+		}
+		else
+		{
+			rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, step, RTC_FORMAT_FLOAT3, pose, 0, sizeof(vec4), vertexCount);
+		}
+	}
+	// rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_NORMAL, 1, RTC_FORMAT_FLOAT3, mesh.normals, 0, sizeof(vec3), mesh.vertexCount);
+	if (indices && copyBuffers)
+	{
+		void *buffer = rtcSetNewGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, sizeof(uvec3), triangleCount);
+		memcpy(buffer, indices, triangleCount * sizeof(uvec3));
+	}
+	else if (indices)
+	{
+		rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, indices, 0, sizeof(uvec3), triangleCount);
+	}
+	rtcSetGeometryBuildQuality(geometry, quality);
+	if (alphaFilter)
+	{
+		rtcSetGeometryUserData(geometry, const_cast<CPUMesh::AlphaFilter *>(alphaFilter));
+		rtcSetGeometryIntersectFilterFunction(geometry, alpha_filter);
+		rtcSetGeometryOccludedFilterFunction(geometry, alpha_filter);
+	}
+	rtcCommitGeometry(geometry);
+
+	RTCScene scene = rtcNewScene(device);
+	const uint ID = rtcAttachGeometry(scene, geometry);
+	rtcReleaseGeometry(geometry);
+	rtcCommitScene(scene);
+	return std::make_pair(scene, ID);
+}
+
 CPUMesh::~CPUMesh()
 {
+	discardRebuild();
+
 	if (scene)
 		rtcReleaseScene(scene);
 
 	scene = nullptr;
 }
 
-CPUMesh::CPUMesh(const CPUMesh &other)
+CPUMesh::CPUMesh(CPUMesh &&other) noexcept
+	: vertices(other.vertices), triangles(other.triangles), indices(other.indices),
+	  embreeVertices(other.embreeVertices), ID(other.ID), device(other.device), scene(other.scene),
+	  vertexCount(other.vertexCount), triangleCount(other.triangleCount), refitCount(other.refitCount),
+	  buildArea(other.buildArea), rebuild(std::move(other.rebuild)), lastVertices(std::move(other.lastVertices)),
+	  previousVertices(std::move(other.previousVertices)), blurred(other.blurred), posed(other.posed),
+	  alphaFilter(std::move(other.alphaFilter))
 {
-	memcpy(this, &other, sizeof(CPUMesh));
-	memset(const_cast<CPUMesh *>(&other), 0, sizeof(CPUMesh));
+	other.scene = nullptr;
 }
 
 void CPUMesh::setGeometry(const Mesh &mesh)
 {
-	if (vertices)
+	// Animated data keeps its vertex and triangle counts
+	const bool refit = scene && int(mesh.vertexCount) == vertexCount && int(mesh.triangleCount) == triangleCount;
+	// The first pose after enabling motion blur has no previous pose yet
+	const bool blur = refit && motionBlur && static_cast<int>(lastVertices.size()) == vertexCount;
+	posed = true;
+
+	vertices = mesh.vertices;
+	triangles = mesh.triangles;
+	indices = mesh.hasIndices() ? mesh.indices : nullptr;
+	vertexCount = int(mesh.vertexCount);
+	triangleCount = int(mesh.triangleCount);
+	if (alphaFilter)
+		alphaFilter->triangles = triangles;
+
+	if (!scene)
 	{
-		vertices = mesh.vertices;
-		triangles = mesh.triangles;
+		std::tie(scene, ID) = create_scene(device, vertices, vertexCount, indices, triangleCount,
+										   RTC_BUILD_QUALITY_HIGH, false, alphaFilter.get());
+		buildArea = bounds_area(scene);
+		refitCount = 0;
+		keepPose();
+		return;
+	}
 
-		auto geometry = rtcGetGeometry(scene, ID);
-		vertexCount = int(mesh.vertexCount);
-		triangleCount = int(mesh.triangleCount);
-		rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, mesh.vertices, 0, sizeof(vec4), mesh.vertexCount);
-		// rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_NORMAL, 1, RTC_FORMAT_FLOAT3, mesh.normals, 0, sizeof(vec3), mesh.vertexCount);
-		if (mesh.hasIndices())
-			rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, mesh.indices, 0, sizeof(uvec3), mesh.triangleCount);
-		if (mesh.vertexCount == vertexCount) // Animated data
-			rtcSetGeometryBuildQuality(geometry, RTC_BUILD_QUALITY_REFIT);
-		rtcCommitGeometry(geometry);
+	// The pose of the previous frame is the first time step
+	if (blur)
+		lastVertices.swap(previousVertices);
+
+	if (refit && swapRebuilt(blur))
+	{
+		keepPose();
+		return;
 	}
-	else
+
+	auto geometry = rtcGetGeometry(scene, ID);
+	setPoses(geometry, blur);
+	// rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_NORMAL, 1, RTC_FORMAT_FLOAT3, mesh.normals, 0, sizeof(vec3), mesh.vertexCount);
+	if (mesh.hasIndices())
+		rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, mesh.indices, 0, sizeof(uvec3), mesh.triangleCount);
+
+	if (!refit)
 	{
-		vertices = mesh.vertices;
-		triangles = mesh.triangles;
-		vertexCount = int(mesh.vertexCount);
-		triangleCount = int(mesh.triangleCount);
-
-		auto geometry = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
-		rtcSetGeometryVertexAttributeCount(geometry, 1);
-		rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, mesh.vertices, 0, sizeof(vec4), mesh.vertexCount);
-		// rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_NORMAL, 1, RTC_FORMAT_FLOAT3, mesh.normals, 0, sizeof(vec3), mesh.vertexCount);
-		if (mesh.hasIndices())
-			rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, mesh.indices, 0, sizeof(uvec3), mesh.triangleCount);
+		// The topology changed, a pending rebuild is outdated
+		discardRebuild();
 		rtcSetGeometryBuildQuality(geometry, RTC_BUILD_QUALITY_HIGH);
-		rtcCommitGeometry(geometry);
+		commit(geometry);
+		buildArea = bounds_area(scene);
+		refitCount = 0;
+		keepPose();
+		return;
+	}
+
+	rtcSetGeometryBuildQuality(geometry, RTC_BUILD_QUALITY_REFIT);
+	commit(geometry);
+	refitCount++;
+	keepPose();
+
+	// Blurred meshes are rebuilt with both of their time steps
+	if (!rebuild.valid() && (refitCount >= MAX_REFITS || bounds_area(scene) > buildArea * MAX_AREA_GROWTH))
+		startRebuild();
+}
+
+bool CPUMesh::setAlphaTest(AlphaTest test, const void *userData)
+{
+	if (!test && !alphaFilter)
+		return false;
+	if (test && alphaFilter && alphaFilter->test == test && alphaFilter->userData == userData)
+		return false;
+
+	if (test)
+		alphaFilter = std::make_unique<AlphaFilter>(AlphaFilter{test, userData, triangles});
+	else
+		alphaFilter.reset();
+
+	if (!scene)
+		return false;
 
-		scene = rtcNewScene(device);
-		ID = rtcAttachGeometry(scene, geometry);
+	auto geometry = rtcGetGeometry(scene, ID);
+	applyAlphaFilter(geometry);
+	commit(geometry);
+	return true;
+}
+
+bool CPUMesh::update()
+{
+	bool changed = false;
+
+	// A mesh that was not posed this frame stopped moving, its time steps would show the last motion forever
+	if (blurred && !posed)
+	{
+		auto geometry = rtcGetGeometry(scene, ID);
+		setPoses(geometry, false);
+		commit(geometry);
+		changed = true;
 	}
 
+	// Rebuilt scenes take over the time steps of the current scene
+	changed |= swapRebuilt(blurred);
+
+	posed = false;
+	return changed;
+}
+
+bool CPUMesh::swapRebuilt(bool blur)
+{
+	if (!rebuild.valid() || rebuild.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		return false;
+
+	const auto [rebuiltScene, rebuiltID] = rebuild.get();
+	rtcReleaseScene(scene);
+	scene = rebuiltScene;
+	ID = rebuiltID;
+	buildArea = bounds_area(scene);
+	refitCount = 0;
+
+	// The new tree was built from a copy of older poses and indices, refit it to the current ones
+	auto geometry = rtcGetGeometry(scene, ID);
+	applyAlphaFilter(geometry);
+	setPoses(geometry, blur);
+	if (indices)
+		rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, indices, 0, sizeof(uvec3), triangleCount);
+	rtcSetGeometryBuildQuality(geometry, RTC_BUILD_QUALITY_REFIT);
+	commit(geometry);
+	return true;
+}
+
+void CPUMesh::startRebuild()
+{
+	// The host may overwrite or free its buffers while the tree is built
+	std::vector<glm::vec4> snapshot(vertices, vertices + vertexCount);
+	std::vector<glm::uvec3> indexSnapshot;
+	if (indices)
+		indexSnapshot.assign(indices, indices + triangleCount);
+	// Blurred meshes are built over both time steps, Embree then builds a tree that bounds the motion in between
+	std::vector<glm::vec4> previousSnapshot;
+	if (blurred)
+		previousSnapshot = previousVertices;
+
+	rebuild = std::async(std::launch::async, [dev = device, snapshot = std::move(snapshot),
+											  indexSnapshot = std::move(indexSnapshot),
+											  previousSnapshot = std::move(previousSnapshot), count = triangleCount]() {
+		return create_scene(dev, snapshot.data(), static_cast<int>(snapshot.size()),
+							indexSnapshot.empty() ? nullptr : indexSnapshot.data(), count, RTC_BUILD_QUALITY_MEDIUM,
+							true, nullptr, previousSnapshot.empty() ? nullptr : previousSnapshot.data());
+	});
+}
+
+void CPUMesh::discardRebuild()
+{
+	if (!rebuild.valid())
+		return;
+
+	rtcReleaseScene(rebuild.get().first);
+}
+
+void CPUMesh::keepPose()
+{
+	if (motionBlur)
+		lastVertices.assign(vertices, vertices + vertexCount);
+	else
+		lastVertices.clear();
+}
+
+void CPUMesh::setPoses(RTCGeometry geometry, bool blur)
+{
+	if (blur)
+	{
+		rtcSetGeometryTimeStepCount(geometry, 2);
+		rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, previousVertices.data(), 0, sizeof(vec4), vertexCount);
+		rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 1, RTC_FORMAT_FLOAT3, vertices, 0, sizeof(vec4), vertexCount);
+	}
+	else
+	{
+		rtcSetGeometryTimeStepCount(geometry, 1);
+		rtcSetSharedGeometryBuffer(geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, vertices, 0, sizeof(vec4), vertexCount);
+	}
+	blurred = blur;
+}
+
+void CPUMesh::commit(RTCGeometry geometry)
+{
+	rtcCommitGeometry(geometry);
 	rtcCommitScene(scene);
 }
+
+void CPUMesh::applyAlphaFilter(RTCGeometry geometry) const
+{
+	if (alphaFilter)
+	{
+		rtcSetGeometryUserData(geometry, alphaFilter.get());
+		rtcSetGeometryIntersectFilterFunction(geometry, alpha_filter);
+		rtcSetGeometryOccludedFilterFunction(geometry, alpha_filter);
+	}
+	else
+	{
+		rtcSetGeometryIntersectFilterFunction(geometry, nullptr);
+		rtcSetGeometryOccludedFilterFunction(geometry, nullptr);
+	}
+}
@@ -2,19 +2,49 @@
 
 #include "PCH.h"
 
+#include <future>
+
 namespace rfw
 {
+/*
+ * Refitting keeps the topology of a mesh's tree, which degrades as a mesh deforms. Once a mesh was refitted too often
+ * or its bounds grew too much since the last build, a new tree is built on a background thread from a copy of the
+ * vertices and indices. The refitted tree is used until the new one is swapped in.
+ *
+ * With motion blur enabled a deforming mesh has two time steps, the pose of the previous frame and the current one.
+ * Background rebuilds of blurred meshes are built over both time steps.
+ *
+ * Meshes with alpha tested materials reject hits on transparent texels in intersection and occlusion filter functions.
+ * Opaque meshes have no filter functions, Embree accepts their hits without calling back.
+ */
 class CPUMesh
 {
   public:
 	explicit CPUMesh(RTCDevice dev) : device(dev) {}
 	~CPUMesh();
-	CPUMesh(const CPUMesh &other);
+	CPUMesh(CPUMesh &&other) noexcept;
+
+	// Returns whether a hit at barycentrics (u, v) of the second and third vertex is transparent
+	using AlphaTest = bool (*)(const void *userData, const rfw::Triangle &triangle, float u, float v);
+
+	struct AlphaFilter
+	{
+		AlphaTest test;
+		const void *userData;
+		const rfw::Triangle *triangles;
+	};
 
 	void setGeometry(const Mesh &mesh);
+	// A null test makes the mesh opaque, returns whether the scene changed
+	bool setAlphaTest(AlphaTest test, const void *userData);
+	// Called once per frame after all geometry was set, returns whether the scene changed
+	bool update();
+
+	int getTriangleCount() const { return triangleCount; }
 
 	const glm::vec4 *vertices = nullptr;
 	const rfw::Triangle *triangles = nullptr;
+	const glm::uvec3 *indices = nullptr;
 
 	glm::vec4 *embreeVertices = nullptr;
 
@@ -23,8 +53,33 @@ class CPUMesh
 	RTCDevice device = nullptr;
 	RTCScene scene = nullptr;
 
+	bool motionBlur = false;
+
   private:
+	// Swaps in a finished background rebuild posed with one or two time steps, returns whether the scene changed
+	bool swapRebuilt(bool blur);
+	void startRebuild();
+	void discardRebuild();
+	void keepPose();
+	// Shares the current pose, preceded by the previous pose when blurred, as the time steps of the geometry
+	void setPoses(RTCGeometry geometry, bool blur);
+	void commit(RTCGeometry geometry);
+	void applyAlphaFilter(RTCGeometry geometry) const;
+
 	int vertexCount = 0;
 	int triangleCount = 0;
+
+	int refitCount = 0;
+	float buildArea = 0.0f; // Surface area of the scene bounds after the last full build
+	std::future<std::pair<RTCScene, uint>> rebuild;
+
+	// Vertices of the host are overwritten by every pose, the last two poses are kept for motion blur
+	std::vector<glm::vec4> lastVertices;
+	std::vector<glm::vec4> previousVertices;
+	bool blurred = false; // Geometry currently has two time steps
+	bool posed = false;	  // Geometry was set since the last update
+
+	// User data of the filter functions, heap allocated so the geometry keeps pointing at it when the mesh moves
+	std::unique_ptr<AlphaFilter> alphaFilter;
 };
-} // namespace rfw
\ No newline at end of file
+} // namespace rfw
@@ -6,12 +6,17 @@
 #include <memory>
 
 #include <rfw/utils.h>
+#include <rfw/utils/gl/pixel_buffer_ring.h>
 #include <rfw/context/context.h>
 #include <rfw/context/context.h>
 #include <rfw/context/structs.h>
 #include <rfw/context/device_structs.h>
 #include <rfw/math.h>
 #include <rfw/context/export.h>
+#include <rfw/context/sampler.h>
+#include <rfw/context/alpha_test.h>
+
+#include <bvh/light_sampler.h>
 
 #include <immintrin.h>
 #include <glm/simd/geometric.h>
@@ -47,6 +47,18 @@ Ray Ray::generateFromView(const Ray::CameraParams &camera, int x, int y, float r
 }
 
 RTCRayHit4 Ray::GenerateRay4(const CameraParams &camera, const int x[4], const int y[4], rfw::utils::rng &rng)
+{
+	float samples[4][4];
+	for (auto &dimension : samples)
+	{
+		for (float &sample : dimension)
+			sample = rng.rand();
+	}
+
+	return GenerateRay4(camera, x, y, samples);
+}
+
+RTCRayHit4 Ray::GenerateRay4(const CameraParams &camera, const int x[4], const int y[4], const float samples[4][4])
 {
 	RTCRayHit4 query{};
 
@@ -62,10 +74,10 @@ RTCRayHit4 Ray::GenerateRay4(const CameraParams &camera, const int x[4], const i
 
 	static const __m128 one4 = _mm_set1_ps(1.0f);
 
-	const __m128 r04 = _mm_set_ps(rng.rand(), rng.rand(), rng.rand(), rng.rand());
-	const __m128 r14 = _mm_set_ps(rng.rand(), rng.rand(), rng.rand(), rng.rand());
-	__m128 r24 = _mm_set_ps(rng.rand(), rng.rand(), rng.rand(), rng.rand());
-	__m128 r34 = _mm_set_ps(rng.rand(), rng.rand(), rng.rand(), rng.rand());
+	const __m128 r04 = _mm_loadu_ps(samples[0]);
+	const __m128 r14 = _mm_loadu_ps(samples[1]);
+	__m128 r24 = _mm_loadu_ps(samples[2]);
+	__m128 r34 = _mm_loadu_ps(samples[3]);
 
 	const __m128 blade4 = _mm_mul_ps(r04, _mm_set1_ps(9.0f));
 
@@ -174,6 +186,18 @@ RTCRayHit4 Ray::GenerateRay4(const CameraParams &camera, const int x[4], const i
 }
 
 RTCRayHit8 Ray::GenerateRay8(const CameraParams &camera, const int x[8], const int y[8], rfw::utils::rng &rng)
+{
+	float samples[4][8];
+	for (auto &dimension : samples)
+	{
+		for (float &sample : dimension)
+			sample = rng.rand();
+	}
+
+	return GenerateRay8(camera, x, y, samples);
+}
+
+RTCRayHit8 Ray::GenerateRay8(const CameraParams &camera, const int x[8], const int y[8], const float samples[4][8])
 {
 	RTCRayHit8 query{};
 
@@ -210,10 +234,10 @@ RTCRayHit8 Ray::GenerateRay8(const CameraParams &camera, const int x[8], const i
 		float r3[8];
 	};
 
-	r04 = _mm256_set_ps(rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand());
-	r14 = _mm256_set_ps(rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand());
-	r24 = _mm256_set_ps(rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand());
-	r34 = _mm256_set_ps(rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand(), rng.rand());
+	r04 = _mm256_loadu_ps(samples[0]);
+	r14 = _mm256_loadu_ps(samples[1]);
+	r24 = _mm256_loadu_ps(samples[2]);
+	r34 = _mm256_loadu_ps(samples[3]);
 
 	const __m256 blade4 = _mm256_mul_ps(r04, _mm256_set1_ps(9.0f));
 
@@ -36,41 +36,47 @@ struct Ray
 	static RTCRayHit8 GenerateRay8(const CameraParams &camera, const int x[8], const int y[8], rfw::utils::rng &rng);
 	static RTCRayHit16 GenerateRay16(const CameraParams &camera, const int x[16], const int y[16],
 									 rfw::utils::rng &rng);
+	// Samples hold the 4 random numbers of every ray, dimension by dimension
+	static RTCRayHit4 GenerateRay4(const CameraParams &camera, const int x[4], const int y[4], const float samples[4][4]);
+	static RTCRayHit8 GenerateRay8(const CameraParams &camera, const int x[8], const int y[8], const float samples[4][8]);
 
-	template <int N>
-	static RTCRayHitNt<N> GenerateRayN(const CameraParams &camera, int x0, int y0, int x1, int y1, rfw::utils::rng &rng)
+	static RTCRayHit16 GenerateRay16(const CameraParams &camera, const int x[16], const int y[16],
+									 const float samples[4][16])
 	{
-		static_assert(N % 4 == 0, "Packet must be a multiple of 4 rays");
-		assert(x1 - x0 == y1 - y0);
+		return GenerateRayN<16, RTCRayHit16>(camera, x, y, samples);
+	}
 
-		RTCRayHitNt<N> query;
+	// Generates N rays 8 at a time, samples hold the 4 random numbers of every ray dimension by dimension
+	template <int N, typename Packet = RTCRayHitNt<N>>
+	static Packet GenerateRayN(const CameraParams &camera, const int x[N], const int y[N], const float samples[4][N])
+	{
+		static_assert(N % 8 == 0, "Stream must be a multiple of 8 rays");
 
-		int offset = 0;
+		Packet query{};
 
-		for (int y = y0; y < y1; y += 4)
+		for (int offset = 0; offset < N; offset += 8)
 		{
-			for (int x = x0; x < x1; x += 4)
-			{
-				const int xs[4] = {x, x + 1, x, x + 1};
-				const int ys[4] = {y, y, y + 1, y + 1};
-				const auto packet = GenerateRay4(camera, xs, ys, rng);
-
-				memcpy(query.hit.geomID + offset, packet.hit.geomID, 4 * sizeof(int));
-				memcpy(query.hit.instID + offset, packet.hit.instID, 4 * sizeof(int));
-				memcpy(query.hit.primID + offset, packet.hit.primID, 4 * sizeof(int));
-
-				memcpy(query.ray.org_x + offset, packet.ray.org_x, 4 * sizeof(float));
-				memcpy(query.ray.org_y + offset, packet.ray.org_y, 4 * sizeof(float));
-				memcpy(query.ray.org_z + offset, packet.ray.org_z, 4 * sizeof(float));
-
-				memcpy(query.ray.dir_x + offset, packet.ray.dir_x, 4 * sizeof(float));
-				memcpy(query.ray.dir_y + offset, packet.ray.dir_y, 4 * sizeof(float));
-				memcpy(query.ray.dir_z + offset, packet.ray.dir_z, 4 * sizeof(float));
-
-				memcpy(query.ray.id + offset, packet.ray.id, 4 * sizeof(int));
-				memcpy(query.ray.tnear + offset, packet.ray.tnear, 4 * sizeof(float));
-				memcpy(query.ray.tfar + offset, packet.ray.tfar, 4 * sizeof(float));
-			}
+			float chunk[4][8];
+			for (int dimension = 0; dimension < 4; dimension++)
+				memcpy(chunk[dimension], samples[dimension] + offset, 8 * sizeof(float));
+
+			const auto packet = GenerateRay8(camera, x + offset, y + offset, chunk);
+
+			memcpy(query.hit.geomID + offset, packet.hit.geomID, 8 * sizeof(int));
+			memcpy(query.hit.instID[0] + offset, packet.hit.instID[0], 8 * sizeof(int));
+			memcpy(query.hit.primID + offset, packet.hit.primID, 8 * sizeof(int));
+
+			memcpy(query.ray.org_x + offset, packet.ray.org_x, 8 * sizeof(float));
+			memcpy(query.ray.org_y + offset, packet.ray.org_y, 8 * sizeof(float));
+			memcpy(query.ray.org_z + offset, packet.ray.org_z, 8 * sizeof(float));
+
+			memcpy(query.ray.dir_x + offset, packet.ray.dir_x, 8 * sizeof(float));
+			memcpy(query.ray.dir_y + offset, packet.ray.dir_y, 8 * sizeof(float));
+			memcpy(query.ray.dir_z + offset, packet.ray.dir_z, 8 * sizeof(float));
+
+			memcpy(query.ray.id + offset, packet.ray.id, 8 * sizeof(int));
+			memcpy(query.ray.tnear + offset, packet.ray.tnear, 8 * sizeof(float));
+			memcpy(query.ray.tfar + offset, packet.ray.tfar, 8 * sizeof(float));
 		}
 
 		return query;
@@ -4,11 +4,20 @@
 
 #include <rfw/context/structs.h>
 
-#include <rtbvh.hpp>
-
 #include "aabb.h"
+#include "traversal_stack.h"
+#include "bvh_stats.h"
+#include "ray_stream.h"
 #include "bvh_node.h"
+#include "bvh_builder.h"
+#include "bvh_cache.h"
+#include "leaf_triangles.h"
 #include "bvh_tree.h"
 #include "mbvh_node.h"
+#include "compressed_mbvh_node.h"
 #include "mbvh_tree.h"
-#include "top_level_bvh.h"
\ No newline at end of file
+#include "mbvh8_node.h"
+#include "mbvh8_tree.h"
+#include "top_level_bvh.h"
+#include "light_bvh.h"
+#include "light_sampler.h"
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "aabb.h"
+#include "bvh_node.h"
+#include "mbvh_node.h"
+#include "mbvh8_node.h"
+
+#include <vector>
+
+namespace rfw
+{
+namespace bvh
+{
+namespace builder
+{
+// Builds a binary BVH over the given primitive bounds using binned SAH.
+// Node 0 is the root, node 1 is unused so that sibling pairs start at an even index. Leaves of triangle trees are
+// filled up to BVH_LEAF_SIZE triangles, other trees stop at 2 primitives per leaf.
+void binned_sah(const AABB *aabbs, int primCount, std::vector<BVHNode> &nodes, std::vector<unsigned int> &primIndices,
+				bool triangleLeaves = false);
+
+// Builds a binary BVH using locally-ordered clustering. Only available through rtbvh, the native builder falls back
+// to binned SAH.
+void locally_ordered_clustering(const AABB *aabbs, int primCount, std::vector<BVHNode> &nodes,
+								std::vector<unsigned int> &primIndices, bool triangleLeaves = false);
+
+// Builds a binary BVH using SAH with spatial splits (SBVH). Vertices must contain 3 consecutive vertices per
+// primitive. Primitives may be referenced by multiple leaves, primIndices can thus be larger than primCount.
+void spatial_sah(const AABB *aabbs, const glm::vec4 *vertices, int primCount, std::vector<BVHNode> &nodes,
+				 std::vector<unsigned int> &primIndices);
+
+// Collapses a binary BVH into a 4-wide BVH, leaf nodes keep referencing the primitive indices of the binary BVH.
+void collapse_mbvh(const std::vector<BVHNode> &nodes, std::vector<MBVHNode> &mbvhNodes);
+
+// Collapses a binary BVH into an 8-wide BVH, leaf nodes keep referencing the primitive indices of the binary BVH.
+void collapse_mbvh8(const std::vector<BVHNode> &nodes, std::vector<MBVH8Node> &mbvhNodes);
+
+// Recalculates the bounds of an existing binary BVH bottom-up.
+void refit(std::vector<BVHNode> &nodes, const std::vector<unsigned int> &primIndices, const AABB *aabbs);
+
+// Returns the SAH cost of a binary BVH relative to the surface area of its root node. Traversal and intersection
+// costs are assumed to be equal.
+float sah_cost(const std::vector<BVHNode> &nodes);
+} // namespace builder
+} // namespace bvh
+} // namespace rfw
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <glm/glm.hpp>
+
+namespace rfw
+{
+namespace bvh
+{
+class BVHTree;
+class MBVHTree;
+
+namespace cache
+{
+// Directory cache files are stored in, an empty path disables the cache. Caching is disabled until a directory is set,
+// applications set it through rfw::system::set_bvh_cache_directory.
+void set_directory(const std::string &path);
+const std::string &get_directory();
+
+// Hashes the vertex and index buffers a BVH is built over
+uint64_t hash_geometry(const glm::vec4 *vertices, int vertexCount, const glm::uvec3 *indices, int faceCount);
+
+// Reads the trees of the cache file for the given hash into bvh and mbvh. Returns false if no cache file exists or
+// its nodes reference out of range children or primitives, the trees are left untouched in that case.
+bool load(uint64_t hash, BVHTree &bvh, MBVHTree &mbvh);
+
+// Writes the trees to a versioned binary cache file
+void store(uint64_t hash, const BVHTree &bvh, const MBVHTree &mbvh);
+} // namespace cache
+} // namespace bvh
+} // namespace rfw
@@ -1,10 +1,19 @@
 #pragma once
 
 #include "AABB.h"
+#include "traversal_stack.h"
+#include "ray_stream.h"
+#include "leaf_intersection.h"
+#include "bvh_stats.h"
 
+#include <algorithm>
 #include <atomic>
-#include <thread>
-#include <future>
+#include <vector>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/task_group.h>
 
 namespace rfw
 {
@@ -12,6 +21,12 @@ namespace bvh
 {
 class BVHTree;
 
+// Maximum depth of the trees built by the binned and spatial SAH builders. CUDART sizes its fixed traversal stacks
+// from this, it has to be raised together with those.
+constexpr int BVH_MAX_DEPTH = 64;
+// Triangle leaves are intersected 8 at a time by LeafTriangles, nodes that fit in a single 8-wide block are not split
+constexpr int BVH_LEAF_SIZE = 8;
+
 struct BVHTraversal
 {
 	int nodeIdx{};
@@ -20,9 +35,23 @@ struct BVHTraversal
 	BVHTraversal(int nIdx) : nodeIdx(nIdx) {}
 };
 
+struct BVHStreamTraversal
+{
+	int nodeIdx;
+	// Range of this node's active rays in the active ray list
+	int begin;
+	int count;
+};
+
 struct BVHNode
 {
   public:
+	// Nodes with at least this many primitives are subdivided as separate tasks
+	static constexpr int PARALLEL_SUBDIVIDE_THRESHOLD = 4096;
+	// Nodes with at least this many primitives are binned and partitioned in parallel
+	static constexpr int PARALLEL_BINNING_THRESHOLD = 1 << 16;
+	static constexpr int PARALLEL_GRAIN_SIZE = 1 << 14;
+
 	AABB bounds;
 	int left_first;
 	int count;
@@ -43,7 +72,7 @@ struct BVHNode
 		return bounds.intersect(org, dirInverse, t_min, t_max, min_t);
 	}
 
-	AABB refit(BVHNode *bvhTree, uint *primIDs, AABB *aabbs);
+	AABB refit(BVHNode *bvhTree, const uint *primIDs, const AABB *aabbs);
 
 	void set_count(int value) noexcept { count = value; }
 
@@ -53,12 +82,13 @@ struct BVHNode
 
 	[[nodiscard]] inline int get_left_first() const noexcept { return left_first; }
 
-	template <int BINS = 9, int MAX_DEPTH = 32, int MAX_PRIMITIVES = 3>
+	// Nodes with at most MAX_LEAF_SIZE primitives become leaves
+	template <int BINS = 9, int MAX_DEPTH = BVH_MAX_DEPTH, int MAX_LEAF_SIZE = 2>
 	void subdivide(const AABB *aabbs, BVHNode *bvhTree, unsigned int *primIndices, unsigned int depth,
 				   std::atomic_int &poolPtr)
 	{
 		depth++;
-		if (get_count() < MAX_PRIMITIVES || depth >= MAX_DEPTH)
+		if (get_count() <= MAX_LEAF_SIZE || depth >= MAX_DEPTH)
 			return; // this is a leaf node
 
 		auto left = -1;
@@ -74,18 +104,22 @@ struct BVHNode
 		auto &right_node = bvhTree[right];
 
 		if (left_node.count > 0)
-			left_node.subdivide<BINS, MAX_DEPTH, MAX_PRIMITIVES>(aabbs, bvhTree, primIndices, depth, poolPtr);
+			left_node.subdivide<BINS, MAX_DEPTH, MAX_LEAF_SIZE>(aabbs, bvhTree, primIndices, depth, poolPtr);
 
 		if (right_node.count > 0)
-			right_node.subdivide<BINS, MAX_DEPTH, MAX_PRIMITIVES>(aabbs, bvhTree, primIndices, depth, poolPtr);
+			right_node.subdivide<BINS, MAX_DEPTH, MAX_LEAF_SIZE>(aabbs, bvhTree, primIndices, depth, poolPtr);
 	}
 
-	template <int BINS = 9, int MAX_DEPTH = 32, int MAX_PRIMITIVES = 3>
-	void subdivide_mt(const AABB *aabbs, BVHNode *bvhTree, unsigned int *primIndices, std::atomic_int &threadCount,
-					  unsigned int depth, std::atomic_int &poolPtr)
+	template <int BINS = 9, int MAX_DEPTH = BVH_MAX_DEPTH, int MAX_LEAF_SIZE = 2>
+	void subdivide_mt(const AABB *aabbs, BVHNode *bvhTree, unsigned int *primIndices, unsigned int depth,
+					  std::atomic_int &poolPtr)
 	{
+		// Small sub-trees are not worth the overhead of a task
+		if (get_count() < PARALLEL_SUBDIVIDE_THRESHOLD)
+			return subdivide<BINS, MAX_DEPTH, MAX_LEAF_SIZE>(aabbs, bvhTree, primIndices, depth, poolPtr);
+
 		depth++;
-		if (get_count() < MAX_PRIMITIVES || depth >= MAX_DEPTH)
+		if (depth >= MAX_DEPTH)
 			return; // this is a leaf node
 
 		int left = -1;
@@ -100,120 +134,162 @@ struct BVHNode
 		auto *leftNode = &bvhTree[left];
 		auto *rightNode = &bvhTree[right];
 
-		const bool subLeft = leftNode->get_count() > 0;
-		const bool subRight = rightNode->get_count() > 0;
+		// Idle workers steal the left sub-tree while this thread continues with the right one
+		tbb::task_group group;
+		group.run([&]() {
+			leftNode->subdivide_mt<BINS, MAX_DEPTH, MAX_LEAF_SIZE>(aabbs, bvhTree, primIndices, depth, poolPtr);
+		});
+		rightNode->subdivide_mt<BINS, MAX_DEPTH, MAX_LEAF_SIZE>(aabbs, bvhTree, primIndices, depth, poolPtr);
+		group.wait();
+	}
+
+	template <int BINS> struct Bins
+	{
+		AABB boxes[3][BINS];
+		int counts[3][BINS] = {};
 
-		if (threadCount.load() < int(std::thread::hardware_concurrency())) // Check if we need to create threads
+		void merge(const Bins &other)
 		{
-			if (subLeft && subRight)
+			for (int axis = 0; axis < 3; axis++)
 			{
-				threadCount.fetch_add(1);
-				auto leftThread = std::async([&]() {
-					leftNode->subdivide_mt<BINS, MAX_DEPTH, MAX_PRIMITIVES>(aabbs, bvhTree, primIndices, threadCount,
-																			depth, poolPtr);
-				});
-
-				rightNode->subdivide_mt<BINS, MAX_DEPTH, MAX_PRIMITIVES>(aabbs, bvhTree, primIndices, threadCount,
-																		 depth, poolPtr);
-				leftThread.get();
+				for (int i = 0; i < BINS; i++)
+				{
+					boxes[axis][i].grow(other.boxes[axis][i]);
+					counts[axis][i] += other.counts[axis][i];
+				}
 			}
-			else if (subLeft)
-				leftNode->subdivide_mt<BINS, MAX_DEPTH, MAX_PRIMITIVES>(aabbs, bvhTree, primIndices, threadCount, depth,
-																		poolPtr);
-			else if (subRight)
-				rightNode->subdivide_mt<BINS, MAX_DEPTH, MAX_PRIMITIVES>(aabbs, bvhTree, primIndices, threadCount,
-																		 depth, poolPtr);
 		}
-		else // No more need to create more threads
-		{
-			if (subLeft)
-				leftNode->subdivide<BINS, MAX_DEPTH, MAX_PRIMITIVES>(aabbs, bvhTree, primIndices, depth, poolPtr);
-			if (subRight)
-				rightNode->subdivide<BINS, MAX_DEPTH, MAX_PRIMITIVES>(aabbs, bvhTree, primIndices, depth, poolPtr);
-		}
-	}
+	};
 
 	template <int BINS>
 	bool partition(const AABB *aabbs, BVHNode *bvhTree, unsigned int *primIndices, int *left, int *right,
 				   std::atomic_int &poolPtr)
 	{
 		const int lFirst = left_first;
-		int lCount = 0;
-		int rFirst = left_first;
-		int rCount = count;
+		// Binning and partitioning are split over tasks near the root where nodes contain most primitives
+		const bool parallel = count >= PARALLEL_BINNING_THRESHOLD;
+
+		// Bins are laid out over the centroid bounds of this node's primitives
+		const auto grow_centroids = [&](const tbb::blocked_range<int> &r, AABB box) {
+			for (int idx = r.begin(), s = r.end(); idx < s; idx++)
+				box.grow(aabbs[primIndices[lFirst + idx]].centroid());
+			return box;
+		};
+
+		AABB centroid_bounds;
+		if (parallel)
+			centroid_bounds = tbb::parallel_reduce(tbb::blocked_range<int>(0, count, PARALLEL_GRAIN_SIZE),
+												   AABB::invalid(), grow_centroids,
+												   [](const AABB &a, const AABB &b) { return AABB::union_of(a, b); });
+		else
+			centroid_bounds = grow_centroids(tbb::blocked_range<int>(0, count), AABB::invalid());
+
+		float bin_min[3], bin_scale[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float extent = centroid_bounds.extend(axis);
+			bin_min[axis] = centroid_bounds.bmin[axis];
+			// Axes on which all centroids lie on a single plane are skipped
+			bin_scale[axis] = extent > 1e-12f ? static_cast<float>(BINS) * (1.0f - 1e-5f) / extent : 0.0f;
+		}
+
+		const auto bin_primitives = [&](const tbb::blocked_range<int> &r, Bins<BINS> bins) {
+			for (int idx = r.begin(), s = r.end(); idx < s; idx++)
+			{
+				const auto &aabb = aabbs[primIndices[lFirst + idx]];
+				for (int axis = 0; axis < 3; axis++)
+				{
+					const int bin =
+						glm::min(BINS - 1, static_cast<int>((aabb.center(axis) - bin_min[axis]) * bin_scale[axis]));
+					bins.boxes[axis][bin].grow(aabb);
+					bins.counts[axis][bin]++;
+				}
+			}
+			return bins;
+		};
+
+		Bins<BINS> bins;
+		if (parallel)
+			bins = tbb::parallel_reduce(tbb::blocked_range<int>(0, count, PARALLEL_GRAIN_SIZE), Bins<BINS>(),
+										bin_primitives, [](Bins<BINS> a, const Bins<BINS> &b) {
+											a.merge(b);
+											return a;
+										});
+		else
+			bins = bin_primitives(tbb::blocked_range<int>(0, count), Bins<BINS>());
 
 		float lowest_node_cost = 1e34f;
-		float best_split = 0;
-		int bestAxis = 0;
+		int best_axis = -1;
+		int best_bin = 0;
 
 		auto best_left_box = AABB();
 		auto best_right_box = AABB();
 
-		float parent_node_cost = bounds.area() * static_cast<float>(count);
-		const vec3 lengths = this->bounds.lengths();
-
-		const float bin_size = 1.0f / static_cast<float>(BINS + 2);
+		const float parent_node_cost = bounds.area() * static_cast<float>(count);
 
 		for (int axis = 0; axis < 3; axis++)
 		{
-			for (int i = 1;
-				 i < (BINS + 2 /* add 2 bins since we don't check walls of node and thus check 2 bins less */); i++)
+			if (bin_scale[axis] == 0.0f)
+				continue;
+
+			const AABB *bin_boxes = bins.boxes[axis];
+			const int *bin_counts = bins.counts[axis];
+
+			// Sweep from the right to store the bounds of every possible right side
+			AABB right_boxes[BINS - 1];
+			int right_counts[BINS - 1];
+			auto right_box = AABB::invalid();
+			int right_count = 0;
+			for (int i = BINS - 1; i > 0; i--)
 			{
-				const auto bin_offset = float(i) * bin_size;
-				const auto split_offset = bounds.bmin[axis] + lengths[axis] * bin_offset;
-
-				int left_count = 0;
-				int right_count = 0;
-
-				auto left_box = AABB::invalid();
-				auto right_box = AABB::invalid();
+				right_box.grow(bin_boxes[i]);
+				right_count += bin_counts[i];
+				right_boxes[i - 1] = right_box;
+				right_counts[i - 1] = right_count;
+			}
 
-				for (int idx = 0; idx < count; idx++)
-				{
-					const auto &aabb = aabbs[primIndices[lFirst + idx]];
-					if (aabb.centroid()[axis] <= split_offset)
-					{
-						left_box.grow(aabb);
-						left_count++;
-					}
-					else
-					{
-						right_box.grow(aabb);
-						right_count++;
-					}
-				}
+			auto left_box = AABB::invalid();
+			int left_count = 0;
+			for (int i = 0; i < BINS - 1; i++)
+			{
+				left_box.grow(bin_boxes[i]);
+				left_count += bin_counts[i];
 
-				const float leftArea = left_box.area();
-				const float rightArea = right_box.area();
+				if (left_count == 0 || right_counts[i] == 0)
+					continue;
 
-				const float splitNodeCost = leftArea * float(left_count) + rightArea * float(right_count);
+				const float splitNodeCost = left_box.area() * static_cast<float>(left_count) +
+											right_boxes[i].area() * static_cast<float>(right_counts[i]);
 				if (lowest_node_cost > splitNodeCost)
 				{
 					lowest_node_cost = splitNodeCost;
-					best_split = split_offset;
-					bestAxis = axis;
+					best_axis = axis;
+					best_bin = i;
 
 					best_left_box = left_box;
-					best_right_box = right_box;
+					best_right_box = right_boxes[i];
 				}
 			}
 		}
 
-		if (parent_node_cost < lowest_node_cost)
+		if (best_axis < 0 || parent_node_cost < lowest_node_cost)
 			return false;
 
-		for (int idx = 0; idx < count; idx++)
-		{
-			const auto &aabb = aabbs[primIndices[lFirst + idx]];
+		const auto is_left = [&](unsigned int primIdx) {
+			const float center = aabbs[primIdx].center(best_axis);
+			const int bin = glm::min(BINS - 1, static_cast<int>((center - bin_min[best_axis]) * bin_scale[best_axis]));
+			return bin <= best_bin;
+		};
 
-			if (aabb.centroid()[bestAxis] <= best_split) // is on left side
-			{
-				std::swap(primIndices[lFirst + idx], primIndices[lFirst + lCount]);
-				lCount++;
-				rFirst++;
-				rCount--;
-			}
-		}
+		int lCount = 0;
+		if (parallel)
+			lCount = partition_parallel(primIndices + lFirst, count, is_left);
+		else
+			lCount = static_cast<int>(std::partition(primIndices + lFirst, primIndices + lFirst + count, is_left) -
+									  (primIndices + lFirst));
+
+		const int rFirst = lFirst + lCount;
+		const int rCount = count - lCount;
 
 		*left = poolPtr.fetch_add(2);
 		*right = *left + 1;
@@ -232,6 +308,48 @@ struct BVHNode
 		return true;
 	}
 
+	// Stable partition in fixed-size blocks: count per block, prefix sum, scatter into a copy, returns the left count
+	template <typename PRED> static int partition_parallel(unsigned int *primIndices, int count, const PRED &is_left)
+	{
+		const int block_count = (count + PARALLEL_GRAIN_SIZE - 1) / PARALLEL_GRAIN_SIZE;
+		std::vector<int> left_offsets(block_count + 1, 0);
+		std::vector<int> right_offsets(block_count + 1, 0);
+
+		tbb::parallel_for(0, block_count, [&](int block) {
+			const int begin = block * PARALLEL_GRAIN_SIZE;
+			const int end = glm::min(count, begin + PARALLEL_GRAIN_SIZE);
+			int left_count = 0;
+			for (int i = begin; i < end; i++)
+				left_count += is_left(primIndices[i]) ? 1 : 0;
+			left_offsets[block + 1] = left_count;
+			right_offsets[block + 1] = (end - begin) - left_count;
+		});
+
+		for (int block = 0; block < block_count; block++)
+		{
+			left_offsets[block + 1] += left_offsets[block];
+			right_offsets[block + 1] += right_offsets[block];
+		}
+
+		const int lCount = left_offsets[block_count];
+		const std::vector<unsigned int> source(primIndices, primIndices + count);
+		tbb::parallel_for(0, block_count, [&](int block) {
+			const int begin = block * PARALLEL_GRAIN_SIZE;
+			const int end = glm::min(count, begin + PARALLEL_GRAIN_SIZE);
+			int left_idx = left_offsets[block];
+			int right_idx = lCount + right_offsets[block];
+			for (int i = begin; i < end; i++)
+			{
+				if (is_left(source[i]))
+					primIndices[left_idx++] = source[i];
+				else
+					primIndices[right_idx++] = source[i];
+			}
+		});
+
+		return lCount;
+	}
+
 	void calculate_bounds(const AABB *aabbs, const unsigned int *primitiveIndices);
 
 	template <typename FUNC> // (int primIdx, __m128* store_mask) -> int
@@ -242,8 +360,8 @@ struct BVHNode
 	{
 		using namespace simd;
 
-		BVHTraversal todo[32];
-		int stackPtr = 0;
+		traversal_stack<BVHTraversal, 32> todo;
+		BVH_STATS_TRAVERSAL();
 		int hitMask = 0;
 		simd::vector4 tNear1 = _mm_setzero_ps(), tFar1 = _mm_setzero_ps();
 		simd::vector4 tNear2 = _mm_setzero_ps(), tFar2 = _mm_setzero_ps();
@@ -252,23 +370,17 @@ struct BVHNode
 		const simd::vector4 inv_dir_y = ONE4 / vector4(dir_y);
 		const simd::vector4 inv_dir_z = ONE4 / vector4(dir_z);
 
-		todo[stackPtr].nodeIdx = 0;
-		while (stackPtr >= 0)
+		todo.push(0);
+		while (!todo.empty())
 		{
-			const auto &node = nodes[todo[stackPtr].nodeIdx];
-			stackPtr--;
+			const auto &node = nodes[todo.pop().nodeIdx];
+			BVH_STATS_NODE_VISITS(1);
 
 			if (node.get_count() > -1)
 			{
-				for (int i = 0; i < node.get_count(); i++)
-				{
-					const auto primIDx = primIndices[node.get_left_first() + i];
-					__m128 store_mask = _mm_setzero_ps();
-					int mask = intersection(primIDx, &store_mask);
-					*hit_mask = _mm_or_ps(*hit_mask, store_mask);
-					hitMask |= mask;
-					_mm_maskstore_epi32(primID, _mm_castps_si128(store_mask), _mm_set1_epi32(primIDx));
-				}
+				BVH_STATS_LEAF(intersection, node.get_count());
+				hitMask |= intersect_leaf4(intersection, node.get_left_first(), node.get_count(), primIndices, primID,
+										   hit_mask);
 			}
 			else
 			{
@@ -285,28 +397,22 @@ struct BVHNode
 				{
 					if ((tNear1 < tNear2).move_mask() > 0 /* tNear1 < tNear2*/)
 					{
-						stackPtr++;
-						todo[stackPtr] = {node.get_left_first()};
-						stackPtr++;
-						todo[stackPtr] = {node.get_left_first() + 1};
+						todo.push(node.get_left_first());
+						todo.push(node.get_left_first() + 1);
 					}
 					else
 					{
-						stackPtr++;
-						todo[stackPtr] = {node.get_left_first() + 1};
-						stackPtr++;
-						todo[stackPtr] = {node.get_left_first()};
+						todo.push(node.get_left_first() + 1);
+						todo.push(node.get_left_first());
 					}
 				}
 				else if (hitLeft)
 				{
-					stackPtr++;
-					todo[stackPtr] = {node.get_left_first()};
+					todo.push(node.get_left_first());
 				}
 				else if (hitRight)
 				{
-					stackPtr++;
-					todo[stackPtr] = {node.get_left_first() + 1};
+					todo.push(node.get_left_first() + 1);
 				}
 			}
 		}
@@ -319,30 +425,24 @@ struct BVHNode
 							 const BVHNode *nodes, const unsigned int *primIndices, const FUNC &intersection)
 	{
 		bool valid = false;
-		BVHTraversal todo[32];
-		int stackPtr = 0;
+		traversal_stack<BVHTraversal, 32> todo;
+		BVH_STATS_TRAVERSAL();
 		float tNear1, tFar1;
 		float tNear2, tFar2;
 
 		const glm::vec3 dirInverse = 1.0f / dir;
 
-		todo[stackPtr].nodeIdx = 0;
-		while (stackPtr >= 0)
+		todo.push(0);
+		while (!todo.empty())
 		{
-			const auto &node = nodes[todo[stackPtr].nodeIdx];
-			stackPtr--;
+			const auto &node = nodes[todo.pop().nodeIdx];
+			BVH_STATS_NODE_VISITS(1);
 
 			if (node.get_count() > -1)
 			{
-				for (int i = 0; i < node.get_count(); i++)
-				{
-					const auto primID = primIndices[node.get_left_first() + i];
-					if (intersection(primID))
-					{
-						valid = true;
-						*hit_idx = primID;
-					}
-				}
+				BVH_STATS_LEAF(intersection, node.get_count());
+				if (intersect_leaf(intersection, node.get_left_first(), node.get_count(), primIndices, hit_idx))
+					valid = true;
 			}
 			else
 			{
@@ -353,28 +453,22 @@ struct BVHNode
 				{
 					if (tNear1 < tNear2)
 					{
-						stackPtr++;
-						todo[stackPtr] = {node.get_left_first()};
-						stackPtr++;
-						todo[stackPtr] = {node.get_left_first() + 1};
+						todo.push(node.get_left_first());
+						todo.push(node.get_left_first() + 1);
 					}
 					else
 					{
-						stackPtr++;
-						todo[stackPtr] = {node.get_left_first() + 1};
-						stackPtr++;
-						todo[stackPtr] = {node.get_left_first()};
+						todo.push(node.get_left_first() + 1);
+						todo.push(node.get_left_first());
 					}
 				}
 				else if (hit_left)
 				{
-					stackPtr++;
-					todo[stackPtr] = {node.get_left_first()};
+					todo.push(node.get_left_first());
 				}
 				else if (hit_right)
 				{
-					stackPtr++;
-					todo[stackPtr] = {node.get_left_first() + 1};
+					todo.push(node.get_left_first() + 1);
 				}
 			}
 		}
@@ -386,27 +480,24 @@ struct BVHNode
 	static bool traverse_bvh_shadow(const glm::vec3 &org, const glm::vec3 &dir, float t_min, float maxDist,
 									const BVHNode *nodes, const unsigned int *primIndices, const FUNC &intersection)
 	{
-		BVHTraversal todo[32];
-		int stackPtr = 0;
+		traversal_stack<BVHTraversal, 32> todo;
+		BVH_STATS_TRAVERSAL();
 		float tNear1, tFar1;
 		float tNear2, tFar2;
 
 		const glm::vec3 dirInverse = 1.0f / dir;
 
-		todo[stackPtr].nodeIdx = 0;
-		while (stackPtr >= 0)
+		todo.push(0);
+		while (!todo.empty())
 		{
-			const auto &node = nodes[todo[stackPtr].nodeIdx];
-			stackPtr--;
+			const auto &node = nodes[todo.pop().nodeIdx];
+			BVH_STATS_NODE_VISITS(1);
 
 			if (node.get_count() > -1)
 			{
-				for (int i = 0; i < node.get_count(); i++)
-				{
-					const auto primID = primIndices[node.get_left_first() + i];
-					if (intersection(primID))
-						return true;
-				}
+				BVH_STATS_LEAF(intersection, node.get_count());
+				if (occluded_leaf(intersection, node.get_left_first(), node.get_count(), primIndices))
+					return true;
 			}
 			else
 			{
@@ -418,34 +509,211 @@ struct BVHNode
 				{
 					if (tNear1 < tNear2)
 					{
-						stackPtr++;
-						todo[stackPtr] = {node.get_left_first()};
-						stackPtr++;
-						todo[stackPtr] = {node.get_left_first() + 1};
+						todo.push(node.get_left_first());
+						todo.push(node.get_left_first() + 1);
 					}
 					else
 					{
-						stackPtr++;
-						todo[stackPtr] = {node.get_left_first() + 1};
-						stackPtr++;
-						todo[stackPtr] = {node.get_left_first()};
+						todo.push(node.get_left_first() + 1);
+						todo.push(node.get_left_first());
 					}
 				}
 				else if (hit_left)
 				{
-					stackPtr++;
-					todo[stackPtr] = {node.get_left_first()};
+					todo.push(node.get_left_first());
 				}
 				else if (hit_right)
 				{
-					stackPtr++;
-					todo[stackPtr] = {node.get_left_first() + 1};
+					todo.push(node.get_left_first() + 1);
 				}
 			}
 		}
 
 		return false;
 	}
+
+	/*
+	 * Any-hit traversal of 4 rays, returns the mask of occluded lanes. Inactive and occluded lanes get a negative
+	 * distance so they fail every node test, traversal stops as soon as all active lanes are occluded.
+	 */
+	template <typename FUNC> // (int primIdx, int active_mask) -> int occluded_mask
+	static int traverse_bvh_shadow4(const float origin_x[4], const float origin_y[4], const float origin_z[4],
+									const float dir_x[4], const float dir_y[4], const float dir_z[4],
+									const float t_max[4], int active_mask, const BVHNode *nodes,
+									const unsigned int *primIndices, const FUNC &intersection)
+	{
+		using namespace simd;
+
+		traversal_stack<BVHTraversal, 32> todo;
+		BVH_STATS_TRAVERSAL();
+		int occludedMask = 0;
+		simd::vector4 tNear1 = _mm_setzero_ps(), tFar1 = _mm_setzero_ps();
+		simd::vector4 tNear2 = _mm_setzero_ps(), tFar2 = _mm_setzero_ps();
+
+		float t[4];
+		for (int i = 0; i < 4; i++)
+			t[i] = (active_mask & (1 << i)) ? t_max[i] : -1e34f;
+
+		const simd::vector4 inv_dir_x = ONE4 / vector4(dir_x);
+		const simd::vector4 inv_dir_y = ONE4 / vector4(dir_y);
+		const simd::vector4 inv_dir_z = ONE4 / vector4(dir_z);
+
+		todo.push(0);
+		while (!todo.empty())
+		{
+			const auto &node = nodes[todo.pop().nodeIdx];
+			BVH_STATS_NODE_VISITS(1);
+
+			if (node.get_count() > -1)
+			{
+				BVH_STATS_LEAF(intersection, node.get_count());
+				const int mask = occluded_leaf4(intersection, node.get_left_first(), node.get_count(), primIndices,
+												active_mask & ~occludedMask);
+				if (mask == 0)
+					continue;
+
+				occludedMask |= mask;
+				if (occludedMask == active_mask)
+					return occludedMask;
+
+				for (int i = 0; i < 4; i++)
+				{
+					if (mask & (1 << i))
+						t[i] = -1e34f;
+				}
+			}
+			else
+			{
+				const int hitLeft = nodes[node.get_left_first()].bounds.intersect4(
+					origin_x, origin_y, origin_z, reinterpret_cast<const float *>(&inv_dir_x),
+					reinterpret_cast<const float *>(&inv_dir_y), reinterpret_cast<const float *>(&inv_dir_z), t,
+					&tNear1, &tFar1);
+				const int hitRight = nodes[node.get_left_first() + 1].bounds.intersect4(
+					origin_x, origin_y, origin_z, reinterpret_cast<const float *>(&inv_dir_x),
+					reinterpret_cast<const float *>(&inv_dir_y), reinterpret_cast<const float *>(&inv_dir_z), t,
+					&tNear2, &tFar2);
+
+				if (hitLeft > 0 && hitRight > 0)
+				{
+					if ((tNear1 < tNear2).move_mask() > 0 /* tNear1 < tNear2*/)
+					{
+						todo.push(node.get_left_first());
+						todo.push(node.get_left_first() + 1);
+					}
+					else
+					{
+						todo.push(node.get_left_first() + 1);
+						todo.push(node.get_left_first());
+					}
+				}
+				else if (hitLeft)
+				{
+					todo.push(node.get_left_first());
+				}
+				else if (hitRight)
+				{
+					todo.push(node.get_left_first() + 1);
+				}
+			}
+		}
+
+		return occludedMask;
+	}
+
+	/*
+	 * Traverses a batch of rays together. Every node only tests the rays that intersected its parent, the active ray
+	 * lists of all stack entries are stored consecutively so a popped entry always owns the end of the list.
+	 * Children are visited in the order preferred by the majority of rays that intersect both.
+	 */
+	template <typename FUNC> // (int primIdx, int rayIdx) -> bool
+	static void traverse_bvh_stream(const RayStreamSoA &rays, float *t, const int *rayIndices, int rayCount,
+									const BVHNode *nodes, const unsigned int *primIndices, const FUNC &intersection)
+	{
+		// Buffers keep their capacity between batches, only the first batches of a thread allocate
+		StreamScratch &scratch = StreamScratch::get();
+		std::vector<glm::vec3> &origins = scratch.origins;
+		std::vector<glm::vec3> &dirInverses = scratch.dir_inverses;
+		std::vector<int> &active = scratch.active;
+		std::vector<int> &left_rays = scratch.left_rays;
+		std::vector<int> &right_rays = scratch.right_rays;
+		origins.resize(rayCount);
+		dirInverses.resize(rayCount);
+		active.resize(rayCount);
+
+		for (int i = 0; i < rayCount; i++)
+		{
+			const int ray = rayIndices[i];
+			origins[i] = glm::vec3(rays.origin_x[ray], rays.origin_y[ray], rays.origin_z[ray]);
+			dirInverses[i] = 1.0f / glm::vec3(rays.dir_x[ray], rays.dir_y[ray], rays.dir_z[ray]);
+			active[i] = i;
+		}
+
+		traversal_stack<BVHStreamTraversal, 32> todo;
+		BVH_STATS_TRAVERSAL();
+		todo.push({0, 0, rayCount});
+		while (!todo.empty())
+		{
+			const BVHStreamTraversal entry = todo.pop();
+			BVH_STATS_NODE_VISITS(entry.count);
+			const auto &node = nodes[entry.nodeIdx];
+			// Everything after this entry's range belongs to sub-trees that were already traversed
+			active.resize(entry.begin + entry.count);
+
+			if (node.get_count() > -1)
+			{
+				BVH_STATS_LEAF(intersection, node.get_count() * entry.count);
+				for (int i = 0; i < node.get_count(); i++)
+				{
+					const auto primID = primIndices[node.get_left_first() + i];
+					for (int j = entry.begin, end = entry.begin + entry.count; j < end; j++)
+						intersection(primID, rayIndices[active[j]]);
+				}
+				continue;
+			}
+
+			const BVHNode &left = nodes[node.get_left_first()];
+			const BVHNode &right = nodes[node.get_left_first() + 1];
+
+			left_rays.clear();
+			right_rays.clear();
+			int left_first = 0;
+			for (int j = entry.begin, end = entry.begin + entry.count; j < end; j++)
+			{
+				const int slot = active[j];
+				const float ray_t = t[rayIndices[slot]];
+				float tNear1, tFar1;
+				float tNear2, tFar2;
+
+				const bool hit_left = left.intersect(origins[slot], dirInverses[slot], &tNear1, &tFar1, ray_t);
+				const bool hit_right = right.intersect(origins[slot], dirInverses[slot], &tNear2, &tFar2, ray_t);
+
+				if (hit_left)
+					left_rays.push_back(slot);
+				if (hit_right)
+					right_rays.push_back(slot);
+				if (hit_left && hit_right)
+					left_first += tNear1 < tNear2 ? 1 : -1;
+			}
+
+			// The child visited last is pushed first and its rays are stored first
+			const bool visit_left_first = left_first >= 0;
+			const int first_idx = visit_left_first ? node.get_left_first() : node.get_left_first() + 1;
+			const int last_idx = visit_left_first ? node.get_left_first() + 1 : node.get_left_first();
+			const std::vector<int> &first_rays = visit_left_first ? left_rays : right_rays;
+			const std::vector<int> &last_rays = visit_left_first ? right_rays : left_rays;
+
+			if (!last_rays.empty())
+			{
+				todo.push({last_idx, static_cast<int>(active.size()), static_cast<int>(last_rays.size())});
+				active.insert(active.end(), last_rays.begin(), last_rays.end());
+			}
+			if (!first_rays.empty())
+			{
+				todo.push({first_idx, static_cast<int>(active.size()), static_cast<int>(first_rays.size())});
+				active.insert(active.end(), first_rays.begin(), first_rays.end());
+			}
+		}
+	}
 };
 } // namespace bvh
-} // namespace rfw
\ No newline at end of file
+} // namespace rfw
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <rfw/math.h>
+#include <rfw/context/settings.h>
+
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace rfw
+{
+namespace bvh
+{
+class BVHTree;
+struct BVHNode;
+class MBVHNode;
+class MBVH8Node;
+
+// Quality metrics of a constructed tree, gathered on request and thus not part of the traversal cost
+struct BVHStats
+{
+	// Surface area heuristic cost relative to the root, traversal and primitive tests are weighted equally
+	float sah_cost = 0.0f;
+	// Effective primitive overlap: surface area of triangles inside nodes that do not reference them, weighted like
+	// sah_cost and relative to the total triangle area. Only available for trees over triangles.
+	float epo = 0.0f;
+
+	int node_count = 0;
+	int leaf_count = 0;
+	int max_depth = 0;
+
+	std::vector<int> depth_histogram;	  // Number of leaves at every depth
+	std::vector<int> leaf_size_histogram; // Number of leaves per primitive count
+};
+
+namespace stats
+{
+// Computes the metrics of a tree, EPO is only computed when the triangles of the tree are passed
+BVHStats compute(const std::vector<BVHNode> &nodes, const BVHTree *triangles = nullptr);
+BVHStats compute(const std::vector<MBVHNode> &nodes, const BVHTree *triangles = nullptr);
+BVHStats compute(const std::vector<MBVH8Node> &nodes, const BVHTree *triangles = nullptr);
+
+struct TraversalCounters
+{
+	uint64_t node_visits = 0;
+	uint64_t prim_tests = 0;
+};
+
+// Adds the counters of a finished traversal to the counters of the calling thread
+void add(const TraversalCounters &counters);
+// Sums the counters of all threads, counters are only consistent when no rays are being traced
+TraversalCounters collect();
+void reset();
+
+// Leaf callback of a top level traversal. Its leaves hold instances, which are not counted as primitive tests. Every
+// other leaf callback tests primitives, one at a time or a complete leaf range at once.
+template <typename FUNC> class InstanceLeaves
+{
+  public:
+	explicit InstanceLeaves(FUNC func) : m_Func(std::move(func)) {}
+
+	// Only invocable with the arguments of the wrapped callback, leaf helpers select their variant by signature
+	template <typename... ARGS>
+	auto operator()(ARGS... args) const -> decltype(std::declval<const FUNC &>()(args...))
+	{
+		return m_Func(args...);
+	}
+
+  private:
+	FUNC m_Func;
+};
+
+template <typename FUNC> InstanceLeaves<FUNC> instance_leaves(FUNC func)
+{
+	return InstanceLeaves<FUNC>(std::move(func));
+}
+
+template <typename FUNC> constexpr bool is_instance_leaves_v = false;
+template <typename FUNC> constexpr bool is_instance_leaves_v<InstanceLeaves<FUNC>> = true;
+
+// Counts a single traversal in locals, thread counters are only touched once when the traversal finishes
+class TraversalScope : public TraversalCounters
+{
+  public:
+	TraversalScope() = default;
+	TraversalScope(const TraversalScope &) = delete;
+	~TraversalScope() { add(*this); }
+
+	template <typename FUNC> void leaf(int count)
+	{
+		if constexpr (!is_instance_leaves_v<FUNC>)
+			prim_tests += count;
+	}
+};
+} // namespace stats
+} // namespace bvh
+} // namespace rfw
+
+#if BVH_STATS
+#define BVH_STATS_TRAVERSAL() rfw::bvh::stats::TraversalScope bvh_stats_scope
+#define BVH_STATS_NODE_VISITS(count) bvh_stats_scope.node_visits += (count)
+#define BVH_STATS_LEAF(func, count) bvh_stats_scope.leaf<std::decay_t<decltype(func)>>(count)
+#else
+#define BVH_STATS_TRAVERSAL() (void)0
+#define BVH_STATS_NODE_VISITS(count) (void)0
+#define BVH_STATS_LEAF(func, count) (void)0
+#endif
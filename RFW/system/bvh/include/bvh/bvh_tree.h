@@ -2,7 +2,8 @@
 
 #include "bvh_node.h"
 #include "aabb.h"
-#include <rtbvh.hpp>
+#include "leaf_triangles.h"
+#include "bvh_stats.h"
 
 #include <vector>
 #include <optional>
@@ -37,13 +38,27 @@ class BVHTree
 	int traverse4(const float origin_x[4], const float origin_y[4], const float origin_z[4], const float dir_x[4],
 				  const float dir_y[4], const float dir_z[4], float t[4], int primID[4], float t_min, __m128 *hit_mask);
 	bool traverse_shadow(const glm::vec3 &origin, const glm::vec3 &dir, float t_min, float t_max);
+	// Returns the mask of the active lanes that are occluded before their t_max
+	int traverse_shadow4(const float origin_x[4], const float origin_y[4], const float origin_z[4], const float dir_x[4],
+						 const float dir_y[4], const float dir_z[4], float t_min, const float t_max[4],
+						 int active_mask);
+	// Traversal of alpha tested meshes, hits rejected by the filter are skipped
+	bool traverse(const glm::vec3 &origin, const glm::vec3 &dir, float t_min, float *t, int *primIdx, glm::vec2 *bary,
+				  const HitFilter &filter);
+	bool traverse_shadow(const glm::vec3 &origin, const glm::vec3 &dir, float t_min, float t_max,
+						 const HitFilter &filter);
 
 	void set_vertices(const glm::vec4 *vertices);
 	void set_vertices(const glm::vec4 *vertices, const glm::uvec3 *indices);
 
+	// Corners of triangle primID, read from the vertices the tree was last constructed or refitted with
+	void get_triangle(int primID, glm::vec3 *p0, glm::vec3 *p1, glm::vec3 *p2) const;
+
 	AABB get_aabb() const;
+	// Computing EPO clips every triangle against all nodes it overlaps, which is expensive for large meshes
+	BVHStats get_stats(bool epo = true) const;
 
-	operator bool() const { return instance.has_value(); }
+	operator bool() const { return !nodes.empty(); }
 
   public:
 	const glm::vec4 *vertices = nullptr;
@@ -52,13 +67,13 @@ class BVHTree
 	const int vertex_count = -1;
 	const int face_count = -1;
 
-	std::optional<rtbvh::RTBVH> instance = std::nullopt;
+	std::vector<BVHNode> nodes;
+	std::vector<unsigned int> prim_indices;
 	std::vector<AABB> aabbs;
 	std::vector<glm::vec4> splat_vertices;
 
-	std::vector<glm::vec3> p0s;
-	std::vector<glm::vec3> edge1s;
-	std::vector<glm::vec3> edge2s;
+	// Triangles in leaf order, used by the traversal of this tree and the MBVHs built from it
+	LeafTriangles leaf_triangles;
 };
 } // namespace bvh
 } // namespace rfw
\ No newline at end of file
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <rfw/math.h>
+
+#include <type_traits>
+
+namespace rfw
+{
+namespace bvh
+{
+/*
+ * Leaf helpers shared by the traversal templates. A traversal callback either intersects a single primitive or, when
+ * it accepts (int first, int count), a complete leaf range of the primitive index list at once. Range callbacks are
+ * used with the SoA triangle storage in LeafTriangles.
+ */
+
+// Range callback: (int first, int count) -> int primIdx or -1
+template <typename FUNC>
+inline bool intersect_leaf(const FUNC &func, int first, int count, const unsigned int *primIndices, int *hit_idx)
+{
+	if constexpr (std::is_invocable_v<const FUNC &, int, int>)
+	{
+		const int primID = func(first, count);
+		if (primID < 0)
+			return false;
+		*hit_idx = primID;
+		return true;
+	}
+	else
+	{
+		bool valid = false;
+		for (int i = 0; i < count; i++)
+		{
+			const auto primID = primIndices[first + i];
+			if (func(primID))
+			{
+				valid = true;
+				*hit_idx = primID;
+			}
+		}
+		return valid;
+	}
+}
+
+// Range callback: (int first, int count, __m128 *store_mask) -> int, stores primitive indices itself
+template <typename FUNC>
+inline int intersect_leaf4(const FUNC &func, int first, int count, const unsigned int *primIndices, int primID[4],
+						   __m128 *hit_mask)
+{
+	int hitMask = 0;
+	if constexpr (std::is_invocable_v<const FUNC &, int, int, __m128 *>)
+	{
+		__m128 store_mask = _mm_setzero_ps();
+		hitMask = func(first, count, &store_mask);
+		*hit_mask = _mm_or_ps(*hit_mask, store_mask);
+	}
+	else
+	{
+		for (int i = 0; i < count; i++)
+		{
+			const auto primIDx = primIndices[first + i];
+			__m128 store_mask = _mm_setzero_ps();
+			int mask = func(primIDx, &store_mask);
+			*hit_mask = _mm_or_ps(*hit_mask, store_mask);
+			hitMask |= mask;
+			_mm_maskstore_epi32(primID, _mm_castps_si128(store_mask), _mm_set1_epi32(primIDx));
+		}
+	}
+	return hitMask;
+}
+
+// Range callback: (int first, int count) -> bool
+template <typename FUNC>
+inline bool occluded_leaf(const FUNC &func, int first, int count, const unsigned int *primIndices)
+{
+	if constexpr (std::is_invocable_v<const FUNC &, int, int>)
+	{
+		return func(first, count);
+	}
+	else
+	{
+		for (int i = 0; i < count; i++)
+		{
+			if (func(primIndices[first + i]))
+				return true;
+		}
+		return false;
+	}
+}
+
+// Range callback: (int first, int count, int active_mask) -> int occluded_mask, only active lanes are tested
+template <typename FUNC>
+inline int occluded_leaf4(const FUNC &func, int first, int count, const unsigned int *primIndices, int active_mask)
+{
+	if constexpr (std::is_invocable_v<const FUNC &, int, int, int>)
+	{
+		return func(first, count, active_mask);
+	}
+	else
+	{
+		int occludedMask = 0;
+		for (int i = 0; i < count && occludedMask != active_mask; i++)
+			occludedMask |= func(primIndices[first + i], active_mask & ~occludedMask);
+		return occludedMask;
+	}
+}
+} // namespace bvh
+} // namespace rfw
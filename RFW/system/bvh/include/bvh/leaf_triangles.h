@@ -0,0 +1,61 @@
+#pragma once
+
+#include <rfw/math.h>
+
+#include <vector>
+
+namespace rfw
+{
+namespace bvh
+{
+class BVHTree;
+
+/*
+ * Any-hit filter of alpha tested geometry, returns false to reject the hit of triangle prim_id. u and v are the
+ * barycentric coordinates of the hit with respect to the second and third vertex.
+ */
+struct HitFilter
+{
+	bool (*accept)(const void *user_data, int prim_id, float u, float v) = nullptr;
+	const void *user_data = nullptr;
+
+	bool operator()(int prim_id, float u, float v) const { return accept(user_data, prim_id, u, v); }
+};
+
+/*
+ * Triangles stored in BVH leaf order as structure of arrays, every leaf is a contiguous range that is intersected
+ * 8 triangles at a time using AVX2. Ranges follow the primitive index list of the BVH so the leaf ranges of the
+ * binary, 4-wide and 8-wide trees can be used as-is. Arrays are padded so the last chunk can be loaded unmasked.
+ */
+class LeafTriangles
+{
+  public:
+	// Gathers the triangles of a constructed or refitted BVH in leaf order
+	void build(const BVHTree &bvh);
+	void clear();
+
+	// Intersects triangles [first, first + count), returns the primitive index of the closest hit or -1
+	int intersect(const glm::vec3 &org, const glm::vec3 &dir, float t_min, float *t, int first, int count,
+				  glm::vec2 *bary = nullptr) const;
+	// Intersects 4 rays against every triangle of the range at once using SSE, hit rays store their primitive index
+	// in primID and their lane in store_mask
+	int intersect4(const float origin_x[4], const float origin_y[4], const float origin_z[4], const float dir_x[4],
+				   const float dir_y[4], const float dir_z[4], float t_min, float t[4], int primID[4], int first,
+				   int count, __m128 *store_mask) const;
+	bool occluded(const glm::vec3 &org, const glm::vec3 &dir, float t_min, float t_max, int first, int count) const;
+
+	// Variants for alpha tested geometry, hits rejected by the filter are ignored
+	int intersect(const glm::vec3 &org, const glm::vec3 &dir, float t_min, float *t, int first, int count,
+				  const HitFilter &filter, glm::vec2 *bary = nullptr) const;
+	bool occluded(const glm::vec3 &org, const glm::vec3 &dir, float t_min, float t_max, int first, int count,
+				  const HitFilter &filter) const;
+
+	[[nodiscard]] bool empty() const { return prim_ids.empty(); }
+
+	std::vector<float> p0_x, p0_y, p0_z;
+	std::vector<float> edge1_x, edge1_y, edge1_z;
+	std::vector<float> edge2_x, edge2_y, edge2_z;
+	std::vector<int> prim_ids;
+};
+} // namespace bvh
+} // namespace rfw
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "aabb.h"
+
+#include <rfw/context/structs.h>
+
+#include <vector>
+
+namespace rfw
+{
+namespace bvh
+{
+// Emitted power used to select lights, area lights store their radiance as energy
+inline float light_power(const AreaLight &l) { return l.energy * l.area; }
+inline float light_power(const PointLight &l) { return l.energy; }
+inline float light_power(const SpotLight &l) { return l.energy; }
+inline float light_power(const DirectionalLight &l) { return l.energy; }
+
+/*
+ * Light hierarchy for many-light sampling. Every node bounds the positions, power and emission directions of its
+ * lights, a light is picked by descending the tree once and choosing children proportional to an estimate of their
+ * contribution to the shading point, which accounts for distance and orientation. Lights are indexed in the order
+ * area, point, spot. Directional lights have no position and are not part of the tree.
+ */
+class LightBVH
+{
+  public:
+	struct LightBounds
+	{
+		AABB bounds;
+		glm::vec3 axis; // Emission direction
+		float power;
+		float theta_o; // Spread of the emission directions around the axis
+		float theta_e; // Angle beyond theta_o that light is still emitted at
+	};
+
+	struct LightNode
+	{
+		LightBounds bounds;
+		int left_first;
+		int count; // Negative for interior nodes
+
+		[[nodiscard]] bool is_leaf() const { return count >= 0; }
+	};
+
+	LightBVH() = default;
+
+	void build(const AreaLight *areaLights, size_t areaCount, const PointLight *pointLights, size_t pointCount,
+			   const SpotLight *spotLights, size_t spotCount);
+	// Updates the bounds of the existing tree in place, light counts must not have changed since the last build
+	void refit(const AreaLight *areaLights, size_t areaCount, const PointLight *pointLights, size_t pointCount,
+			   const SpotLight *spotLights, size_t spotCount);
+	void clear();
+
+	// Picks a light for shading point p using a single uniform random number, returns -1 if no light contributes
+	[[nodiscard]] int sample(const glm::vec3 &p, float r, float *pdf) const;
+	// Probability that sample picks the given light at shading point p
+	[[nodiscard]] float pdf(const glm::vec3 &p, int light) const;
+
+	[[nodiscard]] bool empty() const { return m_Lights.empty(); }
+	[[nodiscard]] size_t get_light_count() const { return m_Lights.size(); }
+	[[nodiscard]] float get_power() const { return m_Nodes.empty() ? 0.0f : m_Nodes[0].bounds.power; }
+
+  private:
+	void gather(const AreaLight *areaLights, size_t areaCount, const PointLight *pointLights, size_t pointCount,
+				const SpotLight *spotLights, size_t spotCount);
+	void refit_node(int nodeIdx, int parentIdx);
+
+	static LightBounds union_of(const LightBounds &a, const LightBounds &b);
+	static float importance(const glm::vec3 &p, const LightBounds &bounds);
+
+	std::vector<LightNode> m_Nodes;
+	std::vector<unsigned int> m_PrimIndices;
+	std::vector<LightBounds> m_Lights;
+	std::vector<int> m_Parents;		// Parent of every node, -1 for the root
+	std::vector<int> m_LightLeaves; // Leaf node of every light
+};
+} // namespace bvh
+} // namespace rfw
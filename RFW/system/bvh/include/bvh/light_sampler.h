@@ -0,0 +1,70 @@
+#pragma once
+
+#include "light_bvh.h"
+
+#include <rfw/context/structs.h>
+#include <rfw/context/device_structs.h>
+#include <rfw/utils/alias_table.h>
+
+#include <vector>
+
+namespace rfw
+{
+namespace bvh
+{
+/*
+ * Next event estimation light selection shared by the CPU backends. Keeps a copy of the scene lights and picks a
+ * single light per shading point uniformly, proportional to power or through a LightBVH. Lights are indexed in the
+ * order area, point, spot, directional.
+ */
+class LightSampler
+{
+  public:
+	enum class Selection
+	{
+		Uniform,
+		Power,
+		Hierarchy
+	};
+
+	LightSampler() = default;
+
+	// Copies the lights, the hierarchy is only refitted when no lights were added or removed
+	void set_lights(const LightCount &lightCount, const DeviceAreaLight *areaLights, const DevicePointLight *pointLights,
+					const DeviceSpotLight *spotLights, const DeviceDirectionalLight *directionalLights);
+
+	// Picks a light for shading point p using a single uniform random number, returns -1 if no light contributes
+	[[nodiscard]] int pick(const glm::vec3 &p, float r, float *pdf) const;
+	// Probability that pick returns the given light at shading point p
+	[[nodiscard]] float pdf(const glm::vec3 &p, int light) const;
+
+	// Connects shading point p with normal N to the center of an area light or to the position or direction of any
+	// other light. Stores the direction, distance and radiance arriving at p including its cosine, returns false for
+	// lights behind p and points outside the cone of a spot light
+	bool connect(int light, const glm::vec3 &p, const glm::vec3 &N, glm::vec3 *L, float *dist,
+				 glm::vec3 *radiance) const;
+
+	void set_selection(Selection selection) { m_Selection = selection; }
+	[[nodiscard]] Selection get_selection() const { return m_Selection; }
+
+	[[nodiscard]] const std::vector<AreaLight> &get_area_lights() const { return m_AreaLights; }
+	[[nodiscard]] const std::vector<PointLight> &get_point_lights() const { return m_PointLights; }
+	[[nodiscard]] const std::vector<SpotLight> &get_spot_lights() const { return m_SpotLights; }
+	[[nodiscard]] const std::vector<DirectionalLight> &get_directional_lights() const { return m_DirectionalLights; }
+
+  private:
+	// Directional lights are not part of the hierarchy, they are picked by their share of the total power
+	[[nodiscard]] float directional_probability() const;
+
+	LightCount m_LightCount = {};
+	std::vector<AreaLight> m_AreaLights;
+	std::vector<PointLight> m_PointLights;
+	std::vector<SpotLight> m_SpotLights;
+	std::vector<DirectionalLight> m_DirectionalLights;
+	utils::alias_table m_Table; // Power proportional selection over all lights
+	LightBVH m_BVH;				// Hierarchy over area, point and spot lights
+	float m_DirectionalPower = 0.0f;
+	Selection m_Selection = Selection::Hierarchy;
+};
+} // namespace bvh
+} // namespace rfw
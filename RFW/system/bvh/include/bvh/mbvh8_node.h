@@ -0,0 +1,271 @@
+#pragma once
+
+#include "AABB.h"
+#include "mbvh_node.h"
+
+#include <atomic>
+#include <rfw/utils/array_proxy.h>
+
+namespace rfw
+{
+namespace bvh
+{
+struct MBVH8Hit
+{
+	union
+	{
+		__m256 tmin8;
+		float tmin[8];
+	};
+	int mask = 0;
+
+	// Writes the indices of intersected children ordered from nearest to farthest, returns the number of children
+	int sorted_children(int order[8]) const
+	{
+		int count = 0;
+		for (int i = 0; i < 8; i++)
+		{
+			if ((mask & (1 << i)) == 0)
+				continue;
+
+			int j = count++;
+			for (; j > 0 && tmin[order[j - 1]] > tmin[i]; j--)
+				order[j] = order[j - 1];
+			order[j] = i;
+		}
+		return count;
+	}
+};
+
+/*
+ * 8-wide BVH node, bounds of all children are tested at once using AVX.
+ * Nodes are collapsed from a binary BVH by repeatedly opening the child with the largest surface area, which
+ * effectively merges up to 3 levels of the binary tree into a single node.
+ */
+class alignas(32) MBVH8Node
+{
+  public:
+	MBVH8Node()
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			bminx[i] = bminy[i] = bminz[i] = 1e34f;
+			bmaxx[i] = bmaxy[i] = bmaxz[i] = -1e34f;
+			childs[i] = -1;
+			counts[i] = 0;
+		}
+	}
+
+	~MBVH8Node() = default;
+
+	union
+	{
+		__m256 bminx_8;
+		float bminx[8];
+	};
+	union
+	{
+		__m256 bmaxx_8;
+		float bmaxx[8];
+	};
+
+	union
+	{
+		__m256 bminy_8;
+		float bminy[8];
+	};
+	union
+	{
+		__m256 bmaxy_8;
+		float bmaxy[8];
+	};
+
+	union
+	{
+		__m256 bminz_8;
+		float bminz[8];
+	};
+	union
+	{
+		__m256 bmaxz_8;
+		float bmaxz[8];
+	};
+
+	int childs[8];
+	int counts[8];
+
+	void set_bounds(unsigned int nodeIdx, const glm::vec3 &min, const glm::vec3 &max);
+
+	void set_bounds(unsigned int nodeIdx, const AABB &bounds);
+
+	MBVH8Hit intersect(const glm::vec3 &org, const glm::vec3 &dirInverse, float t) const;
+	MBVH8Hit intersect4(const float origin_x[4], const float origin_y[4], const float origin_z[4],
+						const float inv_dir_x[4], const float inv_dir_y[4], const float inv_dir_z[4],
+						const float t[4]) const;
+
+	void merge_nodes(const BVHNode &node, const rfw::utils::array_proxy<BVHNode> bvhPool, MBVH8Node *bvhTree,
+					 std::atomic_int &poolPtr);
+
+	// Recalculates child bounds in place from the primitive bounds, returns the bounds of this node
+	AABB refit(MBVH8Node *bvhTree, const uint *primIDs, const AABB *aabbs);
+
+	template <typename FUNC>
+	static bool traverse_mbvh(const glm::vec3 &org, const glm::vec3 &dir, float t_min, float *t, int *hit_idx,
+							  const MBVH8Node *nodes, const uint *primIndices, const FUNC &func)
+	{
+		bool valid = false;
+		traversal_stack<MBVHTraversal, 64> todo;
+		BVH_STATS_TRAVERSAL();
+		int order[8];
+
+		const glm::vec3 dirInverse = 1.0f / dir;
+
+		MBVH8Hit hit = nodes[0].intersect(org, dirInverse, *t);
+		BVH_STATS_NODE_VISITS(1);
+		for (int i = hit.sorted_children(order) - 1; i >= 0; i--) // reversed order, we want to check best nodes first
+		{
+			const int idx = order[i];
+			if (nodes[0].childs[idx] >= 0)
+			{
+				todo.push({nodes[0].childs[idx], nodes[0].counts[idx]});
+			}
+		}
+
+		while (!todo.empty())
+		{
+			const MBVHTraversal entry = todo.pop();
+			BVH_STATS_NODE_VISITS(1);
+			const int leftFirst = entry.leftFirst;
+			const int count = entry.count;
+
+			if (count > -1) // leaf node
+			{
+				BVH_STATS_LEAF(func, count);
+				if (intersect_leaf(func, leftFirst, count, primIndices, hit_idx))
+					valid = true;
+				continue;
+			}
+
+			hit = nodes[leftFirst].intersect(org, dirInverse, *t);
+			for (int i = hit.sorted_children(order) - 1; i >= 0; i--) // reversed order, we want to check best nodes first
+			{
+				const int idx = order[i];
+				if (nodes[leftFirst].childs[idx] >= 0)
+				{
+					todo.push({nodes[leftFirst].childs[idx], nodes[leftFirst].counts[idx]});
+				}
+			}
+		}
+
+		return valid;
+	}
+
+	template <typename FUNC> // (int primIdx, __m128* store_mask) -> int
+	static int traverse_mbvh4(const float origin_x[4], const float origin_y[4], const float origin_z[4],
+							  const float dir_x[4], const float dir_y[4], const float dir_z[4], float t[4],
+							  int primID[4], const MBVH8Node *nodes, const unsigned int *primIndices, __m128 *hit_mask,
+							  const FUNC &intersection)
+	{
+		int hitMask = 0;
+		traversal_stack<MBVHTraversal, 64> todo;
+		BVH_STATS_TRAVERSAL();
+		int order[8];
+
+		const simd::vector4 inv_dir_x = simd::ONE4 / simd::vector4(dir_x);
+		const simd::vector4 inv_dir_y = simd::ONE4 / simd::vector4(dir_y);
+		const simd::vector4 inv_dir_z = simd::ONE4 / simd::vector4(dir_z);
+
+		MBVH8Hit hit = nodes[0].intersect4(origin_x, origin_y, origin_z, reinterpret_cast<const float *>(&inv_dir_x),
+										   reinterpret_cast<const float *>(&inv_dir_y),
+										   reinterpret_cast<const float *>(&inv_dir_z), t);
+		BVH_STATS_NODE_VISITS(1);
+		for (int i = hit.sorted_children(order) - 1; i >= 0; i--) // reversed order, we want to check best nodes first
+		{
+			const int idx = order[i];
+			if (nodes[0].childs[idx] >= 0)
+			{
+				todo.push({nodes[0].childs[idx], nodes[0].counts[idx]});
+			}
+		}
+
+		while (!todo.empty())
+		{
+			const MBVHTraversal entry = todo.pop();
+			BVH_STATS_NODE_VISITS(1);
+			const int leftFirst = entry.leftFirst;
+			const int count = entry.count;
+
+			if (count > -1) // leaf node
+			{
+				BVH_STATS_LEAF(intersection, count);
+				hitMask |= intersect_leaf4(intersection, leftFirst, count, primIndices, primID, hit_mask);
+				continue;
+			}
+
+			hit = nodes[leftFirst].intersect4(origin_x, origin_y, origin_z, reinterpret_cast<const float *>(&inv_dir_x),
+											  reinterpret_cast<const float *>(&inv_dir_y),
+											  reinterpret_cast<const float *>(&inv_dir_z), t);
+			for (int i = hit.sorted_children(order) - 1; i >= 0; i--) // reversed order, we want to check best nodes first
+			{
+				const int idx = order[i];
+				if (nodes[leftFirst].childs[idx] >= 0)
+				{
+					todo.push({nodes[leftFirst].childs[idx], nodes[leftFirst].counts[idx]});
+				}
+			}
+		}
+
+		return hitMask;
+	}
+
+	template <typename FUNC>
+	static bool traverse_mbvh_shadow(const glm::vec3 &org, const glm::vec3 &dir, float t_min, float tmax,
+									 const MBVH8Node *nodes, const uint *primIndices, const FUNC &func)
+	{
+		traversal_stack<MBVHTraversal, 64> todo;
+		BVH_STATS_TRAVERSAL();
+
+		const glm::vec3 dirInverse = 1.0f / dir;
+
+		// Any hit terminates traversal, children are not sorted
+		MBVH8Hit hit = nodes[0].intersect(org, dirInverse, tmax);
+		BVH_STATS_NODE_VISITS(1);
+		for (int idx = 0; idx < 8; idx++)
+		{
+			if ((hit.mask & (1 << idx)) && nodes[0].childs[idx] >= 0)
+			{
+				todo.push({nodes[0].childs[idx], nodes[0].counts[idx]});
+			}
+		}
+
+		while (!todo.empty())
+		{
+			const MBVHTraversal entry = todo.pop();
+			BVH_STATS_NODE_VISITS(1);
+			const int leftFirst = entry.leftFirst;
+			const int count = entry.count;
+
+			if (count > -1) // leaf node
+			{
+				BVH_STATS_LEAF(func, count);
+				if (occluded_leaf(func, leftFirst, count, primIndices))
+					return true;
+				continue;
+			}
+
+			hit = nodes[leftFirst].intersect(org, dirInverse, tmax);
+			for (int idx = 0; idx < 8; idx++)
+			{
+				if ((hit.mask & (1 << idx)) && nodes[leftFirst].childs[idx] >= 0)
+				{
+					todo.push({nodes[leftFirst].childs[idx], nodes[leftFirst].counts[idx]});
+				}
+			}
+		}
+
+		// Nothing occluding
+		return false;
+	}
+};
+} // namespace bvh
+} // namespace rfw
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "aabb.h"
+#include "bvh_tree.h"
+#include "mbvh8_node.h"
+
+#include <vector>
+
+namespace rfw
+{
+namespace bvh
+{
+
+struct AABB;
+class MBVH8Node;
+
+class MBVH8Tree
+{
+  public:
+	friend class MBVH8Node;
+	MBVH8Tree();
+	MBVH8Tree(BVHTree *orgTree);
+	~MBVH8Tree();
+
+	void reset();
+	void construct();
+
+	// Refits the nodes in place to the bounds of the (already refitted) binary BVH
+	void refit();
+	void refit(const glm::vec4 *vertices);
+	void refit(const glm::vec4 *vertices, const glm::uvec3 *indices);
+
+	bool traverse(const glm::vec3 &origin, const glm::vec3 &dir, float t_min, float *t, int *primIdx, glm::vec2 *bary);
+	bool traverse(const glm::vec3 &origin, const glm::vec3 &dir, float t_min, float *t, int *primIdx);
+	int traverse4(const float origin_x[4], const float origin_y[4], const float origin_z[4], const float dir_x[4],
+				  const float dir_y[4], const float dir_z[4], float t[4], int primID[4], float t_min, __m128 *hit_mask);
+	bool traverse_shadow(const glm::vec3 &origin, const glm::vec3 &dir, float t_min, float tmax);
+
+	AABB get_aabb() const;
+	BVHStats get_stats(bool epo = true) const;
+
+	operator bool() const { return !nodes.empty(); }
+
+	BVHTree *bvh = nullptr;
+	std::vector<MBVH8Node> nodes;
+};
+
+} // namespace bvh
+} // namespace rfw
\ No newline at end of file
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "AABB.h"
+#include "traversal_stack.h"
+#include "leaf_intersection.h"
+#include "bvh_stats.h"
 
 #include <atomic>
 #include <rfw/utils/array_proxy.h>
@@ -116,19 +119,24 @@ class MBVHNode
 	void merge_nodes(const BVHNode &node, const rfw::utils::array_proxy<BVHNode> bvhPool, MBVHNode *bvhTree,
 					 std::atomic_int &poolPtr);
 
+	// Recalculates child bounds in place from the primitive bounds, returns the bounds of this node
+	AABB refit(MBVHNode *bvhTree, const uint *primIDs, const AABB *aabbs);
+
 	void sort_results(const float *tmin, int &a, int &b, int &c, int &d) const;
 
-	template <typename FUNC>
+	// Traversal templates accept any 4-wide node type that provides intersect/intersect4 and childs/counts
+	template <typename NODE, typename FUNC>
 	static bool traverse_mbvh(const glm::vec3 &org, const glm::vec3 &dir, float t_min, float *t, int *hit_idx,
-							  const MBVHNode *nodes, const uint *primIndices, const FUNC &func)
+							  const NODE *nodes, const uint *primIndices, const FUNC &func)
 	{
 		bool valid = false;
-		MBVHTraversal todo[32];
-		int stackptr = -1;
+		traversal_stack<MBVHTraversal, 32> todo;
+		BVH_STATS_TRAVERSAL();
 
 		const glm::vec3 dirInverse = 1.0f / dir;
 
 		MBVHHit hit = nodes[0].intersect(org, dirInverse, *t);
+		BVH_STATS_NODE_VISITS(1);
 		for (int i = 3; i >= 0; i--) // reversed order, we want to check best nodes first
 		{
 			const int idx = (hit.tmini[i] & 0b11);
@@ -137,30 +145,23 @@ class MBVHNode
 				const int lf = nodes[0].childs[idx];
 				if (lf >= 0)
 				{
-					stackptr++;
-					todo[stackptr].leftFirst = lf;
-					todo[stackptr].count = nodes[0].counts[idx];
+					todo.push({lf, nodes[0].counts[idx]});
 				}
 			}
 		}
 
-		while (stackptr >= 0)
+		while (!todo.empty())
 		{
-			const int leftFirst = todo[stackptr].leftFirst;
-			const int count = todo[stackptr].count;
-			stackptr--;
+			const MBVHTraversal entry = todo.pop();
+			BVH_STATS_NODE_VISITS(1);
+			const int leftFirst = entry.leftFirst;
+			const int count = entry.count;
 
 			if (count > -1) // leaf node
 			{
-				for (int i = 0; i < count; i++)
-				{
-					const auto primID = primIndices[leftFirst + i];
-					if (func(primID))
-					{
-						valid = true;
-						*hit_idx = primID;
-					}
-				}
+				BVH_STATS_LEAF(func, count);
+				if (intersect_leaf(func, leftFirst, count, primIndices, hit_idx))
+					valid = true;
 				continue;
 			}
 
@@ -170,9 +171,7 @@ class MBVHNode
 				const int idx = (hit.tmini[i] & 0b11);
 				if (hit.result[idx] == 1 && nodes[leftFirst].childs[idx] >= 0)
 				{
-					stackptr++;
-					todo[stackptr].leftFirst = nodes[leftFirst].childs[idx];
-					todo[stackptr].count = nodes[leftFirst].counts[idx];
+					todo.push({nodes[leftFirst].childs[idx], nodes[leftFirst].counts[idx]});
 				}
 			}
 		}
@@ -180,15 +179,15 @@ class MBVHNode
 		return valid;
 	}
 
-	template <typename FUNC> // (int primIdx, __m128* store_mask) -> int
+	template <typename NODE, typename FUNC> // (int primIdx, __m128* store_mask) -> int
 	static int traverse_mbvh4(const float origin_x[4], const float origin_y[4], const float origin_z[4],
 							  const float dir_x[4], const float dir_y[4], const float dir_z[4], float t[4],
-							  int primID[4], const MBVHNode *nodes, const unsigned int *primIndices, __m128 *hit_mask,
+							  int primID[4], const NODE *nodes, const unsigned int *primIndices, __m128 *hit_mask,
 							  const FUNC &intersection)
 	{
 		int hitMask = 0;
-		MBVHTraversal todo[32];
-		int stackptr = -1;
+		traversal_stack<MBVHTraversal, 32> todo;
+		BVH_STATS_TRAVERSAL();
 
 		const simd::vector4 inv_dir_x = simd::ONE4 / simd::vector4(dir_x);
 		const simd::vector4 inv_dir_y = simd::ONE4 / simd::vector4(dir_y);
@@ -197,6 +196,7 @@ class MBVHNode
 		MBVHHit hit = nodes[0].intersect4(origin_x, origin_y, origin_z, reinterpret_cast<const float *>(&inv_dir_x),
 										  reinterpret_cast<const float *>(&inv_dir_y),
 										  reinterpret_cast<const float *>(&inv_dir_z), t);
+		BVH_STATS_NODE_VISITS(1);
 		for (int i = 3; i >= 0; i--) // reversed order, we want to check best nodes first
 		{
 			const int idx = (hit.tmini[i] & 0b11);
@@ -205,30 +205,22 @@ class MBVHNode
 				const int lf = nodes[0].childs[idx];
 				if (lf >= 0)
 				{
-					stackptr++;
-					todo[stackptr].leftFirst = lf;
-					todo[stackptr].count = nodes[0].counts[idx];
+					todo.push({lf, nodes[0].counts[idx]});
 				}
 			}
 		}
 
-		while (stackptr >= 0)
+		while (!todo.empty())
 		{
-			const int leftFirst = todo[stackptr].leftFirst;
-			const int count = todo[stackptr].count;
-			stackptr--;
+			const MBVHTraversal entry = todo.pop();
+			BVH_STATS_NODE_VISITS(1);
+			const int leftFirst = entry.leftFirst;
+			const int count = entry.count;
 
 			if (count > -1) // leaf node
 			{
-				for (int i = 0; i < count; i++)
-				{
-					const auto primIDx = primIndices[leftFirst + i];
-					__m128 store_mask = _mm_setzero_ps();
-					int mask = intersection(primIDx, &store_mask);
-					*hit_mask = _mm_or_ps(*hit_mask, store_mask);
-					hitMask |= mask;
-					_mm_maskstore_epi32(primID, _mm_castps_si128(store_mask), _mm_set1_epi32(primIDx));
-				}
+				BVH_STATS_LEAF(intersection, count);
+				hitMask |= intersect_leaf4(intersection, leftFirst, count, primIndices, primID, hit_mask);
 				continue;
 			}
 
@@ -240,9 +232,7 @@ class MBVHNode
 				const int idx = (hit.tmini[i] & 0b11);
 				if (hit.result[idx] == 1 && nodes[leftFirst].childs[idx] >= 0)
 				{
-					stackptr++;
-					todo[stackptr].leftFirst = nodes[leftFirst].childs[idx];
-					todo[stackptr].count = nodes[leftFirst].counts[idx];
+					todo.push({nodes[leftFirst].childs[idx], nodes[leftFirst].counts[idx]});
 				}
 			}
 		}
@@ -250,16 +240,17 @@ class MBVHNode
 		return hitMask;
 	}
 
-	template <typename FUNC>
+	template <typename NODE, typename FUNC>
 	static bool traverse_mbvh_shadow(const glm::vec3 &org, const glm::vec3 &dir, float t_min, float tmax,
-									 const MBVHNode *nodes, const uint *primIndices, const FUNC &func)
+									 const NODE *nodes, const uint *primIndices, const FUNC &func)
 	{
-		MBVHTraversal todo[32];
-		int stackptr = -1;
+		traversal_stack<MBVHTraversal, 32> todo;
+		BVH_STATS_TRAVERSAL();
 
 		const glm::vec3 dirInverse = 1.0f / dir;
 
 		MBVHHit hit = nodes[0].intersect(org, dirInverse, tmax);
+		BVH_STATS_NODE_VISITS(1);
 		for (int i = 3; i >= 0; i--)
 		{ // reversed order, we want to check best nodes first
 			const int idx = (hit.tmini[i] & 0b11);
@@ -268,27 +259,23 @@ class MBVHNode
 				const int lf = nodes[0].childs[idx];
 				if (lf >= 0)
 				{
-					stackptr++;
-					todo[stackptr].leftFirst = lf;
-					todo[stackptr].count = nodes[0].counts[idx];
+					todo.push({lf, nodes[0].counts[idx]});
 				}
 			}
 		}
 
-		while (stackptr >= 0)
+		while (!todo.empty())
 		{
-			const int leftFirst = todo[stackptr].leftFirst;
-			const int count = todo[stackptr].count;
-			stackptr--;
+			const MBVHTraversal entry = todo.pop();
+			BVH_STATS_NODE_VISITS(1);
+			const int leftFirst = entry.leftFirst;
+			const int count = entry.count;
 
 			if (count > -1) // leaf node
 			{
-				for (int i = 0; i < count; i++)
-				{
-					const auto primID = primIndices[leftFirst + i];
-					if (func(primID))
-						return true;
-				}
+				BVH_STATS_LEAF(func, count);
+				if (occluded_leaf(func, leftFirst, count, primIndices))
+					return true;
 				continue;
 			}
 
@@ -298,9 +285,7 @@ class MBVHNode
 				const int idx = (hit.tmini[i] & 0b11);
 				if (hit.result[idx] == 1 && nodes[leftFirst].childs[idx] >= 0)
 				{
-					stackptr++;
-					todo[stackptr].leftFirst = nodes[leftFirst].childs[idx];
-					todo[stackptr].count = nodes[leftFirst].counts[idx];
+					todo.push({nodes[leftFirst].childs[idx], nodes[leftFirst].counts[idx]});
 				}
 			}
 		}
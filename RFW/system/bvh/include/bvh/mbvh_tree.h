@@ -2,7 +2,10 @@
 
 #include "aabb.h"
 #include "bvh_tree.h"
-#include <rtbvh.hpp>
+#include "mbvh_node.h"
+#include "compressed_mbvh_node.h"
+
+#include <vector>
 
 namespace rfw
 {
@@ -23,6 +26,12 @@ class MBVHTree
 	void reset();
 	void construct();
 
+	// Replaces the nodes with nodes that store quantized child bounds, traversal uses the compressed nodes afterwards
+	void compress();
+	bool is_compressed() const { return !compressed_nodes.empty(); }
+
+	// Refits the nodes in place to the bounds of the (already refitted) binary BVH
+	void refit();
 	void refit(const glm::vec4 *vertices);
 	void refit(const glm::vec4 *vertices, const glm::uvec3 *indices);
 
@@ -33,11 +42,13 @@ class MBVHTree
 	bool traverse_shadow(const glm::vec3 &origin, const glm::vec3 &dir, float t_min, float tmax);
 
 	AABB get_aabb() const;
+	BVHStats get_stats(bool epo = true) const;
 
-	operator bool() const { return instance.has_value(); }
+	operator bool() const { return !nodes.empty() || !compressed_nodes.empty(); }
 
 	BVHTree *bvh = nullptr;
-	std::optional<rtbvh::RTMBVH> instance = std::nullopt;
+	std::vector<MBVHNode> nodes;
+	std::vector<CompressedMBVHNode> compressed_nodes;
 };
 
 } // namespace bvh
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace rfw
+{
+namespace bvh
+{
+// Structure of arrays layout for large batches of rays
+struct RayStreamSoA
+{
+	void resize(size_t count);
+	void set(size_t idx, const glm::vec3 &origin, const glm::vec3 &direction, float tmax = 1e34f, float tmin = 1e-5f);
+
+	[[nodiscard]] size_t size() const { return origin_x.size(); }
+
+	std::vector<float> origin_x;
+	std::vector<float> origin_y;
+	std::vector<float> origin_z;
+
+	std::vector<float> dir_x;
+	std::vector<float> dir_y;
+	std::vector<float> dir_z;
+
+	std::vector<float> t_min;
+	std::vector<float> t_max;
+};
+
+// Hit results of a ray stream, prim_id and inst_id are -1 for rays that did not hit anything
+struct HitStreamSoA
+{
+	void resize(size_t count);
+
+	[[nodiscard]] size_t size() const { return t.size(); }
+
+	std::vector<float> t;
+	std::vector<int> prim_id;
+	std::vector<int> inst_id;
+};
+
+// Buffers of BVHNode::traverse_bvh_stream, every thread reuses its own buffers for all batches it traverses
+struct StreamScratch
+{
+	std::vector<glm::vec3> origins;
+	std::vector<glm::vec3> dir_inverses;
+	std::vector<int> active;
+	std::vector<int> left_rays;
+	std::vector<int> right_rays;
+
+	// Buffers of the calling thread, stream traversals must thus not be nested
+	static StreamScratch &get();
+};
+
+} // namespace bvh
+} // namespace rfw
@@ -6,15 +6,26 @@ namespace bvh
 {
 class BVHTree;
 class MBVHTree;
+class MBVH8Tree;
 
 struct rfwMesh
 {
 	rfwMesh() = default;
 
 	void set_geometry(const Mesh &mesh);
+	// Store the MBVH with 8-bit quantized child bounds to reduce its memory footprint
+	void set_compressed(bool value);
 
 	std::unique_ptr<BVHTree> bvh;
 	std::unique_ptr<MBVHTree> mbvh;
+	std::unique_ptr<MBVH8Tree> mbvh8;
+
+	bool compressed = false;
+
+	// Returns whether a hit at barycentrics (u, v) is transparent. Only set for meshes with alpha tested materials,
+	// opaque meshes skip the test and are traversed without a filter.
+	bool (*alpha_test)(const void *user_data, const rfw::Triangle &triangle, float u, float v) = nullptr;
+	const void *alpha_user_data = nullptr;
 
 	const rfw::Triangle *triangles = nullptr;
 	const glm::vec4 *vertices = nullptr;
@@ -30,6 +41,7 @@ class TopLevelBVH
 	TopLevelBVH() = default;
 
 	void construct_bvh();
+	// Refits the existing trees in place, rebuilds if the instance count changed or the SAH cost grew too much
 	void refit();
 
 	rfwMesh &get_mesh(const int ID) { return *instance_meshes[ID]; }
@@ -43,6 +55,20 @@ class TopLevelBVH
 				   float dir_z[4], float t[4], int primID[4], int instID[4], float t_min) const;
 
 	bool is_occluded(const vec3 &origin, const vec3 &direction, float t_max, float t_min = 1e-5f) const;
+	// Any-hit tests of packets of shadow rays, return the mask of the active lanes that are occluded
+	int is_occluded4(const float origin_x[4], const float origin_y[4], const float origin_z[4], const float dir_x[4],
+					 const float dir_y[4], const float dir_z[4], const float t_max[4], float t_min = 1e-5f,
+					 int active_mask = 0xF) const;
+	int is_occluded8(const float origin_x[8], const float origin_y[8], const float origin_z[8], const float dir_x[8],
+					 const float dir_y[8], const float dir_z[8], const float t_max[8], float t_min = 1e-5f,
+					 int active_mask = 0xFF) const;
+
+	// Intersects a large batch of rays. Rays are sorted by direction octant and origin and traversed in coherent
+	// batches in parallel, intended for incoherent secondary rays.
+	void intersect_stream(const RayStreamSoA &rays, HitStreamSoA &hits) const;
+
+	// Metrics of the tree over instances that is used for traversal, EPO is not available for instance bounds
+	BVHStats get_stats() const;
 
 	void set_instance(size_t idx, glm::mat4 transform, rfwMesh *tree, AABB boundingBox);
 
@@ -54,16 +80,19 @@ class TopLevelBVH
 	const simd::matrix4 &get_instance_matrix(int instID) const;
 
 	bool count_changed = true;
+	// Rebuild when the SAH cost of the refitted tree exceeds the cost after the last build by this factor
+	float rebuild_threshold = 1.5f;
+	float build_cost = 0.0f;
+	float current_cost = 0.0f;
+
 	// Top level BVH structure data
-	std::atomic_int pool_ptr = 0;
-	std::atomic_int mpool_ptr = 0;
-	std::atomic_int thread_count = 0;
-	std::optional<rtbvh::RTBVH> bvh = std::nullopt;
-	std::optional<rtbvh::RTMBVH> mbvh = std::nullopt;
+	std::vector<BVHNode> bvh_nodes;
+	std::vector<MBVHNode> mbvh_nodes;
+	std::vector<MBVH8Node> mbvh8_nodes;
+	std::vector<unsigned int> prim_indices;
 
 	std::vector<AABB> aabbs;
 	std::vector<AABB> instance_aabbs;
-	std::vector<glm::vec4> centers;
 
 	// Instance data
 	std::vector<rfwMesh *> instance_meshes;
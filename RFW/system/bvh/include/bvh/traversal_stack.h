@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+
+namespace rfw
+{
+namespace bvh
+{
+/*
+ * Traversal stack for trees of arbitrary depth. Entries live in a fixed-size local array which covers typical trees,
+ * only when a traversal pushes more than N entries the contents move to a heap allocation that doubles in size.
+ * Pushing costs a single well-predicted branch over a raw array.
+ */
+template <typename T, int N> class traversal_stack
+{
+  public:
+	traversal_stack() = default;
+
+	traversal_stack(const traversal_stack &) = delete;
+	traversal_stack &operator=(const traversal_stack &) = delete;
+
+	inline void push(const T &value)
+	{
+		if (m_Size == m_Capacity)
+			grow();
+		m_Data[m_Size++] = value;
+	}
+
+	inline T pop() { return m_Data[--m_Size]; }
+
+	[[nodiscard]] inline bool empty() const { return m_Size == 0; }
+	[[nodiscard]] inline int size() const { return m_Size; }
+
+  private:
+	void grow()
+	{
+		const int capacity = m_Capacity * 2;
+		std::unique_ptr<T[]> data = std::make_unique<T[]>(capacity);
+		memcpy(data.get(), m_Data, m_Size * sizeof(T));
+		m_Overflow = std::move(data);
+		m_Data = m_Overflow.get();
+		m_Capacity = capacity;
+	}
+
+	T m_Local[N];
+	T *m_Data = m_Local;
+	int m_Size = 0;
+	int m_Capacity = N;
+	std::unique_ptr<T[]> m_Overflow;
+};
+} // namespace bvh
+} // namespace rfw
@@ -0,0 +1,192 @@
+#include <bvh/BVH.h>
+
+#include <atomic>
+#include <numeric>
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
+
+#if RFW_RTBVH
+#include <rtbvh.hpp>
+#endif
+
+namespace rfw::bvh::builder
+{
+
+#if RFW_RTBVH
+static std::vector<glm::vec4> get_centers(const AABB *aabbs, int primCount)
+{
+	std::vector<glm::vec4> centers(primCount);
+	tbb::parallel_for(0, primCount, [&](int i) { centers[i] = glm::vec4(aabbs[i].centroid(), 1.0f); });
+	return centers;
+}
+
+static void copy_and_free(rtbvh::RTBVH instance, std::vector<BVHNode> &nodes, std::vector<unsigned int> &primIndices)
+{
+	const auto *rtNodes = reinterpret_cast<const BVHNode *>(instance.nodes);
+	nodes.assign(rtNodes, rtNodes + instance.node_count);
+	primIndices.assign(instance.indices, instance.indices + instance.index_count);
+	rtbvh::free_bvh(instance);
+}
+#endif
+
+static AABB get_bounds(const AABB *aabbs, int primCount)
+{
+	return tbb::parallel_reduce(
+		tbb::blocked_range<int>(0, primCount), AABB::invalid(),
+		[&](const tbb::blocked_range<int> &r, AABB bounds) {
+			for (int i = r.begin(); i < r.end(); i++)
+				bounds.grow(aabbs[i]);
+			return bounds;
+		},
+		[](const AABB &a, const AABB &b) { return AABB::union_of(a, b); });
+}
+
+void binned_sah(const AABB *aabbs, int primCount, std::vector<BVHNode> &nodes, std::vector<unsigned int> &primIndices,
+				bool triangleLeaves)
+{
+#if RFW_RTBVH
+	const auto centers = get_centers(aabbs, primCount);
+	copy_and_free(rtbvh::create_bvh(reinterpret_cast<const rtbvh::RTAABB *>(aabbs), primCount,
+									reinterpret_cast<const float *>(centers.data()), sizeof(glm::vec4),
+									rtbvh::BVHType::BinnedSAH),
+				  nodes, primIndices);
+#else
+	static_assert(sizeof(BVHNode) == 32);
+
+	// A binary tree with N leaves has at most 2N - 1 nodes, node 1 is left unused
+	nodes.clear();
+	nodes.resize(std::max(primCount * 2, 2));
+	primIndices.resize(primCount);
+	std::iota(primIndices.begin(), primIndices.end(), 0u);
+
+	AABB root_bounds = get_bounds(aabbs, primCount);
+	root_bounds.offset_by(1e-5f);
+
+	BVHNode &root = nodes[0];
+	root.bounds = root_bounds;
+	root.set_left_first(0);
+	root.set_count(primCount);
+
+	std::atomic_int poolPtr = 2;
+	if (triangleLeaves)
+		root.subdivide_mt<16, BVH_MAX_DEPTH, BVH_LEAF_SIZE>(aabbs, nodes.data(), primIndices.data(), 0, poolPtr);
+	else
+		root.subdivide_mt<16>(aabbs, nodes.data(), primIndices.data(), 0, poolPtr);
+
+	nodes.resize(poolPtr.load());
+#endif
+}
+
+void locally_ordered_clustering(const AABB *aabbs, int primCount, std::vector<BVHNode> &nodes,
+								std::vector<unsigned int> &primIndices, bool triangleLeaves)
+{
+#if RFW_RTBVH
+	const auto centers = get_centers(aabbs, primCount);
+	copy_and_free(rtbvh::create_bvh(reinterpret_cast<const rtbvh::RTAABB *>(aabbs), primCount,
+									reinterpret_cast<const float *>(centers.data()), sizeof(glm::vec4),
+									rtbvh::BVHType::LocallyOrderedClustered),
+				  nodes, primIndices);
+#else
+	binned_sah(aabbs, primCount, nodes, primIndices, triangleLeaves);
+#endif
+}
+
+#if RFW_RTBVH
+void spatial_sah(const AABB *aabbs, const glm::vec4 *vertices, int primCount, std::vector<BVHNode> &nodes,
+				 std::vector<unsigned int> &primIndices)
+{
+	const auto centers = get_centers(aabbs, primCount);
+	copy_and_free(rtbvh::create_spatial_bvh(reinterpret_cast<const rtbvh::RTAABB *>(aabbs), primCount,
+											reinterpret_cast<const float *>(centers.data()), sizeof(glm::vec4),
+											reinterpret_cast<const float *>(vertices), sizeof(glm::vec4),
+											3 * sizeof(glm::vec4)),
+				  nodes, primIndices);
+}
+#endif
+
+void collapse_mbvh(const std::vector<BVHNode> &nodes, std::vector<MBVHNode> &mbvhNodes)
+{
+	const BVHNode &root = nodes[0];
+
+	mbvhNodes.clear();
+	if (root.is_leaf())
+	{
+		// Tree consists of a single leaf, store it as the only child of the root
+		mbvhNodes.resize(1);
+		mbvhNodes[0].set_bounds(0, root.bounds);
+		mbvhNodes[0].childs[0] = root.get_left_first();
+		mbvhNodes[0].counts[0] = root.get_count();
+		return;
+	}
+
+	// Every 4-wide node replaces at least 1 binary node
+	mbvhNodes.resize(nodes.size());
+
+	std::atomic_int poolPtr = 1;
+	mbvhNodes[0].merge_nodes(root, nodes, mbvhNodes.data(), poolPtr);
+	mbvhNodes.resize(poolPtr.load());
+}
+
+void collapse_mbvh8(const std::vector<BVHNode> &nodes, std::vector<MBVH8Node> &mbvhNodes)
+{
+	const BVHNode &root = nodes[0];
+
+	mbvhNodes.clear();
+	if (root.is_leaf())
+	{
+		mbvhNodes.resize(1);
+		mbvhNodes[0].set_bounds(0, root.bounds);
+		mbvhNodes[0].childs[0] = root.get_left_first();
+		mbvhNodes[0].counts[0] = root.get_count();
+		return;
+	}
+
+	// Every 8-wide node replaces at least 1 binary node
+	mbvhNodes.resize(nodes.size());
+
+	std::atomic_int poolPtr = 1;
+	mbvhNodes[0].merge_nodes(root, nodes, mbvhNodes.data(), poolPtr);
+	mbvhNodes.resize(poolPtr.load());
+}
+
+void refit(std::vector<BVHNode> &nodes, const std::vector<unsigned int> &primIndices, const AABB *aabbs)
+{
+	nodes[0].refit(nodes.data(), primIndices.data(), aabbs);
+}
+
+float sah_cost(const std::vector<BVHNode> &nodes)
+{
+	if (nodes.empty())
+		return 0.0f;
+
+	const BVHNode &root = nodes[0];
+	if (root.is_leaf())
+		return static_cast<float>(root.get_count());
+
+	const float root_area = root.bounds.area();
+	float cost = 0.0f;
+
+	std::vector<int> stack = {0};
+	while (!stack.empty())
+	{
+		const BVHNode &node = nodes[stack.back()];
+		stack.pop_back();
+
+		if (node.is_leaf())
+		{
+			if (node.get_count() > 0)
+				cost += node.bounds.area() * static_cast<float>(node.get_count());
+			continue;
+		}
+
+		cost += node.bounds.area();
+		stack.push_back(node.get_left_first());
+		stack.push_back(node.get_left_first() + 1);
+	}
+
+	return cost / root_area;
+}
+
+} // namespace rfw::bvh::builder
@@ -0,0 +1,344 @@
+#include <bvh/BVH.h>
+#include <bvh/bvh_cache.h>
+
+#include <rfw/utils/logger.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+#include <tbb/parallel_for.h>
+
+namespace rfw::bvh::cache
+{
+
+// Increment whenever the node layout or the output of the builders changes. Build parameters that are named
+// constants are part of build_parameters() instead and invalidate old files on their own.
+static constexpr uint32_t CACHE_VERSION = 3;
+static constexpr char CACHE_MAGIC[4] = {'R', 'F', 'W', 'B'};
+static constexpr size_t CACHE_ALIGNMENT = 64;
+
+#if RFW_RTBVH
+static constexpr uint32_t CACHE_BUILDER = 1;
+#else
+static constexpr uint32_t CACHE_BUILDER = 0;
+#endif
+
+struct CacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t hash;
+	uint32_t builder;
+	uint32_t node_size;
+	uint32_t mbvh_node_size;
+	int32_t face_count;
+	uint64_t node_count;
+	uint64_t mbvh_node_count;
+	uint64_t index_count;
+};
+
+struct CacheLayout
+{
+	size_t nodes_offset;
+	size_t mbvh_nodes_offset;
+	size_t indices_offset;
+	size_t size;
+};
+
+// Caching is opt-in, an empty directory disables it
+static std::string cache_directory;
+
+static size_t align(size_t offset) { return (offset + CACHE_ALIGNMENT - 1) & ~(CACHE_ALIGNMENT - 1); }
+
+static CacheLayout get_layout(const CacheHeader &header)
+{
+	CacheLayout layout = {};
+	layout.nodes_offset = align(sizeof(CacheHeader));
+	layout.mbvh_nodes_offset = align(layout.nodes_offset + header.node_count * sizeof(BVHNode));
+	layout.indices_offset = align(layout.mbvh_nodes_offset + header.mbvh_node_count * sizeof(MBVHNode));
+	layout.size = layout.indices_offset + header.index_count * sizeof(unsigned int);
+	return layout;
+}
+
+static std::string get_path(uint64_t hash)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bvh", static_cast<unsigned long long>(hash));
+	return (std::filesystem::path(cache_directory) / name).string();
+}
+
+// Unique for every writer, processes storing the same cache file at once never share a temporary file
+static std::string get_temp_path(const std::string &path)
+{
+	static std::atomic<unsigned long long> counter = 0;
+	std::random_device device;
+	char suffix[64];
+	snprintf(suffix, sizeof(suffix), ".%08x%08x.%llu.tmp", device(), device(), counter.fetch_add(1));
+	return path + suffix;
+}
+
+// Nodes and indices of a cache file are referenced without bounds checks during traversal. Only nodes reachable from
+// the root are checked, the builders leave node 1 of the binary tree unused. Interior children have to follow their
+// parent, which also rules out cycles.
+static bool validate(const CacheHeader &header, const std::vector<BVHNode> &nodes,
+					 const std::vector<MBVHNode> &mbvh_nodes, const std::vector<unsigned int> &indices)
+{
+	const auto node_count = static_cast<int64_t>(header.node_count);
+	const auto mbvh_node_count = static_cast<int64_t>(header.mbvh_node_count);
+	const auto index_count = static_cast<int64_t>(header.index_count);
+
+	std::vector<int64_t> stack;
+	if (node_count > 0)
+		stack.push_back(0);
+	while (!stack.empty())
+	{
+		const int64_t i = stack.back();
+		stack.pop_back();
+
+		const BVHNode &node = nodes[i];
+		const int64_t first = node.get_left_first();
+		if (node.is_leaf())
+		{
+			if (first < 0 || first + node.get_count() > index_count)
+				return false;
+			continue;
+		}
+
+		if (node.get_count() != -1 || first <= i || first + 1 >= node_count)
+			return false;
+		stack.push_back(first);
+		stack.push_back(first + 1);
+	}
+
+	if (mbvh_node_count > 0)
+		stack.push_back(0);
+	while (!stack.empty())
+	{
+		const int64_t i = stack.back();
+		stack.pop_back();
+
+		for (int j = 0; j < 4; j++)
+		{
+			const int64_t child = mbvh_nodes[i].childs[j];
+			const int64_t count = mbvh_nodes[i].counts[j];
+			if (child < 0)
+				continue;
+
+			if (count >= 0)
+			{
+				if (child + count > index_count)
+					return false;
+				continue;
+			}
+
+			if (count != -1 || child <= i || child >= mbvh_node_count)
+				return false;
+			stack.push_back(child);
+		}
+	}
+
+	return std::all_of(indices.begin(), indices.end(),
+					   [&](unsigned int idx) { return static_cast<int64_t>(idx) < header.face_count; });
+}
+
+template <typename T> static bool read_array(std::ifstream &file, size_t offset, size_t count, std::vector<T> &array)
+{
+	array.resize(count);
+	file.seekg(static_cast<std::streamoff>(offset));
+	file.read(reinterpret_cast<char *>(array.data()), static_cast<std::streamsize>(count * sizeof(T)));
+	return static_cast<bool>(file);
+}
+
+template <typename T> static void write_array(std::ofstream &file, size_t offset, const std::vector<T> &array)
+{
+	// Padding up to the aligned offset
+	static constexpr char zeros[CACHE_ALIGNMENT] = {};
+	file.write(zeros, static_cast<std::streamsize>(offset - static_cast<size_t>(file.tellp())));
+	file.write(reinterpret_cast<const char *>(array.data()), static_cast<std::streamsize>(array.size() * sizeof(T)));
+}
+
+// MurmurHash64A
+static uint64_t hash_bytes(const void *data, size_t size, uint64_t seed)
+{
+	constexpr uint64_t m = 0xc6a4a7935bd1e995ull;
+	constexpr int r = 47;
+
+	const auto *bytes = static_cast<const unsigned char *>(data);
+	uint64_t h = seed ^ (size * m);
+
+	const size_t words = size / sizeof(uint64_t);
+	for (size_t i = 0; i < words; i++)
+	{
+		uint64_t k;
+		memcpy(&k, bytes + i * sizeof(uint64_t), sizeof(uint64_t));
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
+	}
+
+	const size_t remainder = size % sizeof(uint64_t);
+	if (remainder > 0)
+	{
+		uint64_t k = 0;
+		memcpy(&k, bytes + words * sizeof(uint64_t), remainder);
+		h ^= k;
+		h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+// Hashes fixed-size chunks in parallel and combines their hashes, the result does not depend on the thread count
+static uint64_t hash_buffer(const void *data, size_t size, uint64_t seed)
+{
+	constexpr size_t chunk_size = 1u << 20u;
+	const auto *bytes = static_cast<const char *>(data);
+	const size_t chunk_count = (size + chunk_size - 1) / chunk_size;
+
+	std::vector<uint64_t> hashes(chunk_count);
+	tbb::parallel_for(size_t(0), chunk_count, [&](size_t i) {
+		const size_t offset = i * chunk_size;
+		hashes[i] = hash_bytes(bytes + offset, std::min(chunk_size, size - offset), seed + i);
+	});
+
+	return hash_bytes(hashes.data(), hashes.size() * sizeof(uint64_t), seed ^ size);
+}
+
+void set_directory(const std::string &path) { cache_directory = path; }
+
+const std::string &get_directory() { return cache_directory; }
+
+// Parameters the builder output depends on, files written with different values are never found
+static uint64_t build_parameters()
+{
+	const uint32_t parameters[] = {CACHE_VERSION, CACHE_BUILDER, static_cast<uint32_t>(BVH_MAX_DEPTH),
+								   static_cast<uint32_t>(BVH_LEAF_SIZE)};
+	return hash_bytes(parameters, sizeof(parameters), 0);
+}
+
+uint64_t hash_geometry(const glm::vec4 *vertices, int vertexCount, const glm::uvec3 *indices, int faceCount)
+{
+	uint64_t hash = hash_buffer(vertices, vertexCount * sizeof(glm::vec4), build_parameters());
+	if (indices)
+		hash = hash_buffer(indices, faceCount * sizeof(glm::uvec3), hash);
+	return hash;
+}
+
+bool load(uint64_t hash, BVHTree &bvh, MBVHTree &mbvh)
+{
+	if (cache_directory.empty())
+		return false;
+
+	std::ifstream file(get_path(hash), std::ios::in | std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	CacheHeader header;
+	if (!file.read(reinterpret_cast<char *>(&header), sizeof(CacheHeader)))
+		return false;
+
+	if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION ||
+		header.hash != hash || header.builder != CACHE_BUILDER || header.node_size != sizeof(BVHNode) ||
+		header.mbvh_node_size != sizeof(MBVHNode) || header.face_count != bvh.face_count || header.node_count == 0 ||
+		header.mbvh_node_count == 0)
+		return false;
+
+	file.seekg(0, std::ios::end);
+	const CacheLayout layout = get_layout(header);
+	if (static_cast<size_t>(file.tellg()) < layout.size)
+	{
+		WARNING("BVH cache file for %016llx is truncated", static_cast<unsigned long long>(hash));
+		return false;
+	}
+
+	std::vector<BVHNode> nodes;
+	std::vector<MBVHNode> mbvh_nodes;
+	std::vector<unsigned int> indices;
+	if (!read_array(file, layout.nodes_offset, header.node_count, nodes) ||
+		!read_array(file, layout.mbvh_nodes_offset, header.mbvh_node_count, mbvh_nodes) ||
+		!read_array(file, layout.indices_offset, header.index_count, indices) ||
+		!validate(header, nodes, mbvh_nodes, indices))
+	{
+		WARNING("BVH cache file for %016llx is corrupt, rebuilding", static_cast<unsigned long long>(hash));
+		return false;
+	}
+
+	bvh.nodes = std::move(nodes);
+	bvh.prim_indices = std::move(indices);
+	bvh.leaf_triangles.build(bvh);
+	mbvh.reset();
+	mbvh.nodes = std::move(mbvh_nodes);
+	return true;
+}
+
+void store(uint64_t hash, const BVHTree &bvh, const MBVHTree &mbvh)
+{
+	if (cache_directory.empty() || bvh.nodes.empty() || mbvh.nodes.empty())
+		return;
+
+	CacheHeader header = {};
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.hash = hash;
+	header.builder = CACHE_BUILDER;
+	header.node_size = sizeof(BVHNode);
+	header.mbvh_node_size = sizeof(MBVHNode);
+	header.face_count = bvh.face_count;
+	header.node_count = bvh.nodes.size();
+	header.mbvh_node_count = mbvh.nodes.size();
+	header.index_count = bvh.prim_indices.size();
+
+	std::error_code error;
+	std::filesystem::create_directories(cache_directory, error);
+	if (error)
+	{
+		WARNING("Could not create BVH cache directory %s: %s", cache_directory.c_str(), error.message().c_str());
+		return;
+	}
+
+	// Write to a temporary file first so readers never see a partially written file
+	const std::string path = get_path(hash);
+	const std::string tmp_path = get_temp_path(path);
+	{
+		std::ofstream file(tmp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			WARNING("Could not write BVH cache file %s", tmp_path.c_str());
+			return;
+		}
+
+		const CacheLayout layout = get_layout(header);
+		file.write(reinterpret_cast<const char *>(&header), sizeof(CacheHeader));
+		write_array(file, layout.nodes_offset, bvh.nodes);
+		write_array(file, layout.mbvh_nodes_offset, mbvh.nodes);
+		write_array(file, layout.indices_offset, bvh.prim_indices);
+		if (!file)
+		{
+			WARNING("Could not write BVH cache file %s", tmp_path.c_str());
+			file.close();
+			std::filesystem::remove(tmp_path, error);
+			return;
+		}
+	}
+
+	std::filesystem::rename(tmp_path, path, error);
+	if (error)
+	{
+		WARNING("Could not write BVH cache file %s: %s", path.c_str(), error.message().c_str());
+		std::filesystem::remove(tmp_path, error);
+	}
+}
+
+} // namespace rfw::bvh::cache
@@ -19,7 +19,7 @@ BVHNode::BVHNode(int leftFirst, int count, AABB bounds) : bounds(bounds)
 	set_count(-1);
 }
 
-AABB BVHNode::refit(BVHNode *bvhTree, uint *primIDs, AABB *aabbs)
+AABB BVHNode::refit(BVHNode *bvhTree, const uint *primIDs, const AABB *aabbs)
 {
 	if (is_leaf() && get_count() <= 0)
 		return AABB::invalid();
@@ -0,0 +1,386 @@
+#include <bvh/BVH.h>
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <mutex>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_reduce.h>
+
+namespace rfw::bvh::stats
+{
+
+namespace
+{
+// Tree of any width flattened in breadth-first order, children of a node are stored consecutively after it
+struct StatsNode
+{
+	AABB bounds;
+	int first = 0;
+	int count = -1; // -1 for interior nodes
+	int child_first = 0;
+	int child_count = 0;
+	int depth = 0;
+
+	// Range of the primitive index list covered by the sub-tree
+	int range_begin = 0;
+	int range_end = 0;
+};
+
+/*
+ * Counters are written by their own thread only, using relaxed loads and stores instead of read-modify-write
+ * operations. Threads register their counters on first use, counters of exited threads are kept in retired.
+ */
+struct ThreadCounters;
+struct Registry
+{
+	std::mutex mutex;
+	std::vector<ThreadCounters *> threads;
+	TraversalCounters retired;
+};
+
+Registry &registry()
+{
+	static Registry instance;
+	return instance;
+}
+
+struct ThreadCounters
+{
+	ThreadCounters()
+	{
+		Registry &reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		reg.threads.push_back(this);
+	}
+
+	~ThreadCounters()
+	{
+		Registry &reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		reg.retired.node_visits += node_visits.load(std::memory_order_relaxed);
+		reg.retired.prim_tests += prim_tests.load(std::memory_order_relaxed);
+		reg.threads.erase(std::find(reg.threads.begin(), reg.threads.end(), this));
+	}
+
+	std::atomic<uint64_t> node_visits{0};
+	std::atomic<uint64_t> prim_tests{0};
+};
+
+thread_local ThreadCounters thread_counters;
+
+float clipped_area(const glm::vec3 triangle[3], const AABB &box)
+{
+	// A triangle clipped by 6 planes has at most 9 vertices
+	glm::vec3 polygon[16], clipped[16];
+	int count = 3;
+	for (int i = 0; i < 3; i++)
+		polygon[i] = triangle[i];
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (int side = 0; side < 2; side++)
+		{
+			const auto distance = [&](const glm::vec3 &p) {
+				return side == 0 ? p[axis] - box.bmin[axis] : box.bmax[axis] - p[axis];
+			};
+
+			int clipped_count = 0;
+			for (int i = 0; i < count; i++)
+			{
+				const glm::vec3 &a = polygon[i];
+				const glm::vec3 &b = polygon[(i + 1) % count];
+				const float da = distance(a);
+				const float db = distance(b);
+
+				if (da >= 0.0f)
+					clipped[clipped_count++] = a;
+				if ((da >= 0.0f) != (db >= 0.0f))
+					clipped[clipped_count++] = a + (b - a) * (da / (da - db));
+			}
+
+			if (clipped_count < 3)
+				return 0.0f;
+
+			count = clipped_count;
+			for (int i = 0; i < count; i++)
+				polygon[i] = clipped[i];
+		}
+	}
+
+	glm::vec3 normal = glm::vec3(0.0f);
+	for (int i = 1; i < count - 1; i++)
+		normal += glm::cross(polygon[i] - polygon[0], polygon[i + 1] - polygon[0]);
+	return 0.5f * glm::length(normal);
+}
+
+bool overlaps(const AABB &a, const AABB &b)
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (a.bmin[axis] > b.bmax[axis] || b.bmin[axis] > a.bmax[axis])
+			return false;
+	}
+	return true;
+}
+
+float compute_epo(const std::vector<StatsNode> &nodes, const BVHTree &bvh)
+{
+	const auto &primIndices = bvh.prim_indices;
+	const int primCount = bvh.face_count;
+
+	// Positions of every primitive in the index list, spatial splits may reference a primitive more than once
+	std::vector<int> offsets(primCount + 1, 0);
+	std::vector<int> positions(primIndices.size());
+	for (const unsigned int primID : primIndices)
+		offsets[primID + 1]++;
+	for (int i = 0; i < primCount; i++)
+		offsets[i + 1] += offsets[i];
+	std::vector<int> cursor(offsets.begin(), offsets.end() - 1);
+	for (int i = 0, s = static_cast<int>(primIndices.size()); i < s; i++)
+		positions[cursor[primIndices[i]]++] = i;
+
+	using Sums = std::pair<double, double>; // overlapping area, total area
+	const Sums sums = tbb::parallel_reduce(
+		tbb::blocked_range<int>(0, primCount), Sums(0.0, 0.0),
+		[&](const tbb::blocked_range<int> &r, Sums sum) {
+			std::vector<int> stack;
+			for (int primID = r.begin(); primID < r.end(); primID++)
+			{
+				glm::vec3 triangle[3];
+				bvh.get_triangle(primID, &triangle[0], &triangle[1], &triangle[2]);
+				sum.second += 0.5 * glm::length(glm::cross(triangle[1] - triangle[0], triangle[2] - triangle[0]));
+
+				const AABB &bounds = bvh.aabbs[primID];
+				const auto contains = [&](const StatsNode &node) {
+					for (int i = offsets[primID]; i < offsets[primID + 1]; i++)
+					{
+						if (positions[i] >= node.range_begin && positions[i] < node.range_end)
+							return true;
+					}
+					return false;
+				};
+
+				// Nodes that do not contain the triangle have no descendants that do, but still need to be visited
+				stack.assign(1, 0);
+				while (!stack.empty())
+				{
+					const StatsNode &node = nodes[stack.back()];
+					stack.pop_back();
+
+					if (!overlaps(node.bounds, bounds))
+						continue;
+
+					if (!contains(node))
+					{
+						const float cost = node.count >= 0 ? static_cast<float>(node.count) : 1.0f;
+						sum.first += cost * clipped_area(triangle, node.bounds);
+					}
+
+					for (int i = 0; i < node.child_count; i++)
+						stack.push_back(node.child_first + i);
+				}
+			}
+			return sum;
+		},
+		[](const Sums &a, const Sums &b) { return Sums(a.first + b.first, a.second + b.second); });
+
+	return sums.second > 0.0 ? static_cast<float>(sums.first / sums.second) : 0.0f;
+}
+
+BVHStats compute(std::vector<StatsNode> &nodes, const BVHTree *triangles)
+{
+	BVHStats stats;
+	if (nodes.empty())
+		return stats;
+
+	stats.node_count = static_cast<int>(nodes.size());
+
+	// Children are stored after their parent, walk backwards to gather sub-tree ranges bottom-up
+	double cost = 0.0;
+	int max_leaf_size = 0;
+	for (int i = stats.node_count - 1; i >= 0; i--)
+	{
+		StatsNode &node = nodes[i];
+		stats.max_depth = glm::max(stats.max_depth, node.depth);
+
+		if (node.count >= 0)
+		{
+			node.range_begin = node.first;
+			node.range_end = node.first + node.count;
+			cost += node.bounds.area() * static_cast<double>(node.count);
+			max_leaf_size = glm::max(max_leaf_size, node.count);
+			stats.leaf_count++;
+			continue;
+		}
+
+		node.range_begin = std::numeric_limits<int>::max();
+		node.range_end = 0;
+		for (int c = 0; c < node.child_count; c++)
+		{
+			node.range_begin = glm::min(node.range_begin, nodes[node.child_first + c].range_begin);
+			node.range_end = glm::max(node.range_end, nodes[node.child_first + c].range_end);
+		}
+		cost += node.bounds.area();
+	}
+
+	const float root_area = nodes[0].bounds.area();
+	stats.sah_cost = root_area > 0.0f ? static_cast<float>(cost / root_area) : 0.0f;
+
+	stats.depth_histogram.resize(stats.max_depth + 1, 0);
+	stats.leaf_size_histogram.resize(max_leaf_size + 1, 0);
+	for (const StatsNode &node : nodes)
+	{
+		if (node.count < 0)
+			continue;
+		stats.depth_histogram[node.depth]++;
+		stats.leaf_size_histogram[node.count]++;
+	}
+
+	if (triangles)
+		stats.epo = compute_epo(nodes, *triangles);
+
+	return stats;
+}
+
+// Wide nodes store the bounds of their children, the root bounds are the union of the children of node 0
+template <int WIDTH, typename NODE> std::vector<StatsNode> flatten_wide(const std::vector<NODE> &nodes)
+{
+	std::vector<StatsNode> result;
+	if (nodes.empty())
+		return result;
+
+	std::vector<int> source = {0}; // Wide node of every interior node, -1 for leaves
+	result.emplace_back();
+	result[0].bounds = AABB::invalid();
+
+	for (size_t i = 0; i < result.size(); i++)
+	{
+		if (source[i] < 0)
+			continue;
+
+		const NODE &node = nodes[source[i]];
+		const int child_first = static_cast<int>(result.size());
+		int child_count = 0;
+
+		for (int c = 0; c < WIDTH; c++)
+		{
+			if (node.childs[c] < 0)
+				continue;
+
+			StatsNode child;
+			child.bounds = AABB(glm::vec3(node.bminx[c], node.bminy[c], node.bminz[c]),
+								glm::vec3(node.bmaxx[c], node.bmaxy[c], node.bmaxz[c]));
+			child.depth = result[i].depth + 1;
+			if (node.counts[c] > -1)
+			{
+				child.first = node.childs[c];
+				child.count = node.counts[c];
+				source.push_back(-1);
+			}
+			else
+			{
+				source.push_back(node.childs[c]);
+			}
+
+			if (i == 0)
+				result[0].bounds.grow(child.bounds);
+
+			result.push_back(child);
+			child_count++;
+		}
+
+		result[i].child_first = child_first;
+		result[i].child_count = child_count;
+	}
+
+	return result;
+}
+} // namespace
+
+BVHStats compute(const std::vector<BVHNode> &nodes, const BVHTree *triangles)
+{
+	std::vector<StatsNode> flattened;
+	if (!nodes.empty())
+	{
+		std::vector<int> source = {0};
+		flattened.emplace_back();
+		flattened[0].bounds = nodes[0].bounds;
+
+		for (size_t i = 0; i < flattened.size(); i++)
+		{
+			const BVHNode &node = nodes[source[i]];
+			if (node.is_leaf())
+			{
+				flattened[i].first = node.get_left_first();
+				flattened[i].count = node.get_count();
+				continue;
+			}
+
+			const int depth = flattened[i].depth + 1;
+			flattened[i].child_first = static_cast<int>(flattened.size());
+			flattened[i].child_count = 2;
+			for (int c = 0; c < 2; c++)
+			{
+				StatsNode child;
+				child.bounds = nodes[node.get_left_first() + c].bounds;
+				child.depth = depth;
+				flattened.push_back(child);
+				source.push_back(node.get_left_first() + c);
+			}
+		}
+	}
+
+	return compute(flattened, triangles);
+}
+
+BVHStats compute(const std::vector<MBVHNode> &nodes, const BVHTree *triangles)
+{
+	auto flattened = flatten_wide<4>(nodes);
+	return compute(flattened, triangles);
+}
+
+BVHStats compute(const std::vector<MBVH8Node> &nodes, const BVHTree *triangles)
+{
+	auto flattened = flatten_wide<8>(nodes);
+	return compute(flattened, triangles);
+}
+
+void add(const TraversalCounters &counters)
+{
+	ThreadCounters &local = thread_counters;
+	local.node_visits.store(local.node_visits.load(std::memory_order_relaxed) + counters.node_visits,
+							std::memory_order_relaxed);
+	local.prim_tests.store(local.prim_tests.load(std::memory_order_relaxed) + counters.prim_tests,
+						   std::memory_order_relaxed);
+}
+
+TraversalCounters collect()
+{
+	Registry &reg = registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+
+	TraversalCounters result = reg.retired;
+	for (const ThreadCounters *counters : reg.threads)
+	{
+		result.node_visits += counters->node_visits.load(std::memory_order_relaxed);
+		result.prim_tests += counters->prim_tests.load(std::memory_order_relaxed);
+	}
+	return result;
+}
+
+void reset()
+{
+	Registry &reg = registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+
+	reg.retired = {};
+	for (ThreadCounters *counters : reg.threads)
+	{
+		counters->node_visits.store(0, std::memory_order_relaxed);
+		counters->prim_tests.store(0, std::memory_order_relaxed);
+	}
+}
+
+} // namespace rfw::bvh::stats
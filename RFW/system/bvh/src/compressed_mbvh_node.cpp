@@ -0,0 +1,217 @@
+#include <bvh/BVH.h>
+
+#include <cmath>
+#include <cstring>
+
+using namespace glm;
+
+namespace rfw::bvh
+{
+
+// Decoding must match CompressedMBVHNode::compress exactly to keep the bounds conservative, thus no FMA is used
+static inline __m128 dequantize(const uint8_t q[4], float origin, float scale)
+{
+	int packed;
+	memcpy(&packed, q, sizeof(int));
+	const __m128 qf = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)));
+	return _mm_add_ps(_mm_set1_ps(origin), _mm_mul_ps(qf, _mm_set1_ps(scale)));
+}
+
+static inline float dequantize(int q, float origin, float scale) { return origin + static_cast<float>(q) * scale; }
+
+void CompressedMBVHNode::compress(const MBVHNode &node)
+{
+	childs = node.childs;
+	counts = node.counts;
+
+	const float *mins[3] = {node.bminx, node.bminy, node.bminz};
+	const float *maxs[3] = {node.bmaxx, node.bmaxy, node.bmaxz};
+	uint8_t *qmins[3] = {qminx, qminy, qminz};
+	uint8_t *qmaxs[3] = {qmaxx, qmaxy, qmaxz};
+
+	bool valid[4];
+	AABB bounds = AABB::invalid();
+	for (int i = 0; i < 4; i++)
+	{
+		valid[i] = node.bminx[i] <= node.bmaxx[i] && node.bminy[i] <= node.bmaxy[i] && node.bminz[i] <= node.bmaxz[i];
+		if (!valid[i])
+			continue;
+
+		bounds.grow(vec3(node.bminx[i], node.bminy[i], node.bminz[i]));
+		bounds.grow(vec3(node.bmaxx[i], node.bmaxy[i], node.bmaxz[i]));
+	}
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float bmin = bounds.bmin[axis] <= bounds.bmax[axis] ? bounds.bmin[axis] : 0.0f;
+		const float bmax = bounds.bmin[axis] <= bounds.bmax[axis] ? bounds.bmax[axis] : 0.0f;
+
+		// Smallest power of 2 that covers the extent of the node in 255 steps
+		int exponent = 0;
+		std::frexp((bmax - bmin) / 255.0f, &exponent);
+		float s = std::ldexp(1.0f, exponent);
+		while (dequantize(255, bmin, s) < bmax)
+			s *= 2.0f;
+
+		origin[axis] = bmin;
+		scale[axis] = s;
+
+		for (int i = 0; i < 4; i++)
+		{
+			if (!valid[i]) // Invalid children are referenced by empty leaves, their bounds do not matter
+			{
+				qmins[axis][i] = 0;
+				qmaxs[axis][i] = 0;
+				continue;
+			}
+
+			// Round outwards
+			int lo = glm::clamp(static_cast<int>(std::floor((mins[axis][i] - bmin) / s)), 0, 255);
+			while (lo > 0 && dequantize(lo, bmin, s) > mins[axis][i])
+				lo--;
+			int hi = glm::clamp(static_cast<int>(std::ceil((maxs[axis][i] - bmin) / s)), 0, 255);
+			while (hi < 255 && dequantize(hi, bmin, s) < maxs[axis][i])
+				hi++;
+
+			qmins[axis][i] = static_cast<uint8_t>(lo);
+			qmaxs[axis][i] = static_cast<uint8_t>(hi);
+		}
+	}
+}
+
+MBVHHit CompressedMBVHNode::intersect(const glm::vec3 &org, const glm::vec3 &dirInverse, float rayt) const
+{
+	MBVHHit hit;
+
+	static const __m128i mask = _mm_set1_epi32(0xFFFFFFFCu);
+	static const __m128i or_mask = _mm_set_epi32(0b11, 0b10, 0b01, 0b00);
+
+	union
+	{
+		__m256 t1_2;
+		__m128 t[2];
+	};
+
+	__m256 org_component = _mm256_set1_ps(org.x);
+	__m256 dir_component = _mm256_set1_ps(dirInverse.x);
+	__m256 side = _mm256_set_m128(dequantize(qmaxx, origin[0], scale[0]), dequantize(qminx, origin[0], scale[0]));
+
+	t1_2 = _mm256_mul_ps(_mm256_sub_ps(side, org_component), dir_component);
+	hit.tmin4 = _mm_min_ps(t[0], t[1]);
+	__m128 t_max = _mm_max_ps(t[0], t[1]);
+
+	org_component = _mm256_set1_ps(org.y);
+	dir_component = _mm256_set1_ps(dirInverse.y);
+	side = _mm256_set_m128(dequantize(qmaxy, origin[1], scale[1]), dequantize(qminy, origin[1], scale[1]));
+
+	t1_2 = _mm256_mul_ps(_mm256_sub_ps(side, org_component), dir_component);
+	hit.tmin4 = _mm_max_ps(hit.tmin4, _mm_min_ps(t[0], t[1]));
+	t_max = _mm_min_ps(t_max, _mm_max_ps(t[0], t[1]));
+
+	org_component = _mm256_set1_ps(org.z);
+	dir_component = _mm256_set1_ps(dirInverse.z);
+	side = _mm256_set_m128(dequantize(qmaxz, origin[2], scale[2]), dequantize(qminz, origin[2], scale[2]));
+
+	t1_2 = _mm256_mul_ps(_mm256_sub_ps(side, org_component), dir_component);
+	hit.tmin4 = _mm_max_ps(hit.tmin4, _mm_min_ps(t[0], t[1]));
+	t_max = _mm_min_ps(t_max, _mm_max_ps(t[0], t[1]));
+
+	// return (*tmax) > (*tmin) && (*tmin) < t;
+	const __m128 greaterThanMin = _mm_cmpge_ps(t_max, hit.tmin4);
+	const __m128 lessThanT = _mm_cmplt_ps(hit.tmin4, _mm_set1_ps(rayt));
+	const __m128 result = _mm_and_ps(greaterThanMin, lessThanT);
+	const int resultMask = _mm_movemask_ps(result);
+
+	hit.tmini4 = _mm_and_si128(hit.tmini4, mask);
+	hit.tmini4 = _mm_or_si128(hit.tmini4, or_mask);
+	hit.result = bvec4(resultMask & 1, resultMask & 2, resultMask & 4, resultMask & 8);
+
+	if (hit.tmin[0] > hit.tmin[1])
+		std::swap(hit.tmin[0], hit.tmin[1]);
+	if (hit.tmin[2] > hit.tmin[3])
+		std::swap(hit.tmin[2], hit.tmin[3]);
+	if (hit.tmin[0] > hit.tmin[2])
+		std::swap(hit.tmin[0], hit.tmin[2]);
+	if (hit.tmin[1] > hit.tmin[3])
+		std::swap(hit.tmin[1], hit.tmin[3]);
+	if (hit.tmin[2] > hit.tmin[3])
+		std::swap(hit.tmin[2], hit.tmin[3]);
+
+	return hit;
+}
+
+MBVHHit CompressedMBVHNode::intersect4(const float origin_x[4], const float origin_y[4], const float origin_z[4],
+									   const float inv_direction_x[4], const float inv_direction_y[4],
+									   const float inv_direction_z[4], const float rayt[4]) const
+{
+	static const __m128i mask = _mm_set1_epi32(0xFFFFFFFCu);
+	static const __m128i or_mask = _mm_set_epi32(0b11, 0b10, 0b01, 0b00);
+	__m128 result = _mm_setzero_ps();
+
+	// Decode once for all rays in the packet
+	const __m256 x_side =
+		_mm256_set_m128(dequantize(qmaxx, origin[0], scale[0]), dequantize(qminx, origin[0], scale[0]));
+	const __m256 y_side =
+		_mm256_set_m128(dequantize(qmaxy, origin[1], scale[1]), dequantize(qminy, origin[1], scale[1]));
+	const __m256 z_side =
+		_mm256_set_m128(dequantize(qmaxz, origin[2], scale[2]), dequantize(qminz, origin[2], scale[2]));
+
+	MBVHHit hit = {};
+
+	for (int i = 0; i < 4; i++)
+	{
+		__m256 org_component = _mm256_set1_ps(origin_x[i]);
+		__m256 dir_component = _mm256_set1_ps(inv_direction_x[i]);
+
+		union
+		{
+			__m256 t1_2;
+			__m128 t[2];
+		};
+
+		t1_2 = _mm256_mul_ps(_mm256_sub_ps(x_side, org_component), dir_component);
+		__m128 tmin4 = _mm_min_ps(t[0], t[1]);
+		__m128 tmax4 = _mm_max_ps(t[0], t[1]);
+
+		org_component = _mm256_set1_ps(origin_y[i]);
+		dir_component = _mm256_set1_ps(inv_direction_y[i]);
+
+		t1_2 = _mm256_mul_ps(_mm256_sub_ps(y_side, org_component), dir_component);
+		tmin4 = _mm_max_ps(tmin4, _mm_min_ps(t[0], t[1]));
+		tmax4 = _mm_min_ps(tmax4, _mm_max_ps(t[0], t[1]));
+
+		org_component = _mm256_set1_ps(origin_z[i]);
+		dir_component = _mm256_set1_ps(inv_direction_z[i]);
+
+		t1_2 = _mm256_mul_ps(_mm256_sub_ps(z_side, org_component), dir_component);
+		tmin4 = _mm_max_ps(tmin4, _mm_min_ps(t[0], t[1]));
+		tmax4 = _mm_min_ps(tmax4, _mm_max_ps(t[0], t[1]));
+
+		const __m128 greaterThanMin = _mm_cmpge_ps(tmax4, tmin4);
+		const __m128 lessThanT = _mm_cmplt_ps(tmin4, _mm_set1_ps(rayt[i]));
+		result = _mm_or_ps(result, _mm_and_ps(greaterThanMin, lessThanT));
+
+		hit.tmin4 = _mm_min_ps(hit.tmin4, tmin4);
+	}
+
+	const int resultMask = _mm_movemask_ps(result);
+
+	hit.tmini4 = _mm_and_si128(hit.tmini4, mask);
+	hit.tmini4 = _mm_or_si128(hit.tmini4, or_mask);
+	hit.result = bvec4(resultMask & 1, resultMask & 2, resultMask & 4, resultMask & 8);
+
+	if (hit.tmin[0] > hit.tmin[1])
+		std::swap(hit.tmin[0], hit.tmin[1]);
+	if (hit.tmin[2] > hit.tmin[3])
+		std::swap(hit.tmin[2], hit.tmin[3]);
+	if (hit.tmin[0] > hit.tmin[2])
+		std::swap(hit.tmin[0], hit.tmin[2]);
+	if (hit.tmin[1] > hit.tmin[3])
+		std::swap(hit.tmin[1], hit.tmin[3]);
+	if (hit.tmin[2] > hit.tmin[3])
+		std::swap(hit.tmin[2], hit.tmin[3]);
+
+	return hit;
+}
+
+} // namespace rfw::bvh
@@ -0,0 +1,330 @@
+#include <bvh/BVH.h>
+
+#include <tbb/parallel_for.h>
+
+namespace rfw::bvh
+{
+
+// Number of floats every array is padded with, the kernel always loads 8 triangles
+static constexpr int LEAF_PADDING = 8;
+
+struct Ray8
+{
+	__m256 org_x, org_y, org_z;
+	__m256 dir_x, dir_y, dir_z;
+};
+
+static inline Ray8 broadcast_ray(float ox, float oy, float oz, float dx, float dy, float dz)
+{
+	return {_mm256_set1_ps(ox), _mm256_set1_ps(oy), _mm256_set1_ps(oz),
+			_mm256_set1_ps(dx), _mm256_set1_ps(dy), _mm256_set1_ps(dz)};
+}
+
+// Moller-Trumbore against 8 consecutive triangles, returns the mask of lanes with a hit in (t_min, t_max)
+static inline int intersect8(const LeafTriangles &tris, int base, int remaining, const Ray8 &ray, float t_min,
+							 float t_max, __m256 *t, __m256 *u, __m256 *v)
+{
+	const __m256 e1x = _mm256_loadu_ps(tris.edge1_x.data() + base);
+	const __m256 e1y = _mm256_loadu_ps(tris.edge1_y.data() + base);
+	const __m256 e1z = _mm256_loadu_ps(tris.edge1_z.data() + base);
+	const __m256 e2x = _mm256_loadu_ps(tris.edge2_x.data() + base);
+	const __m256 e2y = _mm256_loadu_ps(tris.edge2_y.data() + base);
+	const __m256 e2z = _mm256_loadu_ps(tris.edge2_z.data() + base);
+
+	// const vec3 h = cross(dir, e2);
+	const __m256 hx = _mm256_sub_ps(_mm256_mul_ps(ray.dir_y, e2z), _mm256_mul_ps(ray.dir_z, e2y));
+	const __m256 hy = _mm256_sub_ps(_mm256_mul_ps(ray.dir_z, e2x), _mm256_mul_ps(ray.dir_x, e2z));
+	const __m256 hz = _mm256_sub_ps(_mm256_mul_ps(ray.dir_x, e2y), _mm256_mul_ps(ray.dir_y, e2x));
+
+	// const float a = dot(e1, h);
+	const __m256 a =
+		_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, hx), _mm256_mul_ps(e1y, hy)), _mm256_mul_ps(e1z, hz));
+	// Lanes past the end of the leaf are masked out as well
+	const __m256 lanes = _mm256_castsi256_ps(
+		_mm256_cmpgt_epi32(_mm256_set1_epi32(remaining), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+	const __m256 abs_a = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+	__m256 mask = _mm256_and_ps(lanes, _mm256_cmp_ps(abs_a, _mm256_set1_ps(1e-6f), _CMP_GE_OQ));
+	if (_mm256_movemask_ps(mask) == 0)
+		return 0;
+
+	const __m256 f = _mm256_div_ps(_mm256_set1_ps(1.0f), a);
+
+	// const vec3 s = org - p0;
+	const __m256 sx = _mm256_sub_ps(ray.org_x, _mm256_loadu_ps(tris.p0_x.data() + base));
+	const __m256 sy = _mm256_sub_ps(ray.org_y, _mm256_loadu_ps(tris.p0_y.data() + base));
+	const __m256 sz = _mm256_sub_ps(ray.org_z, _mm256_loadu_ps(tris.p0_z.data() + base));
+
+	// const float u = f * dot(s, h);
+	*u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, hx), _mm256_mul_ps(sy, hy)),
+										_mm256_mul_ps(sz, hz)));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(*u, _mm256_setzero_ps(), _CMP_GE_OQ));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(*u, _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+	if (_mm256_movemask_ps(mask) == 0)
+		return 0;
+
+	// const vec3 q = cross(s, e1);
+	const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+	const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+	const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+
+	// const float v = f * dot(dir, q);
+	*v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ray.dir_x, qx), _mm256_mul_ps(ray.dir_y, qy)),
+										_mm256_mul_ps(ray.dir_z, qz)));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(*v, _mm256_setzero_ps(), _CMP_GE_OQ));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(*u, *v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+	if (_mm256_movemask_ps(mask) == 0)
+		return 0;
+
+	// const float t = f * dot(e2, q);
+	*t = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)),
+										_mm256_mul_ps(e2z, qz)));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(*t, _mm256_set1_ps(t_min), _CMP_GT_OQ));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(*t, _mm256_set1_ps(t_max), _CMP_LT_OQ));
+	return _mm256_movemask_ps(mask);
+}
+
+// Returns the lane with the smallest t of all lanes in mask
+static inline int closest_lane(const __m256 &t, int mask)
+{
+	alignas(32) float t8[8];
+	_mm256_store_ps(t8, t);
+
+	int best = -1;
+	float best_t = 1e34f;
+	for (int lane = 0; lane < 8; lane++)
+	{
+		if ((mask & (1 << lane)) && t8[lane] < best_t)
+		{
+			best = lane;
+			best_t = t8[lane];
+		}
+	}
+	return best;
+}
+
+void LeafTriangles::build(const BVHTree &bvh)
+{
+	const int count = static_cast<int>(bvh.prim_indices.size());
+	const size_t size = count + LEAF_PADDING;
+
+	for (auto *array : {&p0_x, &p0_y, &p0_z, &edge1_x, &edge1_y, &edge1_z, &edge2_x, &edge2_y, &edge2_z})
+		array->assign(size, 0.0f);
+	prim_ids.assign(size, -1);
+
+	tbb::parallel_for(0, count, [&](int i) {
+		const int primID = static_cast<int>(bvh.prim_indices[i]);
+		glm::vec3 p0, p1, p2;
+		bvh.get_triangle(primID, &p0, &p1, &p2);
+		const glm::vec3 e1 = p1 - p0;
+		const glm::vec3 e2 = p2 - p0;
+
+		p0_x[i] = p0.x;
+		p0_y[i] = p0.y;
+		p0_z[i] = p0.z;
+		edge1_x[i] = e1.x;
+		edge1_y[i] = e1.y;
+		edge1_z[i] = e1.z;
+		edge2_x[i] = e2.x;
+		edge2_y[i] = e2.y;
+		edge2_z[i] = e2.z;
+		prim_ids[i] = primID;
+	});
+}
+
+void LeafTriangles::clear()
+{
+	for (auto *array : {&p0_x, &p0_y, &p0_z, &edge1_x, &edge1_y, &edge1_z, &edge2_x, &edge2_y, &edge2_z})
+		array->clear();
+	prim_ids.clear();
+}
+
+int LeafTriangles::intersect(const glm::vec3 &org, const glm::vec3 &dir, float t_min, float *rayt, int first,
+							 int count, glm::vec2 *bary) const
+{
+	const Ray8 ray = broadcast_ray(org.x, org.y, org.z, dir.x, dir.y, dir.z);
+
+	int hit = -1;
+	for (int base = first, end = first + count; base < end; base += 8)
+	{
+		__m256 t, u, v;
+		const int mask = intersect8(*this, base, end - base, ray, t_min, *rayt, &t, &u, &v);
+		if (mask == 0)
+			continue;
+
+		const int lane = closest_lane(t, mask);
+		alignas(32) float t8[8], u8[8], v8[8];
+		_mm256_store_ps(t8, t);
+		*rayt = t8[lane];
+		hit = prim_ids[base + lane];
+
+		if (bary)
+		{
+			_mm256_store_ps(u8, u);
+			_mm256_store_ps(v8, v);
+			*bary = glm::vec2(1.0f - u8[lane] - v8[lane], u8[lane]);
+		}
+	}
+
+	return hit;
+}
+
+int LeafTriangles::intersect4(const float origin_x[4], const float origin_y[4], const float origin_z[4],
+							  const float dir_x[4], const float dir_y[4], const float dir_z[4], float t_min, float t[4],
+							  int primID[4], int first, int count, __m128 *store_mask) const
+{
+	const __m128 org_x = _mm_loadu_ps(origin_x);
+	const __m128 org_y = _mm_loadu_ps(origin_y);
+	const __m128 org_z = _mm_loadu_ps(origin_z);
+	const __m128 d_x = _mm_loadu_ps(dir_x);
+	const __m128 d_y = _mm_loadu_ps(dir_y);
+	const __m128 d_z = _mm_loadu_ps(dir_z);
+	const __m128 tmin4 = _mm_set1_ps(t_min);
+	const __m128 zero4 = _mm_setzero_ps();
+	const __m128 one4 = _mm_set1_ps(1.0f);
+
+	__m128 t4 = _mm_loadu_ps(t);
+	__m128i prim4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(primID));
+	__m128 hit4 = _mm_setzero_ps();
+
+	// Every triangle of the leaf is tested against all 4 rays at once
+	for (int i = first, end = first + count; i < end; i++)
+	{
+		const __m128 e1x = _mm_set1_ps(edge1_x[i]);
+		const __m128 e1y = _mm_set1_ps(edge1_y[i]);
+		const __m128 e1z = _mm_set1_ps(edge1_z[i]);
+		const __m128 e2x = _mm_set1_ps(edge2_x[i]);
+		const __m128 e2y = _mm_set1_ps(edge2_y[i]);
+		const __m128 e2z = _mm_set1_ps(edge2_z[i]);
+
+		// const vec3 h = cross(dir, e2);
+		const __m128 hx = _mm_sub_ps(_mm_mul_ps(d_y, e2z), _mm_mul_ps(d_z, e2y));
+		const __m128 hy = _mm_sub_ps(_mm_mul_ps(d_z, e2x), _mm_mul_ps(d_x, e2z));
+		const __m128 hz = _mm_sub_ps(_mm_mul_ps(d_x, e2y), _mm_mul_ps(d_y, e2x));
+
+		// const float a = dot(e1, h);
+		const __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx), _mm_mul_ps(e1y, hy)), _mm_mul_ps(e1z, hz));
+		__m128 mask = _mm_cmpge_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), a), _mm_set1_ps(1e-6f));
+		if (_mm_movemask_ps(mask) == 0)
+			continue;
+
+		const __m128 f = _mm_div_ps(one4, a);
+
+		// const vec3 s = org - p0;
+		const __m128 sx = _mm_sub_ps(org_x, _mm_set1_ps(p0_x[i]));
+		const __m128 sy = _mm_sub_ps(org_y, _mm_set1_ps(p0_y[i]));
+		const __m128 sz = _mm_sub_ps(org_z, _mm_set1_ps(p0_z[i]));
+
+		// const float u = f * dot(s, h);
+		const __m128 u =
+			_mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx), _mm_mul_ps(sy, hy)), _mm_mul_ps(sz, hz)));
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, zero4), _mm_cmple_ps(u, one4)));
+		if (_mm_movemask_ps(mask) == 0)
+			continue;
+
+		// const vec3 q = cross(s, e1);
+		const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+		const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+		const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+
+		// const float v = f * dot(dir, q);
+		const __m128 v =
+			_mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(d_x, qx), _mm_mul_ps(d_y, qy)), _mm_mul_ps(d_z, qz)));
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, zero4), _mm_cmple_ps(_mm_add_ps(u, v), one4)));
+		if (_mm_movemask_ps(mask) == 0)
+			continue;
+
+		// const float t = f * dot(e2, q);
+		const __m128 t_hit =
+			_mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(t_hit, tmin4), _mm_cmplt_ps(t_hit, t4)));
+		if (_mm_movemask_ps(mask) == 0)
+			continue;
+
+		t4 = _mm_blendv_ps(t4, t_hit, mask);
+		prim4 = _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(prim4), _mm_castsi128_ps(_mm_set1_epi32(prim_ids[i])),
+											   mask));
+		hit4 = _mm_or_ps(hit4, mask);
+	}
+
+	_mm_storeu_ps(t, t4);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(primID), prim4);
+	*store_mask = hit4;
+	return _mm_movemask_ps(hit4);
+}
+
+bool LeafTriangles::occluded(const glm::vec3 &org, const glm::vec3 &dir, float t_min, float t_max, int first,
+							 int count) const
+{
+	const Ray8 ray = broadcast_ray(org.x, org.y, org.z, dir.x, dir.y, dir.z);
+	for (int base = first, end = first + count; base < end; base += 8)
+	{
+		__m256 t, u, v;
+		if (intersect8(*this, base, end - base, ray, t_min, t_max, &t, &u, &v) != 0)
+			return true;
+	}
+
+	return false;
+}
+
+int LeafTriangles::intersect(const glm::vec3 &org, const glm::vec3 &dir, float t_min, float *rayt, int first,
+							 int count, const HitFilter &filter, glm::vec2 *bary) const
+{
+	const Ray8 ray = broadcast_ray(org.x, org.y, org.z, dir.x, dir.y, dir.z);
+
+	int hit = -1;
+	for (int base = first, end = first + count; base < end; base += 8)
+	{
+		__m256 t, u, v;
+		int mask = intersect8(*this, base, end - base, ray, t_min, *rayt, &t, &u, &v);
+		if (mask == 0)
+			continue;
+
+		alignas(32) float t8[8], u8[8], v8[8];
+		_mm256_store_ps(t8, t);
+		_mm256_store_ps(u8, u);
+		_mm256_store_ps(v8, v);
+
+		// Candidates are filtered front to back, the first accepted one is the closest hit of this chunk
+		while (mask != 0)
+		{
+			const int lane = closest_lane(t, mask);
+			mask &= ~(1 << lane);
+			if (!filter(prim_ids[base + lane], u8[lane], v8[lane]))
+				continue;
+
+			*rayt = t8[lane];
+			hit = prim_ids[base + lane];
+			if (bary)
+				*bary = glm::vec2(1.0f - u8[lane] - v8[lane], u8[lane]);
+			break;
+		}
+	}
+
+	return hit;
+}
+
+bool LeafTriangles::occluded(const glm::vec3 &org, const glm::vec3 &dir, float t_min, float t_max, int first,
+							 int count, const HitFilter &filter) const
+{
+	const Ray8 ray = broadcast_ray(org.x, org.y, org.z, dir.x, dir.y, dir.z);
+	for (int base = first, end = first + count; base < end; base += 8)
+	{
+		__m256 t, u, v;
+		const int mask = intersect8(*this, base, end - base, ray, t_min, t_max, &t, &u, &v);
+		if (mask == 0)
+			continue;
+
+		alignas(32) float u8[8], v8[8];
+		_mm256_store_ps(u8, u);
+		_mm256_store_ps(v8, v);
+		for (int lane = 0; lane < 8; lane++)
+		{
+			if ((mask & (1 << lane)) && filter(prim_ids[base + lane], u8[lane], v8[lane]))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+} // namespace rfw::bvh
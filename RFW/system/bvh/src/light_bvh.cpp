@@ -0,0 +1,283 @@
+#include <bvh/BVH.h>
+
+#include <rfw/utils/logger.h>
+#include <rfw/utils/timer.h>
+
+namespace rfw
+{
+namespace bvh
+{
+
+void LightBVH::build(const AreaLight *areaLights, size_t areaCount, const PointLight *pointLights, size_t pointCount,
+					 const SpotLight *spotLights, size_t spotCount)
+{
+	const auto timer = utils::timer();
+
+	gather(areaLights, areaCount, pointLights, pointCount, spotLights, spotCount);
+	if (m_Lights.empty())
+	{
+		clear();
+		return;
+	}
+
+	// The topology is built over the positions of the lights, orientation and power only influence sampling
+	std::vector<AABB> aabbs(m_Lights.size());
+	for (size_t i = 0, s = m_Lights.size(); i < s; i++)
+		aabbs[i] = m_Lights[i].bounds;
+
+	std::vector<BVHNode> nodes;
+	builder::binned_sah(aabbs.data(), static_cast<int>(aabbs.size()), nodes, m_PrimIndices);
+
+	m_Nodes.resize(nodes.size());
+	for (size_t i = 0, s = nodes.size(); i < s; i++)
+	{
+		m_Nodes[i].left_first = nodes[i].get_left_first();
+		m_Nodes[i].count = nodes[i].get_count();
+	}
+
+	m_Parents.resize(m_Nodes.size());
+	m_LightLeaves.resize(m_Lights.size());
+	refit_node(0, -1);
+
+	DEBUG("Light BVH over %zu lights: %zu nodes, built in %f ms", m_Lights.size(), m_Nodes.size(), timer.elapsed());
+}
+
+void LightBVH::refit(const AreaLight *areaLights, size_t areaCount, const PointLight *pointLights, size_t pointCount,
+					 const SpotLight *spotLights, size_t spotCount)
+{
+	assert(areaCount + pointCount + spotCount == m_Lights.size());
+
+	gather(areaLights, areaCount, pointLights, pointCount, spotLights, spotCount);
+	if (!m_Nodes.empty())
+		refit_node(0, -1);
+}
+
+void LightBVH::clear()
+{
+	m_Nodes.clear();
+	m_PrimIndices.clear();
+	m_Lights.clear();
+	m_Parents.clear();
+	m_LightLeaves.clear();
+}
+
+int LightBVH::sample(const glm::vec3 &p, float r, float *pdf) const
+{
+	*pdf = 0.0f;
+	if (m_Nodes.empty())
+		return -1;
+
+	float probability = 1.0f;
+	const LightNode *node = &m_Nodes[0];
+	while (!node->is_leaf())
+	{
+		const int left = node->left_first;
+		const float w_left = importance(p, m_Nodes[left].bounds);
+		const float w_right = importance(p, m_Nodes[left + 1].bounds);
+		const float w_total = w_left + w_right;
+		if (w_total <= 0.0f)
+			return -1;
+
+		// The random number is rescaled to the chosen interval and reused on the next level
+		const float p_left = w_left / w_total;
+		if (r < p_left)
+		{
+			r = glm::min(r / p_left, 0.99999994f);
+			probability *= p_left;
+			node = &m_Nodes[left];
+		}
+		else
+		{
+			r = glm::min((r - p_left) / (1.0f - p_left), 0.99999994f);
+			probability *= 1.0f - p_left;
+			node = &m_Nodes[left + 1];
+		}
+	}
+
+	float w_total = 0.0f;
+	for (int i = 0; i < node->count; i++)
+		w_total += importance(p, m_Lights[m_PrimIndices[node->left_first + i]]);
+	if (w_total <= 0.0f)
+		return -1;
+
+	float cdf = 0.0f;
+	for (int i = 0; i < node->count; i++)
+	{
+		const unsigned int light = m_PrimIndices[node->left_first + i];
+		const float w = importance(p, m_Lights[light]) / w_total;
+		cdf += w;
+		if (r < cdf || i == node->count - 1)
+		{
+			*pdf = probability * w;
+			return w > 0.0f ? static_cast<int>(light) : -1;
+		}
+	}
+
+	return -1;
+}
+
+float LightBVH::pdf(const glm::vec3 &p, int light) const
+{
+	if (light < 0 || light >= static_cast<int>(m_Lights.size()))
+		return 0.0f;
+
+	// Probability of the light within its leaf
+	int nodeIdx = m_LightLeaves[light];
+	const LightNode &leaf = m_Nodes[nodeIdx];
+	float w_total = 0.0f;
+	for (int i = 0; i < leaf.count; i++)
+		w_total += importance(p, m_Lights[m_PrimIndices[leaf.left_first + i]]);
+	if (w_total <= 0.0f)
+		return 0.0f;
+
+	float probability = importance(p, m_Lights[light]) / w_total;
+
+	// Probability of choosing every node on the path to the root
+	for (int parentIdx = m_Parents[nodeIdx]; parentIdx >= 0; nodeIdx = parentIdx, parentIdx = m_Parents[nodeIdx])
+	{
+		const int left = m_Nodes[parentIdx].left_first;
+		const float w_left = importance(p, m_Nodes[left].bounds);
+		const float w_right = importance(p, m_Nodes[left + 1].bounds);
+		const float w_sum = w_left + w_right;
+		if (w_sum <= 0.0f)
+			return 0.0f;
+
+		probability *= (nodeIdx == left ? w_left : w_right) / w_sum;
+	}
+
+	return probability;
+}
+
+void LightBVH::gather(const AreaLight *areaLights, size_t areaCount, const PointLight *pointLights,
+					  size_t pointCount, const SpotLight *spotLights, size_t spotCount)
+{
+	m_Lights.resize(areaCount + pointCount + spotCount);
+
+	size_t idx = 0;
+	for (size_t i = 0; i < areaCount; i++, idx++)
+	{
+		const AreaLight &l = areaLights[i];
+		LightBounds &b = m_Lights[idx];
+		b.bounds = AABB(glm::min(l.vertex0, glm::min(l.vertex1, l.vertex2)),
+						glm::max(l.vertex0, glm::max(l.vertex1, l.vertex2)));
+		b.axis = l.normal;
+		b.power = light_power(l);
+		b.theta_o = 0.0f;
+		b.theta_e = glm::half_pi<float>();
+	}
+
+	for (size_t i = 0; i < pointCount; i++, idx++)
+	{
+		const PointLight &l = pointLights[i];
+		LightBounds &b = m_Lights[idx];
+		b.bounds = AABB(l.position, l.position);
+		b.axis = glm::vec3(0, 1, 0);
+		b.power = light_power(l);
+		b.theta_o = glm::pi<float>();
+		b.theta_e = glm::half_pi<float>();
+	}
+
+	for (size_t i = 0; i < spotCount; i++, idx++)
+	{
+		const SpotLight &l = spotLights[i];
+		LightBounds &b = m_Lights[idx];
+		b.bounds = AABB(l.position, l.position);
+		b.axis = l.direction;
+		b.power = light_power(l);
+		b.theta_o = acos(glm::clamp(l.cosInner, -1.0f, 1.0f));
+		b.theta_e = glm::max(acos(glm::clamp(l.cosOuter, -1.0f, 1.0f)) - b.theta_o, 0.0f);
+	}
+}
+
+void LightBVH::refit_node(int nodeIdx, int parentIdx)
+{
+	LightNode &node = m_Nodes[nodeIdx];
+	m_Parents[nodeIdx] = parentIdx;
+
+	if (!node.is_leaf())
+	{
+		refit_node(node.left_first, nodeIdx);
+		refit_node(node.left_first + 1, nodeIdx);
+		node.bounds = union_of(m_Nodes[node.left_first].bounds, m_Nodes[node.left_first + 1].bounds);
+		return;
+	}
+
+	for (int i = 0; i < node.count; i++)
+	{
+		const unsigned int light = m_PrimIndices[node.left_first + i];
+		m_LightLeaves[light] = nodeIdx;
+		node.bounds = i == 0 ? m_Lights[light] : union_of(node.bounds, m_Lights[light]);
+	}
+}
+
+LightBVH::LightBounds LightBVH::union_of(const LightBounds &a, const LightBounds &b)
+{
+	if (a.power <= 0.0f)
+	{
+		LightBounds result = b;
+		result.bounds.grow(a.bounds);
+		return result;
+	}
+	if (b.power <= 0.0f)
+		return union_of(b, a);
+
+	LightBounds result;
+	result.bounds = AABB::union_of(a.bounds, b.bounds);
+	result.power = a.power + b.power;
+	result.theta_e = glm::max(a.theta_e, b.theta_e);
+
+	// Smallest cone containing both cones, the wider cone is extended towards the other one
+	const LightBounds &wide = a.theta_o >= b.theta_o ? a : b;
+	const LightBounds &narrow = a.theta_o >= b.theta_o ? b : a;
+
+	const float theta_d = acos(glm::clamp(dot(wide.axis, narrow.axis), -1.0f, 1.0f));
+	if (glm::min(theta_d + narrow.theta_o, glm::pi<float>()) <= wide.theta_o)
+	{
+		result.axis = wide.axis;
+		result.theta_o = wide.theta_o;
+		return result;
+	}
+
+	const float theta_o = 0.5f * (wide.theta_o + theta_d + narrow.theta_o);
+	const glm::vec3 perpendicular = narrow.axis - wide.axis * dot(wide.axis, narrow.axis);
+	const float perpendicular_length = length(perpendicular);
+	if (theta_o >= glm::pi<float>() || perpendicular_length < 1e-6f)
+	{
+		result.axis = wide.axis;
+		result.theta_o = glm::pi<float>();
+		return result;
+	}
+
+	const float theta_r = theta_o - wide.theta_o;
+	result.axis = normalize(wide.axis * cos(theta_r) + perpendicular * (sin(theta_r) / perpendicular_length));
+	result.theta_o = theta_o;
+	return result;
+}
+
+float LightBVH::importance(const glm::vec3 &p, const LightBounds &bounds)
+{
+	if (bounds.power <= 0.0f)
+		return 0.0f;
+
+	const glm::vec3 d = p - bounds.bounds.centroid();
+	const float sq_dist = dot(d, d);
+	const float sq_radius = 0.25f * dot(bounds.bounds.lengths(), bounds.bounds.lengths());
+
+	// Points inside the bounding sphere can receive light from any of its lights
+	float cos_theta_p = 1.0f;
+	if (sq_dist > sq_radius)
+	{
+		const float dist = sqrt(sq_dist);
+		const float theta = acos(glm::clamp(dot(bounds.axis, d / dist), -1.0f, 1.0f));
+		const float theta_u = asin(glm::min(sqrt(sq_radius) / dist, 1.0f));
+		const float theta_p = glm::max(theta - bounds.theta_o - theta_u, 0.0f);
+		if (theta_p > bounds.theta_e)
+			return 0.0f;
+		cos_theta_p = glm::max(cos(theta_p), 1e-4f);
+	}
+
+	return bounds.power * cos_theta_p / glm::max(sq_dist, glm::max(sq_radius, 1e-8f));
+}
+
+} // namespace bvh
+} // namespace rfw
@@ -0,0 +1,199 @@
+#include <bvh/BVH.h>
+
+#include <cstring>
+
+namespace rfw
+{
+namespace bvh
+{
+
+template <typename T, typename DeviceT> static void copy_lights(std::vector<T> &lights, const DeviceT *data, uint count)
+{
+	static_assert(sizeof(T) == sizeof(DeviceT));
+
+	lights.resize(count);
+	if (!lights.empty())
+		memcpy(lights.data(), data, lights.size() * sizeof(T));
+}
+
+void LightSampler::set_lights(const LightCount &lightCount, const DeviceAreaLight *areaLights,
+							  const DevicePointLight *pointLights, const DeviceSpotLight *spotLights,
+							  const DeviceDirectionalLight *directionalLights)
+{
+	// Lights only moved when the counts did not change, e.g. after emissive instances were transformed
+	const bool refit = lightCount.areaLightCount == m_LightCount.areaLightCount &&
+					   lightCount.pointLightCount == m_LightCount.pointLightCount &&
+					   lightCount.spotLightCount == m_LightCount.spotLightCount && !m_BVH.empty();
+	m_LightCount = lightCount;
+
+	copy_lights(m_AreaLights, areaLights, lightCount.areaLightCount);
+	copy_lights(m_PointLights, pointLights, lightCount.pointLightCount);
+	copy_lights(m_SpotLights, spotLights, lightCount.spotLightCount);
+	copy_lights(m_DirectionalLights, directionalLights, lightCount.directionalLightCount);
+
+	std::vector<float> power;
+	power.reserve(m_AreaLights.size() + m_PointLights.size() + m_SpotLights.size() + m_DirectionalLights.size());
+	for (const auto &l : m_AreaLights)
+		power.push_back(light_power(l));
+	for (const auto &l : m_PointLights)
+		power.push_back(light_power(l));
+	for (const auto &l : m_SpotLights)
+		power.push_back(light_power(l));
+	for (const auto &l : m_DirectionalLights)
+		power.push_back(light_power(l));
+
+	m_Table.build(power.data(), power.size());
+
+	if (refit)
+		m_BVH.refit(m_AreaLights.data(), m_AreaLights.size(), m_PointLights.data(), m_PointLights.size(),
+					m_SpotLights.data(), m_SpotLights.size());
+	else
+		m_BVH.build(m_AreaLights.data(), m_AreaLights.size(), m_PointLights.data(), m_PointLights.size(),
+					m_SpotLights.data(), m_SpotLights.size());
+
+	m_DirectionalPower = 0.0f;
+	for (const auto &l : m_DirectionalLights)
+		m_DirectionalPower += light_power(l);
+}
+
+int LightSampler::pick(const glm::vec3 &p, float r, float *pdf) const
+{
+	*pdf = 0.0f;
+	const int lightCount = static_cast<int>(m_Table.size());
+	if (lightCount == 0)
+		return -1;
+
+	if (m_Selection == Selection::Uniform)
+	{
+		*pdf = 1.0f / static_cast<float>(lightCount);
+		return glm::min(static_cast<int>(r * static_cast<float>(lightCount)), lightCount - 1);
+	}
+
+	if (m_Selection == Selection::Power)
+	{
+		const size_t index = m_Table.sample(r);
+		*pdf = m_Table.pdf(index);
+		return static_cast<int>(index);
+	}
+
+	// Directional lights are picked uniformly within their share of the power
+	const float directionalProb = directional_probability();
+	if (r < directionalProb)
+	{
+		const int count = static_cast<int>(m_DirectionalLights.size());
+		const int index = glm::min(static_cast<int>(r / directionalProb * static_cast<float>(count)), count - 1);
+		*pdf = directionalProb / static_cast<float>(count);
+		return static_cast<int>(m_BVH.get_light_count()) + index;
+	}
+
+	r = glm::min((r - directionalProb) / (1.0f - directionalProb), 0.99999994f);
+	const int index = m_BVH.sample(p, r, pdf);
+	*pdf *= 1.0f - directionalProb;
+	return index;
+}
+
+float LightSampler::pdf(const glm::vec3 &p, int light) const
+{
+	const int lightCount = static_cast<int>(m_Table.size());
+	if (light < 0 || light >= lightCount)
+		return 0.0f;
+
+	if (m_Selection == Selection::Uniform)
+		return 1.0f / static_cast<float>(lightCount);
+	if (m_Selection == Selection::Power)
+		return m_Table.pdf(static_cast<size_t>(light));
+
+	const float directionalProb = directional_probability();
+	if (light >= static_cast<int>(m_BVH.get_light_count()))
+		return directionalProb / static_cast<float>(m_DirectionalLights.size());
+	return m_BVH.pdf(p, light) * (1.0f - directionalProb);
+}
+
+bool LightSampler::connect(int light, const glm::vec3 &p, const glm::vec3 &N, glm::vec3 *L, float *dist,
+						   glm::vec3 *radiance) const
+{
+	if (light < 0)
+		return false;
+
+	auto index = static_cast<size_t>(light);
+	if (index < m_AreaLights.size())
+	{
+		const AreaLight &l = m_AreaLights[index];
+		const glm::vec3 D = l.position - p;
+		const float sq_dist = glm::dot(D, D);
+		*dist = sqrt(sq_dist);
+		*L = D / *dist;
+		const float NdotL = glm::dot(N, *L);
+		const float LNdotL = -glm::dot(l.normal, *L);
+		if (NdotL <= 0 || LNdotL <= 0)
+			return false;
+
+		*radiance = l.radiance * l.area / sq_dist * NdotL * LNdotL;
+		return true;
+	}
+	index -= m_AreaLights.size();
+
+	if (index < m_PointLights.size())
+	{
+		const PointLight &l = m_PointLights[index];
+		const glm::vec3 D = l.position - p;
+		const float sq_dist = glm::dot(D, D);
+		*dist = sqrt(sq_dist);
+		*L = D / *dist;
+		const float NdotL = glm::dot(N, *L);
+		if (NdotL <= 0)
+			return false;
+
+		*radiance = l.radiance / sq_dist * NdotL;
+		return true;
+	}
+	index -= m_PointLights.size();
+
+	if (index < m_SpotLights.size())
+	{
+		const SpotLight &l = m_SpotLights[index];
+		const glm::vec3 D = l.position - p;
+		const float sq_dist = glm::dot(D, D);
+		*dist = sqrt(sq_dist);
+		*L = D / *dist;
+		const float NdotL = glm::dot(N, *L);
+		const float cos_angle = -glm::dot(l.direction, *L);
+		const float falloff = glm::clamp((cos_angle - l.cosOuter) / (l.cosInner - l.cosOuter), 0.0f, 1.0f);
+		if (NdotL <= 0 || falloff <= 0)
+			return false;
+
+		*radiance = l.radiance * falloff / sq_dist * NdotL;
+		return true;
+	}
+	index -= m_SpotLights.size();
+
+	if (index < m_DirectionalLights.size())
+	{
+		const DirectionalLight &l = m_DirectionalLights[index];
+		*L = -l.direction;
+		*dist = 1e34f;
+		const float NdotL = glm::dot(N, *L);
+		if (NdotL <= 0)
+			return false;
+
+		*radiance = l.radiance * NdotL;
+		return true;
+	}
+
+	return false;
+}
+
+float LightSampler::directional_probability() const
+{
+	if (m_DirectionalLights.empty())
+		return 0.0f;
+	if (m_BVH.empty())
+		return 1.0f;
+
+	const float total = m_DirectionalPower + m_BVH.get_power();
+	// Directional lights keep a minimum share so their contribution is still sampled when the hierarchy dominates
+	return total > 0.0f ? glm::max(m_DirectionalPower / total, 0.01f) : 0.5f;
+}
+
+} // namespace bvh
+} // namespace rfw
@@ -0,0 +1,208 @@
+#include <bvh/BVH.h>
+
+using namespace glm;
+
+namespace rfw::bvh
+{
+
+void MBVH8Node::set_bounds(unsigned int nodeIdx, const vec3 &min, const vec3 &max)
+{
+	this->bminx[nodeIdx] = min.x;
+	this->bminy[nodeIdx] = min.y;
+	this->bminz[nodeIdx] = min.z;
+
+	this->bmaxx[nodeIdx] = max.x;
+	this->bmaxy[nodeIdx] = max.y;
+	this->bmaxz[nodeIdx] = max.z;
+}
+
+void MBVH8Node::set_bounds(unsigned int nodeIdx, const AABB &bounds)
+{
+	this->bminx[nodeIdx] = bounds.bmin[0];
+	this->bminy[nodeIdx] = bounds.bmin[1];
+	this->bminz[nodeIdx] = bounds.bmin[2];
+
+	this->bmaxx[nodeIdx] = bounds.bmax[0];
+	this->bmaxy[nodeIdx] = bounds.bmax[1];
+	this->bmaxz[nodeIdx] = bounds.bmax[2];
+}
+
+MBVH8Hit MBVH8Node::intersect(const glm::vec3 &org, const glm::vec3 &dirInverse, float rayt) const
+{
+	MBVH8Hit hit;
+
+	__m256 org_component = _mm256_set1_ps(org.x);
+	__m256 dir_component = _mm256_set1_ps(dirInverse.x);
+
+	__m256 t1 = _mm256_mul_ps(_mm256_sub_ps(bminx_8, org_component), dir_component);
+	__m256 t2 = _mm256_mul_ps(_mm256_sub_ps(bmaxx_8, org_component), dir_component);
+	hit.tmin8 = _mm256_min_ps(t1, t2);
+	__m256 t_max = _mm256_max_ps(t1, t2);
+
+	org_component = _mm256_set1_ps(org.y);
+	dir_component = _mm256_set1_ps(dirInverse.y);
+
+	t1 = _mm256_mul_ps(_mm256_sub_ps(bminy_8, org_component), dir_component);
+	t2 = _mm256_mul_ps(_mm256_sub_ps(bmaxy_8, org_component), dir_component);
+	hit.tmin8 = _mm256_max_ps(hit.tmin8, _mm256_min_ps(t1, t2));
+	t_max = _mm256_min_ps(t_max, _mm256_max_ps(t1, t2));
+
+	org_component = _mm256_set1_ps(org.z);
+	dir_component = _mm256_set1_ps(dirInverse.z);
+
+	t1 = _mm256_mul_ps(_mm256_sub_ps(bminz_8, org_component), dir_component);
+	t2 = _mm256_mul_ps(_mm256_sub_ps(bmaxz_8, org_component), dir_component);
+	hit.tmin8 = _mm256_max_ps(hit.tmin8, _mm256_min_ps(t1, t2));
+	t_max = _mm256_min_ps(t_max, _mm256_max_ps(t1, t2));
+
+	// return tmax >= tmin && tmax >= 0 && tmin < t;
+	const __m256 greaterThanMin = _mm256_cmp_ps(t_max, hit.tmin8, _CMP_GE_OQ);
+	const __m256 inFront = _mm256_cmp_ps(t_max, _mm256_setzero_ps(), _CMP_GE_OQ);
+	const __m256 lessThanT = _mm256_cmp_ps(hit.tmin8, _mm256_set1_ps(rayt), _CMP_LT_OQ);
+	hit.mask = _mm256_movemask_ps(_mm256_and_ps(_mm256_and_ps(greaterThanMin, inFront), lessThanT));
+
+	return hit;
+}
+
+MBVH8Hit MBVH8Node::intersect4(const float origin_x[4], const float origin_y[4], const float origin_z[4],
+							   const float inv_direction_x[4], const float inv_direction_y[4],
+							   const float inv_direction_z[4], const float rayt[4]) const
+{
+	MBVH8Hit hit;
+	hit.tmin8 = _mm256_set1_ps(1e34f);
+	__m256 result = _mm256_setzero_ps();
+
+	for (int i = 0; i < 4; i++)
+	{
+		__m256 org_component = _mm256_set1_ps(origin_x[i]);
+		__m256 dir_component = _mm256_set1_ps(inv_direction_x[i]);
+
+		__m256 t1 = _mm256_mul_ps(_mm256_sub_ps(bminx_8, org_component), dir_component);
+		__m256 t2 = _mm256_mul_ps(_mm256_sub_ps(bmaxx_8, org_component), dir_component);
+		__m256 tmin8 = _mm256_min_ps(t1, t2);
+		__m256 tmax8 = _mm256_max_ps(t1, t2);
+
+		org_component = _mm256_set1_ps(origin_y[i]);
+		dir_component = _mm256_set1_ps(inv_direction_y[i]);
+
+		t1 = _mm256_mul_ps(_mm256_sub_ps(bminy_8, org_component), dir_component);
+		t2 = _mm256_mul_ps(_mm256_sub_ps(bmaxy_8, org_component), dir_component);
+		tmin8 = _mm256_max_ps(tmin8, _mm256_min_ps(t1, t2));
+		tmax8 = _mm256_min_ps(tmax8, _mm256_max_ps(t1, t2));
+
+		org_component = _mm256_set1_ps(origin_z[i]);
+		dir_component = _mm256_set1_ps(inv_direction_z[i]);
+
+		t1 = _mm256_mul_ps(_mm256_sub_ps(bminz_8, org_component), dir_component);
+		t2 = _mm256_mul_ps(_mm256_sub_ps(bmaxz_8, org_component), dir_component);
+		tmin8 = _mm256_max_ps(tmin8, _mm256_min_ps(t1, t2));
+		tmax8 = _mm256_min_ps(tmax8, _mm256_max_ps(t1, t2));
+
+		const __m256 greaterThanMin = _mm256_cmp_ps(tmax8, tmin8, _CMP_GE_OQ);
+		const __m256 inFront = _mm256_cmp_ps(tmax8, _mm256_setzero_ps(), _CMP_GE_OQ);
+		const __m256 lessThanT = _mm256_cmp_ps(tmin8, _mm256_set1_ps(rayt[i]), _CMP_LT_OQ);
+		result = _mm256_or_ps(result, _mm256_and_ps(_mm256_and_ps(greaterThanMin, inFront), lessThanT));
+
+		// Children are ordered by the nearest entry distance of any ray in the packet
+		hit.tmin8 = _mm256_min_ps(hit.tmin8, tmin8);
+	}
+
+	hit.mask = _mm256_movemask_ps(result);
+	return hit;
+}
+
+void MBVH8Node::merge_nodes(const BVHNode &node, const rfw::utils::array_proxy<BVHNode> bvhPool, MBVH8Node *bvhTree,
+							std::atomic_int &poolPtr)
+{
+	if (node.is_leaf())
+		throw std::runtime_error("Leaf nodes should not be attempted to be split");
+
+	int children[8];
+	int numChildren = 2;
+	children[0] = node.get_left_first();
+	children[1] = node.get_left_first() + 1;
+
+	// Open the interior child with the largest surface area until the node is full
+	while (numChildren < 8)
+	{
+		int best = -1;
+		float best_area = -1.0f;
+		for (int i = 0; i < numChildren; i++)
+		{
+			const BVHNode &child = bvhPool[children[i]];
+			if (child.is_leaf())
+				continue;
+
+			const float area = child.bounds.area();
+			if (area > best_area)
+			{
+				best = i;
+				best_area = area;
+			}
+		}
+
+		if (best < 0) // All children are leaves
+			break;
+
+		const int left = bvhPool[children[best]].get_left_first();
+		children[best] = left;
+		children[numChildren++] = left + 1;
+	}
+
+	for (int idx = 0; idx < 8; idx++)
+	{
+		if (idx >= numChildren) // Invalidate unused children
+		{
+			set_bounds(idx, vec3(1e34f), vec3(-1e34f));
+			childs[idx] = -1;
+			counts[idx] = 0;
+			continue;
+		}
+
+		const BVHNode &curNode = bvhPool[children[idx]];
+		set_bounds(idx, curNode.bounds);
+
+		if (curNode.is_leaf())
+		{
+			childs[idx] = curNode.get_left_first();
+			counts[idx] = curNode.get_count();
+		}
+		else
+		{
+			const auto newIdx = poolPtr.fetch_add(1);
+			MBVH8Node &newNode = bvhTree[newIdx];
+			childs[idx] = newIdx; // replace BVHNode idx with MBVH8Node idx
+			counts[idx] = -1;
+
+			newNode.merge_nodes(curNode, bvhPool, bvhTree, poolPtr);
+		}
+	}
+}
+
+AABB MBVH8Node::refit(MBVH8Node *bvhTree, const uint *primIDs, const AABB *aabbs)
+{
+	AABB bounds = AABB::invalid();
+	for (int i = 0; i < 8; i++)
+	{
+		if (childs[i] < 0)
+			continue;
+
+		AABB child_bounds = AABB::invalid();
+		if (counts[i] >= 0) // leaf node
+		{
+			for (int j = 0; j < counts[i]; j++)
+				child_bounds.grow(aabbs[primIDs[childs[i] + j]]);
+		}
+		else
+		{
+			child_bounds = bvhTree[childs[i]].refit(bvhTree, primIDs, aabbs);
+		}
+
+		set_bounds(i, child_bounds);
+		bounds.grow(child_bounds);
+	}
+
+	return bounds;
+}
+
+} // namespace rfw::bvh
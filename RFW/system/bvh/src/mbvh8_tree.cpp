@@ -0,0 +1,87 @@
+#include <bvh/BVH.h>
+
+#include <rfw/utils/timer.h>
+#include <rfw/utils/logger.h>
+
+using namespace glm;
+using namespace rfw;
+using namespace simd;
+
+namespace rfw::bvh
+{
+
+MBVH8Tree::MBVH8Tree() = default;
+
+MBVH8Tree::MBVH8Tree(BVHTree *orgTree) { this->bvh = orgTree; }
+MBVH8Tree::~MBVH8Tree() { reset(); }
+
+void MBVH8Tree::reset() { nodes.clear(); }
+
+void MBVH8Tree::construct()
+{
+	reset();
+	builder::collapse_mbvh8(bvh->nodes, nodes);
+}
+
+void MBVH8Tree::refit() { nodes[0].refit(nodes.data(), bvh->prim_indices.data(), bvh->aabbs.data()); }
+
+void MBVH8Tree::refit(const glm::vec4 *vertices)
+{
+	bvh->refit(vertices);
+	refit();
+}
+
+void MBVH8Tree::refit(const glm::vec4 *vertices, const glm::uvec3 *indices)
+{
+	bvh->refit(vertices, indices);
+	refit();
+}
+
+bool MBVH8Tree::traverse(const glm::vec3 &origin, const glm::vec3 &dir, float t_min, float *ray_t, int *primIdx,
+						 glm::vec2 *bary)
+{
+	const auto intersection = [&](int first, int count) {
+		return bvh->leaf_triangles.intersect(origin, dir, t_min, ray_t, first, count, bary);
+	};
+
+	return MBVH8Node::traverse_mbvh(origin, dir, t_min, ray_t, primIdx, nodes.data(), bvh->prim_indices.data(),
+									intersection);
+}
+
+bool MBVH8Tree::traverse(const glm::vec3 &origin, const glm::vec3 &dir, float t_min, float *ray_t, int *primIdx)
+{
+	const auto intersection = [&](int first, int count) {
+		return bvh->leaf_triangles.intersect(origin, dir, t_min, ray_t, first, count);
+	};
+
+	return MBVH8Node::traverse_mbvh(origin, dir, t_min, ray_t, primIdx, nodes.data(), bvh->prim_indices.data(),
+									intersection);
+}
+
+int MBVH8Tree::traverse4(const float origin_x[4], const float origin_y[4], const float origin_z[4], const float dir_x[4],
+						 const float dir_y[4], const float dir_z[4], float t[4], int primID[4], float t_min,
+						 __m128 *hit_mask)
+{
+	const auto intersection = [&](int first, int count, __m128 *store_mask) {
+		return bvh->leaf_triangles.intersect4(origin_x, origin_y, origin_z, dir_x, dir_y, dir_z, t_min, t, primID, first,
+											  count, store_mask);
+	};
+
+	return MBVH8Node::traverse_mbvh4(origin_x, origin_y, origin_z, dir_x, dir_y, dir_z, t, primID, nodes.data(),
+									 bvh->prim_indices.data(), hit_mask, intersection);
+}
+
+bool MBVH8Tree::traverse_shadow(const glm::vec3 &origin, const glm::vec3 &dir, float t_min, float t_max)
+{
+	const auto intersection = [&](int first, int count) {
+		return bvh->leaf_triangles.occluded(origin, dir, t_min, t_max, first, count);
+	};
+
+	return MBVH8Node::traverse_mbvh_shadow(origin, dir, t_min, t_max, nodes.data(), bvh->prim_indices.data(),
+										   intersection);
+}
+
+AABB MBVH8Tree::get_aabb() const { return bvh->get_aabb(); }
+
+BVHStats MBVH8Tree::get_stats(bool epo) const { return stats::compute(nodes, epo ? bvh : nullptr); }
+} // namespace rfw::bvh
\ No newline at end of file
@@ -229,6 +229,32 @@ void MBVHNode::merge_nodes(const BVHNode &node, const rfw::utils::array_proxy<BV
 	}
 }
 
+AABB MBVHNode::refit(MBVHNode *bvhTree, const uint *primIDs, const AABB *aabbs)
+{
+	AABB bounds = AABB::invalid();
+	for (int i = 0; i < 4; i++)
+	{
+		if (childs[i] < 0)
+			continue;
+
+		AABB child_bounds = AABB::invalid();
+		if (counts[i] >= 0) // leaf node
+		{
+			for (int j = 0; j < counts[i]; j++)
+				child_bounds.grow(aabbs[primIDs[childs[i] + j]]);
+		}
+		else
+		{
+			child_bounds = bvhTree[childs[i]].refit(bvhTree, primIDs, aabbs);
+		}
+
+		set_bounds(i, child_bounds);
+		bounds.grow(child_bounds);
+	}
+
+	return bounds;
+}
+
 void MBVHNode::merge_node(const BVHNode &node, const rfw::utils::array_proxy<BVHNode> pool, int &numChildren)
 {
 	// Starting values
@@ -0,0 +1,47 @@
+#include <bvh/BVH.h>
+
+namespace rfw::bvh
+{
+
+void RayStreamSoA::resize(size_t count)
+{
+	origin_x.resize(count);
+	origin_y.resize(count);
+	origin_z.resize(count);
+
+	dir_x.resize(count);
+	dir_y.resize(count);
+	dir_z.resize(count);
+
+	t_min.resize(count, 1e-5f);
+	t_max.resize(count, 1e34f);
+}
+
+void RayStreamSoA::set(size_t idx, const glm::vec3 &origin, const glm::vec3 &direction, float tmax, float tmin)
+{
+	origin_x[idx] = origin.x;
+	origin_y[idx] = origin.y;
+	origin_z[idx] = origin.z;
+
+	dir_x[idx] = direction.x;
+	dir_y[idx] = direction.y;
+	dir_z[idx] = direction.z;
+
+	t_min[idx] = tmin;
+	t_max[idx] = tmax;
+}
+
+void HitStreamSoA::resize(size_t count)
+{
+	t.resize(count);
+	prim_id.resize(count);
+	inst_id.resize(count);
+}
+
+StreamScratch &StreamScratch::get()
+{
+	static thread_local StreamScratch scratch;
+	return scratch;
+}
+
+} // namespace rfw::bvh
@@ -0,0 +1,449 @@
+#include <bvh/BVH.h>
+
+#include <atomic>
+
+#include <tbb/concurrent_vector.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_group.h>
+
+#if !RFW_RTBVH
+
+namespace rfw::bvh::builder
+{
+
+namespace
+{
+
+struct Reference
+{
+	AABB bounds;
+	unsigned int primID;
+};
+
+struct SplitCandidate
+{
+	float cost = 1e34f;
+	int axis = -1;
+	bool spatial = false;
+
+	// Object split: references in bins [0, bin] go left
+	int bin = 0;
+	float bin_min = 0.0f;
+	float bin_scale = 0.0f;
+
+	// Spatial split: references are clipped against this plane
+	float position = 0.0f;
+
+	// Surface area of the overlap between both children of an object split
+	float overlap = 1e34f;
+};
+
+inline bool is_valid(const AABB &bounds)
+{
+	return bounds.bmin[0] <= bounds.bmax[0] && bounds.bmin[1] <= bounds.bmax[1] && bounds.bmin[2] <= bounds.bmax[2];
+}
+
+// AABB::area() is undefined for empty boxes, treat them as having no surface
+inline float half_area(const AABB &bounds) { return is_valid(bounds) ? bounds.area() : 0.0f; }
+
+/*
+ * SBVH builder as described in "Spatial Splits in Bounding Volume Hierarchies" by Stich et al. 2009.
+ * Spatial splits are only evaluated when the children of the best object split overlap by more than alpha times the
+ * surface area of the root node. Sub-trees with enough references are built in parallel.
+ */
+class SpatialBuilder
+{
+  public:
+	static constexpr int OBJECT_BINS = 32;
+	static constexpr int SPATIAL_BINS = 32;
+	static constexpr int MAX_DEPTH = BVH_MAX_DEPTH;
+	// Nodes that fit in a single 8-wide leaf block are not split
+	static constexpr int MAX_LEAF_SIZE = BVH_LEAF_SIZE;
+	static constexpr int PARALLEL_THRESHOLD = 4096;
+	static constexpr float ALPHA = 1e-5f;
+
+	SpatialBuilder(const glm::vec4 *vertices, int primCount, const AABB &rootBounds)
+		: m_Vertices(vertices), m_MinOverlap(ALPHA * half_area(rootBounds)), m_SplitBudget(primCount)
+	{
+	}
+
+	void build(std::vector<Reference> &refs, int nodeIdx, const AABB &bounds, int depth);
+
+	tbb::concurrent_vector<BVHNode> nodes;
+	tbb::concurrent_vector<unsigned int> prim_indices;
+
+  private:
+	void make_leaf(const std::vector<Reference> &refs, int nodeIdx);
+
+	SplitCandidate find_object_split(const std::vector<Reference> &refs) const;
+	SplitCandidate find_spatial_split(const std::vector<Reference> &refs, const AABB &bounds) const;
+
+	void perform_object_split(const SplitCandidate &split, const std::vector<Reference> &refs,
+							  std::vector<Reference> &left, std::vector<Reference> &right) const;
+	void perform_spatial_split(const SplitCandidate &split, const std::vector<Reference> &refs,
+							   std::vector<Reference> &left, std::vector<Reference> &right);
+
+	void split_reference(const Reference &ref, int axis, float position, Reference *left, Reference *right) const;
+
+	const glm::vec4 *m_Vertices;
+	const float m_MinOverlap;
+
+	// Limits the number of additional references spatial splits may introduce
+	std::atomic_int m_SplitBudget;
+};
+
+void SpatialBuilder::build(std::vector<Reference> &refs, int nodeIdx, const AABB &bounds, int depth)
+{
+	const int count = static_cast<int>(refs.size());
+	if (count <= MAX_LEAF_SIZE || depth >= MAX_DEPTH)
+		return make_leaf(refs, nodeIdx);
+
+	SplitCandidate split = find_object_split(refs);
+	if (m_SplitBudget.load() > 0 && split.overlap > m_MinOverlap)
+	{
+		const SplitCandidate spatial = find_spatial_split(refs, bounds);
+		if (spatial.cost < split.cost)
+			split = spatial;
+	}
+
+	if (split.axis < 0 || half_area(bounds) * static_cast<float>(count) < split.cost)
+		return make_leaf(refs, nodeIdx);
+
+	std::vector<Reference> left_refs, right_refs;
+	if (split.spatial)
+		perform_spatial_split(split, refs, left_refs, right_refs);
+	else
+		perform_object_split(split, refs, left_refs, right_refs);
+
+	if (left_refs.empty() || right_refs.empty())
+		return make_leaf(refs, nodeIdx);
+
+	// Release memory of this node's references before descending
+	std::vector<Reference>().swap(refs);
+
+	AABB left_bounds = AABB::invalid();
+	for (const auto &ref : left_refs)
+		left_bounds.grow(ref.bounds);
+	AABB right_bounds = AABB::invalid();
+	for (const auto &ref : right_refs)
+		right_bounds.grow(ref.bounds);
+
+	left_bounds.offset_by(1e-5f);
+	right_bounds.offset_by(1e-5f);
+
+	const int left = static_cast<int>(nodes.grow_by(2) - nodes.begin());
+	nodes[left].bounds = left_bounds;
+	nodes[left + 1].bounds = right_bounds;
+	nodes[nodeIdx].set_left_first(left);
+	nodes[nodeIdx].set_count(-1);
+
+	if (count > PARALLEL_THRESHOLD)
+	{
+		tbb::task_group group;
+		group.run([&]() { build(left_refs, left, left_bounds, depth + 1); });
+		build(right_refs, left + 1, right_bounds, depth + 1);
+		group.wait();
+	}
+	else
+	{
+		build(left_refs, left, left_bounds, depth + 1);
+		build(right_refs, left + 1, right_bounds, depth + 1);
+	}
+}
+
+void SpatialBuilder::make_leaf(const std::vector<Reference> &refs, int nodeIdx)
+{
+	const auto first = prim_indices.grow_by(refs.size());
+	for (size_t i = 0; i < refs.size(); i++)
+		first[i] = refs[i].primID;
+
+	nodes[nodeIdx].set_left_first(static_cast<int>(first - prim_indices.begin()));
+	nodes[nodeIdx].set_count(static_cast<int>(refs.size()));
+}
+
+SplitCandidate SpatialBuilder::find_object_split(const std::vector<Reference> &refs) const
+{
+	SplitCandidate best = {};
+
+	AABB centroid_bounds = AABB::invalid();
+	for (const auto &ref : refs)
+		centroid_bounds.grow(ref.bounds.centroid());
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float extent = centroid_bounds.extend(axis);
+		if (extent <= 1e-12f)
+			continue;
+
+		const float bin_min = centroid_bounds.bmin[axis];
+		const float bin_scale = static_cast<float>(OBJECT_BINS) * (1.0f - 1e-5f) / extent;
+
+		AABB bin_bounds[OBJECT_BINS];
+		int bin_counts[OBJECT_BINS] = {};
+		for (const auto &ref : refs)
+		{
+			const int bin = glm::min(OBJECT_BINS - 1, static_cast<int>((ref.bounds.center(axis) - bin_min) * bin_scale));
+			bin_bounds[bin].grow(ref.bounds);
+			bin_counts[bin]++;
+		}
+
+		AABB right_bounds[OBJECT_BINS - 1];
+		int right_counts[OBJECT_BINS - 1];
+		AABB right = AABB::invalid();
+		int right_count = 0;
+		for (int i = OBJECT_BINS - 1; i > 0; i--)
+		{
+			right.grow(bin_bounds[i]);
+			right_count += bin_counts[i];
+			right_bounds[i - 1] = right;
+			right_counts[i - 1] = right_count;
+		}
+
+		AABB left = AABB::invalid();
+		int left_count = 0;
+		for (int i = 0; i < OBJECT_BINS - 1; i++)
+		{
+			left.grow(bin_bounds[i]);
+			left_count += bin_counts[i];
+			if (left_count == 0 || right_counts[i] == 0)
+				continue;
+
+			const float cost = half_area(left) * static_cast<float>(left_count) +
+							   half_area(right_bounds[i]) * static_cast<float>(right_counts[i]);
+			if (cost < best.cost)
+			{
+				best.cost = cost;
+				best.axis = axis;
+				best.spatial = false;
+				best.bin = i;
+				best.bin_min = bin_min;
+				best.bin_scale = bin_scale;
+				best.overlap = half_area(left.intersection(right_bounds[i]));
+			}
+		}
+	}
+
+	return best;
+}
+
+SplitCandidate SpatialBuilder::find_spatial_split(const std::vector<Reference> &refs, const AABB &bounds) const
+{
+	SplitCandidate best = {};
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float extent = bounds.extend(axis);
+		if (extent <= 1e-12f)
+			continue;
+
+		const float origin = bounds.bmin[axis];
+		const float bin_width = extent / static_cast<float>(SPATIAL_BINS);
+		const float inv_bin_width = 1.0f / bin_width;
+
+		AABB bin_bounds[SPATIAL_BINS];
+		int entries[SPATIAL_BINS] = {};
+		int exits[SPATIAL_BINS] = {};
+
+		for (const auto &ref : refs)
+		{
+			const int first =
+				glm::clamp(static_cast<int>((ref.bounds.bmin[axis] - origin) * inv_bin_width), 0, SPATIAL_BINS - 1);
+			const int last =
+				glm::clamp(static_cast<int>((ref.bounds.bmax[axis] - origin) * inv_bin_width), first, SPATIAL_BINS - 1);
+
+			// Chop the reference into a piece per bin it overlaps
+			Reference current = ref;
+			for (int bin = first; bin < last; bin++)
+			{
+				Reference left, right;
+				split_reference(current, axis, origin + bin_width * static_cast<float>(bin + 1), &left, &right);
+				bin_bounds[bin].grow(left.bounds);
+				current = right;
+			}
+			bin_bounds[last].grow(current.bounds);
+
+			entries[first]++;
+			exits[last]++;
+		}
+
+		AABB right_bounds[SPATIAL_BINS - 1];
+		int right_counts[SPATIAL_BINS - 1];
+		AABB right = AABB::invalid();
+		int right_count = 0;
+		for (int i = SPATIAL_BINS - 1; i > 0; i--)
+		{
+			right.grow(bin_bounds[i]);
+			right_count += exits[i];
+			right_bounds[i - 1] = right;
+			right_counts[i - 1] = right_count;
+		}
+
+		AABB left = AABB::invalid();
+		int left_count = 0;
+		for (int i = 0; i < SPATIAL_BINS - 1; i++)
+		{
+			left.grow(bin_bounds[i]);
+			left_count += entries[i];
+			if (left_count == 0 || right_counts[i] == 0)
+				continue;
+
+			const float cost = half_area(left) * static_cast<float>(left_count) +
+							   half_area(right_bounds[i]) * static_cast<float>(right_counts[i]);
+			if (cost < best.cost)
+			{
+				best.cost = cost;
+				best.axis = axis;
+				best.spatial = true;
+				best.position = origin + bin_width * static_cast<float>(i + 1);
+			}
+		}
+	}
+
+	return best;
+}
+
+void SpatialBuilder::perform_object_split(const SplitCandidate &split, const std::vector<Reference> &refs,
+										  std::vector<Reference> &left, std::vector<Reference> &right) const
+{
+	for (const auto &ref : refs)
+	{
+		const int bin = glm::min(OBJECT_BINS - 1,
+								 static_cast<int>((ref.bounds.center(split.axis) - split.bin_min) * split.bin_scale));
+		if (bin <= split.bin)
+			left.push_back(ref);
+		else
+			right.push_back(ref);
+	}
+}
+
+void SpatialBuilder::perform_spatial_split(const SplitCandidate &split, const std::vector<Reference> &refs,
+										   std::vector<Reference> &left, std::vector<Reference> &right)
+{
+	const int axis = split.axis;
+	const float position = split.position;
+
+	AABB left_bounds = AABB::invalid();
+	AABB right_bounds = AABB::invalid();
+	std::vector<Reference> straddling;
+
+	for (const auto &ref : refs)
+	{
+		if (ref.bounds.bmax[axis] <= position)
+		{
+			left.push_back(ref);
+			left_bounds.grow(ref.bounds);
+		}
+		else if (ref.bounds.bmin[axis] >= position)
+		{
+			right.push_back(ref);
+			right_bounds.grow(ref.bounds);
+		}
+		else
+		{
+			straddling.push_back(ref);
+		}
+	}
+
+	for (const auto &ref : straddling)
+	{
+		const auto left_count = static_cast<float>(left.size());
+		const auto right_count = static_cast<float>(right.size());
+
+		Reference left_ref, right_ref;
+		split_reference(ref, axis, position, &left_ref, &right_ref);
+
+		// Reference unsplitting: keep the reference whole on one side when that is cheaper than duplicating it
+		const float split_cost = half_area(AABB::union_of(left_bounds, left_ref.bounds)) * (left_count + 1.0f) +
+								 half_area(AABB::union_of(right_bounds, right_ref.bounds)) * (right_count + 1.0f);
+		const float left_cost = half_area(AABB::union_of(left_bounds, ref.bounds)) * (left_count + 1.0f) +
+								half_area(right_bounds) * right_count;
+		const float right_cost = half_area(left_bounds) * left_count +
+								 half_area(AABB::union_of(right_bounds, ref.bounds)) * (right_count + 1.0f);
+
+		const bool can_split = is_valid(left_ref.bounds) && is_valid(right_ref.bounds) && m_SplitBudget.load() > 0;
+
+		if (can_split && split_cost < left_cost && split_cost < right_cost)
+		{
+			m_SplitBudget.fetch_sub(1);
+			left.push_back(left_ref);
+			left_bounds.grow(left_ref.bounds);
+			right.push_back(right_ref);
+			right_bounds.grow(right_ref.bounds);
+		}
+		else if (left_cost <= right_cost)
+		{
+			left.push_back(ref);
+			left_bounds.grow(ref.bounds);
+		}
+		else
+		{
+			right.push_back(ref);
+			right_bounds.grow(ref.bounds);
+		}
+	}
+}
+
+void SpatialBuilder::split_reference(const Reference &ref, int axis, float position, Reference *left,
+									 Reference *right) const
+{
+	left->primID = right->primID = ref.primID;
+	left->bounds = AABB::invalid();
+	right->bounds = AABB::invalid();
+
+	// Clip every edge of the triangle against the split plane
+	const glm::vec4 *vertices = m_Vertices + ref.primID * 3;
+	glm::vec3 v1 = glm::vec3(vertices[2]);
+	for (int i = 0; i < 3; i++)
+	{
+		const glm::vec3 v0 = v1;
+		v1 = glm::vec3(vertices[i]);
+		const float p0 = v0[axis];
+		const float p1 = v1[axis];
+
+		if (p0 <= position)
+			left->bounds.grow(v0);
+		if (p0 >= position)
+			right->bounds.grow(v0);
+
+		if ((p0 < position && position < p1) || (p1 < position && position < p0))
+		{
+			const glm::vec3 t = glm::mix(v0, v1, glm::clamp((position - p0) / (p1 - p0), 0.0f, 1.0f));
+			left->bounds.grow(t);
+			right->bounds.grow(t);
+		}
+	}
+
+	left->bounds.bmax[axis] = position;
+	right->bounds.bmin[axis] = position;
+	left->bounds = left->bounds.intersection(ref.bounds);
+	right->bounds = right->bounds.intersection(ref.bounds);
+}
+
+} // namespace
+
+void spatial_sah(const AABB *aabbs, const glm::vec4 *vertices, int primCount, std::vector<BVHNode> &nodes,
+				 std::vector<unsigned int> &primIndices)
+{
+	std::vector<Reference> refs(primCount);
+	tbb::parallel_for(0, primCount, [&](int i) { refs[i] = {aabbs[i], static_cast<unsigned int>(i)}; });
+
+	AABB root_bounds = AABB::invalid();
+	for (const auto &ref : refs)
+		root_bounds.grow(ref.bounds);
+	root_bounds.offset_by(1e-5f);
+
+	SpatialBuilder builder(vertices, primCount, root_bounds);
+	builder.prim_indices.reserve(primCount);
+
+	// Node 0 is the root, node 1 is left unused so that sibling pairs start at an even index
+	builder.nodes.grow_by(2);
+	builder.nodes[0].bounds = root_bounds;
+	builder.build(refs, 0, root_bounds, 0);
+
+	nodes.assign(builder.nodes.begin(), builder.nodes.end());
+	primIndices.assign(builder.prim_indices.begin(), builder.prim_indices.end());
+}
+
+} // namespace rfw::bvh::builder
+
+#endif
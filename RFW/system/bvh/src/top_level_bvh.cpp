@@ -4,12 +4,15 @@
 #include <rfw/utils/timer.h>
 
 #include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
 
 #define USE_TOP_MBVH 1
 #define USE_MBVH 1
 #define TOP_PACKET_MBVH 1
 #define PACKET_MBVH 1
 #define REFIT 1
+#define USE_MBVH8 1 // Use 8-wide nodes for MBVH traversal
+#define STREAM_BATCH_SIZE 256 // Number of rays traversed together by intersect_stream
 
 namespace rfw::bvh
 {
@@ -38,10 +41,20 @@ void rfwMesh::set_geometry(const rfw::Mesh &mesh)
 		else
 			bvh = std::make_unique<BVHTree>(mesh.vertices, vCount);
 
-		bvh->construct(BVHTree::SpatialSAH);
-
 		mbvh = std::make_unique<MBVHTree>(bvh.get());
+
+#if CACHE_BVH
+		const uint64_t hash = cache::hash_geometry(mesh.vertices, vCount, indices, tCount);
+		if (!cache::load(hash, *bvh, *mbvh))
+		{
+			bvh->construct(BVHTree::SpatialSAH);
+			mbvh->construct();
+			cache::store(hash, *bvh, *mbvh);
+		}
+#else
+		bvh->construct(BVHTree::SpatialSAH);
 		mbvh->construct();
+#endif
 	}
 	else // Keep same BVH but refit nodes
 	{
@@ -50,55 +63,84 @@ void rfwMesh::set_geometry(const rfw::Mesh &mesh)
 		else
 			mbvh->refit(mesh.vertices);
 	}
+
+#if USE_MBVH8
+	if (rebuild)
+		mbvh8.reset();
+	else if (mbvh8)
+		mbvh8->refit();
+#endif
+
+	set_compressed(compressed);
 }
 
-void TopLevelBVH::construct_bvh()
+void rfwMesh::set_compressed(bool value)
 {
-	if (bvh.has_value())
+	compressed = value;
+	if (!mbvh) // Applied once geometry is set
+		return;
+
+	if (compressed != mbvh->is_compressed())
 	{
-		rtbvh::free_bvh(bvh.value());
-		bvh = std::nullopt;
+		mbvh->construct();
+		if (compressed)
+			mbvh->compress();
 	}
 
-	bvh = rtbvh::create_bvh(reinterpret_cast<const rtbvh::RTAABB *>(instance_aabbs.data()), instance_aabbs.size(),
-							reinterpret_cast<const float *>(centers.data()), sizeof(glm::vec4),
-							rtbvh::BVHType::BinnedSAH);
-
-	if (mbvh.has_value())
+#if USE_MBVH8
+	// Compressed meshes are traversed using their 4-wide compressed nodes
+	if (compressed)
+	{
+		mbvh8.reset();
+	}
+	else if (!mbvh8)
 	{
-		rtbvh::free_mbvh(mbvh.value());
-		mbvh = std::nullopt;
+		mbvh8 = std::make_unique<MBVH8Tree>(bvh.get());
+		mbvh8->construct();
 	}
+#endif
+}
 
-	mbvh = rtbvh::create_mbvh(bvh.value());
+// Leaves of alpha tested meshes reject the hits their alpha test finds transparent
+static HitFilter alpha_filter(const rfwMesh &mesh)
+{
+	const auto accept = [](const void *user_data, int prim_id, float u, float v) {
+		const auto *m = static_cast<const rfwMesh *>(user_data);
+		return !m->alpha_test(m->alpha_user_data, m->triangles[prim_id], u, v);
+	};
+
+	return {accept, &mesh};
+}
+
+void TopLevelBVH::construct_bvh()
+{
+	builder::binned_sah(instance_aabbs.data(), static_cast<int>(instance_aabbs.size()), bvh_nodes, prim_indices);
+	builder::collapse_mbvh(bvh_nodes, mbvh_nodes);
+#if USE_MBVH8
+	builder::collapse_mbvh8(bvh_nodes, mbvh8_nodes);
+#endif
+
+	build_cost = builder::sah_cost(bvh_nodes);
+	current_cost = build_cost;
+	count_changed = false;
 }
 
 void TopLevelBVH::refit()
 {
-	if (count_changed)
-	{
-		if (bvh.has_value())
-		{
-			rtbvh::free_bvh(bvh.value());
-			bvh = std::nullopt;
-		}
+	if (count_changed || bvh_nodes.empty())
+		return construct_bvh();
 
-		bvh = rtbvh::create_bvh(reinterpret_cast<const rtbvh::RTAABB *>(instance_aabbs.data()), instance_aabbs.size(),
-								reinterpret_cast<const float *>(centers.data()), sizeof(glm::vec4),
-								rtbvh::BVHType::BinnedSAH);
-	}
-	else
-	{
-		rtbvh::refit(reinterpret_cast<const rtbvh::RTAABB *>(instance_aabbs.data()), bvh.value());
-	}
+	builder::refit(bvh_nodes, prim_indices, instance_aabbs.data());
 
-	if (mbvh.has_value())
-	{
-		rtbvh::free_mbvh(mbvh.value());
-		mbvh = std::nullopt;
-	}
+	// Rebuild once moving instances degraded the tree too much
+	current_cost = builder::sah_cost(bvh_nodes);
+	if (current_cost > build_cost * rebuild_threshold)
+		return construct_bvh();
 
-	mbvh = rtbvh::create_mbvh(bvh.value());
+	mbvh_nodes[0].refit(mbvh_nodes.data(), prim_indices.data(), instance_aabbs.data());
+#if USE_MBVH8
+	mbvh8_nodes[0].refit(mbvh8_nodes.data(), prim_indices.data(), instance_aabbs.data());
+#endif
 }
 
 const rfw::Triangle *TopLevelBVH::intersect(const vec3 &origin, const vec3 &direction, float *t, int *primID,
@@ -107,26 +149,38 @@ const rfw::Triangle *TopLevelBVH::intersect(const vec3 &origin, const vec3 &dire
 	const simd::vector4 org = vec4(origin, 1.0f);
 	const simd::vector4 dir = vec4(direction, 0.0f);
 
-#if USE_TOP_MBVH
-	if (MBVHNode::traverse_mbvh(origin, direction, t_min, t, instID,
-								reinterpret_cast<const MBVHNode *>(mbvh.value().nodes), mbvh.value().indices,
-								[&](const int instance) {
-#else
-	if (BVHNode::traverse_bvh(origin, direction, t_min, t, instID, reinterpret_cast<const BVHNode *>(bvh.value().nodes),
-							  bvh.value().indices, [&](const int instance) {
-#endif
-									const simd::vector4 new_origin = inverse_matrices[instance] * org;
-									const simd::vector4 new_direction = inverse_matrices[instance] * dir;
+	const auto intersection = stats::instance_leaves([&](const int instance) {
+		const simd::vector4 new_origin = inverse_matrices[instance] * org;
+		const simd::vector4 new_direction = inverse_matrices[instance] * dir;
 
-									const glm::vec3 org = new_origin.vec;
-									const glm::vec3 dir = new_direction.vec;
+		const glm::vec3 org = new_origin.vec;
+		const glm::vec3 dir = new_direction.vec;
 
-#if USE_MBVH
-									return instance_meshes[instance]->mbvh->traverse(org, dir, t_min, t, primID, bary);
+		const rfwMesh &mesh = *instance_meshes[instance];
+		if (mesh.alpha_test)
+			return mesh.bvh->traverse(org, dir, t_min, t, primID, bary, alpha_filter(mesh));
+
+#if USE_MBVH && USE_MBVH8
+		if (!instance_meshes[instance]->mbvh8)
+			return instance_meshes[instance]->mbvh->traverse(org, dir, t_min, t, primID, bary);
+		return instance_meshes[instance]->mbvh8->traverse(org, dir, t_min, t, primID, bary);
+#elif USE_MBVH
+		return instance_meshes[instance]->mbvh->traverse(org, dir, t_min, t, primID, bary);
+#else
+		return instance_meshes[instance]->bvh->traverse(org, dir, t_min, t, primID, bary);
+#endif
+	});
+
+#if USE_TOP_MBVH && USE_MBVH8
+	if (MBVH8Node::traverse_mbvh(origin, direction, t_min, t, instID, mbvh8_nodes.data(), prim_indices.data(),
+								 intersection))
+#elif USE_TOP_MBVH
+	if (MBVHNode::traverse_mbvh(origin, direction, t_min, t, instID, mbvh_nodes.data(), prim_indices.data(),
+								intersection))
 #else
-								  return instance_meshes[instance]->bvh->traverse(org, dir, t_min, t, primID, bary);
+	if (BVHNode::traverse_bvh(origin, direction, t_min, t, instID, bvh_nodes.data(), prim_indices.data(),
+							  intersection))
 #endif
-								}))
 	{
 		return &instance_meshes[*instID]->triangles[*primID];
 	}
@@ -140,26 +194,41 @@ const rfw::Triangle *TopLevelBVH::intersect(const vec3 &origin, const vec3 &dire
 	const simd::vector4 org = vec4(origin, 1.0f);
 	const simd::vector4 dir = vec4(direction, 0.0f);
 
-#if USE_TOP_MBVH
-	if (MBVHNode::traverse_mbvh(origin, direction, t_min, t, instID,
-								reinterpret_cast<const MBVHNode *>(mbvh.value().nodes), mbvh.value().indices,
-								[&](const int instance) {
-#else
-	if (BVHNode::traverse_bvh(origin, direction, t_min, t, instID, reinterpret_cast<const BVHNode *>(bvh.value().nodes),
-							  bvh.value().indices, [&](const int instance) {
-#endif
-									const simd::vector4 new_origin = inverse_matrices[instance] * org;
-									const simd::vector4 new_direction = inverse_matrices[instance] * dir;
+	const auto intersection = stats::instance_leaves([&](const int instance) {
+		const simd::vector4 new_origin = inverse_matrices[instance] * org;
+		const simd::vector4 new_direction = inverse_matrices[instance] * dir;
+
+		const glm::vec3 org = new_origin.vec;
+		const glm::vec3 dir = new_direction.vec;
 
-									const glm::vec3 org = new_origin.vec;
-									const glm::vec3 dir = new_direction.vec;
+		const rfwMesh &mesh = *instance_meshes[instance];
+		if (mesh.alpha_test)
+		{
+			const HitFilter filter = alpha_filter(mesh);
+			return mesh.bvh->traverse(org, dir, t_min, t, primID, nullptr, filter);
+		}
 
-#if USE_MBVH
-									return instance_meshes[instance]->mbvh->traverse(org, dir, t_min, t, primID);
+#if USE_MBVH && USE_MBVH8
+		if (!instance_meshes[instance]->mbvh8)
+			return instance_meshes[instance]->mbvh->traverse(org, dir, t_min, t, primID);
+		return instance_meshes[instance]->mbvh8->traverse(org, dir, t_min, t, primID);
+#elif USE_MBVH
+		return instance_meshes[instance]->mbvh->traverse(org, dir, t_min, t, primID);
+#else
+		return instance_meshes[instance]->bvh->traverse(org, dir, t_min, t, primID);
+#endif
+	});
+
+#if USE_TOP_MBVH && USE_MBVH8
+	if (MBVH8Node::traverse_mbvh(origin, direction, t_min, t, instID, mbvh8_nodes.data(), prim_indices.data(),
+								 intersection))
+#elif USE_TOP_MBVH
+	if (MBVHNode::traverse_mbvh(origin, direction, t_min, t, instID, mbvh_nodes.data(), prim_indices.data(),
+								intersection))
 #else
-								  return instance_meshes[instance]->bvh->traverse(org, dir, t_min, t, primID);
+	if (BVHNode::traverse_bvh(origin, direction, t_min, t, instID, bvh_nodes.data(), prim_indices.data(),
+							  intersection))
 #endif
-								}))
 	{
 		return &instance_meshes[*instID]->triangles[*primID];
 	}
@@ -169,122 +238,274 @@ const rfw::Triangle *TopLevelBVH::intersect(const vec3 &origin, const vec3 &dire
 
 bool TopLevelBVH::is_occluded(const vec3 &origin, const vec3 &direction, float t_max, float t_min) const
 {
+	const auto intersection = stats::instance_leaves([&](const int instance) {
+		const vec3 new_origin = inverse_matrices[instance] * vec4(origin, 1);
+		const vec3 new_direction = inverse_matrices[instance] * vec4(direction, 0);
+
+		const rfwMesh &mesh = *instance_meshes[instance];
+		if (mesh.alpha_test)
+			return mesh.bvh->traverse_shadow(new_origin, new_direction, t_min, t_max, alpha_filter(mesh));
 
-#if USE_TOP_MBVH
-	return MBVHNode::traverse_mbvh_shadow(
-		origin, direction, t_min, t_max, reinterpret_cast<const MBVHNode *>(mbvh.value().nodes), mbvh.value().indices,
-		[&](const int instance) {
+#if USE_MBVH && USE_MBVH8
+		if (!instance_meshes[instance]->mbvh8)
+			return instance_meshes[instance]->mbvh->traverse_shadow(new_origin, new_direction, t_min, t_max);
+		return instance_meshes[instance]->mbvh8->traverse_shadow(new_origin, new_direction, t_min, t_max);
+#elif USE_MBVH
+		return instance_meshes[instance]->mbvh->traverse_shadow(new_origin, new_direction, t_min, t_max);
 #else
-	return BVHNode::traverse_bvh_shadow(
-		origin, direction, t_min, t_max, reinterpret_cast<const BVHNode *>(bvh.value().nodes), bvh.value().indices,
-		[&](const int instance) {
+		return instance_meshes[instance]->bvh->traverse_shadow(new_origin, new_direction, t_min, t_max);
 #endif
-			const vec3 new_origin = inverse_matrices[instance] * vec4(origin, 1);
-			const vec3 new_direction = inverse_matrices[instance] * vec4(direction, 0);
+	});
+
+#if USE_TOP_MBVH && USE_MBVH8
+	return MBVH8Node::traverse_mbvh_shadow(origin, direction, t_min, t_max, mbvh8_nodes.data(), prim_indices.data(),
+										   intersection);
+#elif USE_TOP_MBVH
+	return MBVHNode::traverse_mbvh_shadow(origin, direction, t_min, t_max, mbvh_nodes.data(), prim_indices.data(),
+										  intersection);
+#else
+	return BVHNode::traverse_bvh_shadow(origin, direction, t_min, t_max, bvh_nodes.data(), prim_indices.data(),
+										intersection);
+#endif
+}
 
-#if USE_MBVH
-			return instance_meshes[instance]->mbvh->traverse_shadow(new_origin, new_direction, t_min, t_max);
+// Spreads the lower 10 bits of v so there are 2 zero bits between every bit
+static uint expand_bits(uint v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+void TopLevelBVH::intersect_stream(const RayStreamSoA &rays, HitStreamSoA &hits) const
+{
+	const size_t count = rays.size();
+	hits.resize(count);
+	if (bvh_nodes.empty())
+	{
+		hits.t = rays.t_max;
+		std::fill(hits.prim_id.begin(), hits.prim_id.end(), -1);
+		std::fill(hits.inst_id.begin(), hits.inst_id.end(), -1);
+		return;
+	}
+
+	const AABB &bounds = bvh_nodes[0].bounds;
+	const vec3 bmin = glm::make_vec3(bounds.bmin);
+	const vec3 extent = glm::max(glm::make_vec3(bounds.bmax) - bmin, vec3(1e-6f));
+
+	// Sort rays by direction octant first and 8-bit quantized origin morton code second
+	std::vector<uint64_t> keys(count);
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, count), [&](const tbb::blocked_range<size_t> &r) {
+		for (size_t i = r.begin(), s = r.end(); i < s; i++)
+		{
+			hits.t[i] = rays.t_max[i];
+			hits.prim_id[i] = -1;
+			hits.inst_id[i] = -1;
+
+			const uint octant = (rays.dir_x[i] < 0.0f ? 1u : 0u) | (rays.dir_y[i] < 0.0f ? 2u : 0u) |
+								(rays.dir_z[i] < 0.0f ? 4u : 0u);
+			const vec3 origin = vec3(rays.origin_x[i], rays.origin_y[i], rays.origin_z[i]);
+			const uvec3 p = uvec3(glm::clamp((origin - bmin) / extent, vec3(0.0f), vec3(1.0f)) * 255.0f);
+			const uint morton = expand_bits(p.x) | (expand_bits(p.y) << 1u) | (expand_bits(p.z) << 2u);
+
+			keys[i] = (static_cast<uint64_t>((octant << 24u) | morton) << 32u) | static_cast<uint64_t>(i);
+		}
+	});
+	tbb::parallel_sort(keys.begin(), keys.end());
+
+	std::vector<int> order(count);
+	tbb::parallel_for(size_t(0), count, [&](size_t i) { order[i] = static_cast<int>(keys[i] & 0xFFFFFFFFull); });
+
+	const auto intersection = stats::instance_leaves([&](const int instance, const int ray) {
+		const simd::vector4 org = vec4(rays.origin_x[ray], rays.origin_y[ray], rays.origin_z[ray], 1.0f);
+		const simd::vector4 dir = vec4(rays.dir_x[ray], rays.dir_y[ray], rays.dir_z[ray], 0.0f);
+		const glm::vec3 new_origin = (inverse_matrices[instance] * org).vec;
+		const glm::vec3 new_direction = (inverse_matrices[instance] * dir).vec;
+		const float t_min = rays.t_min[ray];
+		float *t = &hits.t[ray];
+		int *primID = &hits.prim_id[ray];
+		const rfwMesh &mesh = *instance_meshes[instance];
+
+#if USE_MBVH && USE_MBVH8
+		bool hit;
+		if (mesh.alpha_test)
+			hit = mesh.bvh->traverse(new_origin, new_direction, t_min, t, primID, nullptr, alpha_filter(mesh));
+		else if (!instance_meshes[instance]->mbvh8)
+			hit = instance_meshes[instance]->mbvh->traverse(new_origin, new_direction, t_min, t, primID);
+		else
+			hit = instance_meshes[instance]->mbvh8->traverse(new_origin, new_direction, t_min, t, primID);
+#elif USE_MBVH
+		const bool hit =
+			mesh.alpha_test
+				? mesh.bvh->traverse(new_origin, new_direction, t_min, t, primID, nullptr, alpha_filter(mesh))
+				: instance_meshes[instance]->mbvh->traverse(new_origin, new_direction, t_min, t, primID);
+#else
+		const bool hit =
+			mesh.alpha_test
+				? mesh.bvh->traverse(new_origin, new_direction, t_min, t, primID, nullptr, alpha_filter(mesh))
+				: instance_meshes[instance]->bvh->traverse(new_origin, new_direction, t_min, t, primID);
+#endif
+		if (hit)
+			hits.inst_id[ray] = instance;
+		return hit;
+	});
+
+	// The top level is traversed using binary nodes, each node filters the active rays of its parent. The simple
+	// partitioner keeps ranges at the batch size, the default one would merge several batches into one traversal.
+	const tbb::blocked_range<size_t> batches(0, count, STREAM_BATCH_SIZE);
+	tbb::parallel_for(
+		batches,
+		[&](const tbb::blocked_range<size_t> &r) {
+			BVHNode::traverse_bvh_stream(rays, hits.t.data(), order.data() + r.begin(), static_cast<int>(r.size()),
+										 bvh_nodes.data(), prim_indices.data(), intersection);
+		},
+		tbb::simple_partitioner());
+}
+
+BVHStats TopLevelBVH::get_stats() const
+{
+#if USE_TOP_MBVH && USE_MBVH8
+	return stats::compute(mbvh8_nodes);
+#elif USE_TOP_MBVH
+	return stats::compute(mbvh_nodes);
 #else
-			return instance_meshes[instance]->bvh->traverse_shadow(new_origin, new_direction, t_min, t_max);
+	return stats::compute(bvh_nodes);
 #endif
-		});
+}
+
+// Transforms a packet of 4 rays by an affine matrix, used to move packets into the space of an instance
+static void transform_packet4(const simd::matrix4 &matrix, const float origin_x[4], const float origin_y[4],
+							  const float origin_z[4], const float direction_x[4], const float direction_y[4],
+							  const float direction_z[4], simd::vector4 new_origin[3], simd::vector4 new_direction[3])
+{
+	const simd::vector4 org_x = simd::vector4(origin_x);
+	const simd::vector4 org_y = simd::vector4(origin_y);
+	const simd::vector4 org_z = simd::vector4(origin_z);
+
+	const simd::vector4 dir_x = simd::vector4(direction_x);
+	const simd::vector4 dir_y = simd::vector4(direction_y);
+	const simd::vector4 dir_z = simd::vector4(direction_z);
+
+	for (int i = 0; i < 3; i++)
+	{
+		const simd::vector4 m0 = matrix.matrix[0][i];
+		const simd::vector4 m1 = matrix.matrix[1][i];
+		const simd::vector4 m2 = matrix.matrix[2][i];
+		const simd::vector4 m3 = matrix.matrix[3][i];
+
+		new_origin[i] = m0 * org_x + m1 * org_y + m2 * org_z + m3;
+		new_direction[i] = m0 * dir_x + m1 * dir_y + m2 * dir_z;
+	}
+}
+
+int TopLevelBVH::is_occluded4(const float origin_x[4], const float origin_y[4], const float origin_z[4],
+							  const float direction_x[4], const float direction_y[4], const float direction_z[4],
+							  const float t_max[4], float t_min, int active_mask) const
+{
+	if (bvh_nodes.empty() || active_mask == 0)
+		return 0;
+
+	const auto intersection = stats::instance_leaves([&](const int instance, int mask) {
+		simd::vector4 new_origin[3], new_direction[3];
+		transform_packet4(inverse_matrices[instance], origin_x, origin_y, origin_z, direction_x, direction_y,
+						  direction_z, new_origin, new_direction);
+
+		const rfwMesh &mesh = *instance_meshes[instance];
+		if (mesh.alpha_test)
+		{
+			// Alpha tested meshes are traversed one ray at a time, hits are passed through the alpha test
+			const HitFilter filter = alpha_filter(mesh);
+			int occluded = 0;
+			for (int i = 0; i < 4; i++)
+			{
+				const vec3 org = vec3(new_origin[0][i], new_origin[1][i], new_origin[2][i]);
+				const vec3 dir = vec3(new_direction[0][i], new_direction[1][i], new_direction[2][i]);
+				if ((mask & (1 << i)) && mesh.bvh->traverse_shadow(org, dir, t_min, t_max[i], filter))
+					occluded |= 1 << i;
+			}
+			return occluded;
+		}
+
+		return instance_meshes[instance]->bvh->traverse_shadow4(
+			reinterpret_cast<float *>(&new_origin[0]), reinterpret_cast<float *>(&new_origin[1]),
+			reinterpret_cast<float *>(&new_origin[2]), reinterpret_cast<float *>(&new_direction[0]),
+			reinterpret_cast<float *>(&new_direction[1]), reinterpret_cast<float *>(&new_direction[2]), t_min, t_max,
+			mask);
+	});
+
+	return BVHNode::traverse_bvh_shadow4(origin_x, origin_y, origin_z, direction_x, direction_y, direction_z, t_max,
+										 active_mask, bvh_nodes.data(), prim_indices.data(), intersection);
+}
+
+int TopLevelBVH::is_occluded8(const float origin_x[8], const float origin_y[8], const float origin_z[8],
+							  const float direction_x[8], const float direction_y[8], const float direction_z[8],
+							  const float t_max[8], float t_min, int active_mask) const
+{
+	// Both halves are traversed as separate 4-wide packets, instances are transformed 4 rays at a time
+	const int lower = is_occluded4(origin_x, origin_y, origin_z, direction_x, direction_y, direction_z, t_max, t_min,
+								   active_mask & 0xF);
+	const int upper = is_occluded4(origin_x + 4, origin_y + 4, origin_z + 4, direction_x + 4, direction_y + 4,
+								   direction_z + 4, t_max + 4, t_min, (active_mask >> 4) & 0xF);
+	return lower | (upper << 4);
 }
 
 int TopLevelBVH::intersect4(float origin_x[4], float origin_y[4], float origin_z[4], float direction_x[4],
 							float direction_y[4], float direction_z[4], float t[4], int primID[4], int instID[4],
 							float t_min) const
 {
-	const auto intersection = [&](const int instance, __m128 *inst_mask) {
-		const auto &matrix = this->inverse_matrices[instance];
-
-		const simd::vector4 org_x = simd::vector4(origin_x);
-		const simd::vector4 org_y = simd::vector4(origin_y);
-		const simd::vector4 org_z = simd::vector4(origin_z);
-		const simd::vector4 org_w = simd::ONE4;
-
-		const simd::vector4 dir_x = simd::vector4(direction_x);
-		const simd::vector4 dir_y = simd::vector4(direction_y);
-		const simd::vector4 dir_z = simd::vector4(direction_z);
-
-		const simd::vector4 m0_0 = matrix.matrix[0][0];
-		// _mm_shuffle_ps(matrix.cols[0], matrix.cols[0], _MM_SHUFFLE(0, 0, 0, 0));
-		const simd::vector4 m0_1 = matrix.matrix[0][1];
-		// _mm_shuffle_ps(matrix.cols[0], matrix.cols[0], _MM_SHUFFLE(1, 1, 1, 1));
-		const simd::vector4 m0_2 = matrix.matrix[0][2];
-		// _mm_shuffle_ps(matrix.cols[0], matrix.cols[0], _MM_SHUFFLE(2, 2, 2, 2));
-
-		simd::vector4 new_origin_x = m0_0 * org_x;
-		simd::vector4 new_origin_y = m0_1 * org_x;
-		simd::vector4 new_origin_z = m0_2 * org_x;
-
-		simd::vector4 new_direction_x = m0_0 * dir_x;
-		simd::vector4 new_direction_y = m0_1 * dir_x;
-		simd::vector4 new_direction_z = m0_2 * dir_x;
-
-		const simd::vector4 m1_0 = matrix.matrix[1][0];
-		// _mm_shuffle_ps(matrix.cols[1], matrix.cols[1], _MM_SHUFFLE(0, 0, 0, 0));
-		const simd::vector4 m1_1 = matrix.matrix[1][1];
-		// _mm_shuffle_ps(matrix.cols[1], matrix.cols[1], _MM_SHUFFLE(1, 1, 1, 1));
-		const simd::vector4 m1_2 = matrix.matrix[1][2];
-		// _mm_shuffle_ps(matrix.cols[1], matrix.cols[1], _MM_SHUFFLE(3, 2, 2, 2));
-
-		new_origin_x += m1_0 * org_y;
-		new_origin_y += m1_1 * org_y;
-		new_origin_z += m1_2 * org_y;
-
-		new_direction_x += m1_0 * dir_y;
-		new_direction_y += m1_1 * dir_y;
-		new_direction_z += m1_2 * dir_y;
-
-		const simd::vector4 m2_0 = matrix.matrix[2][0];
-		// _mm_shuffle_ps(matrix.cols[2], matrix.cols[2], _MM_SHUFFLE(0, 0, 0, 0));
-		const simd::vector4 m2_1 = matrix.matrix[2][1];
-		// _mm_shuffle_ps(matrix.cols[2], matrix.cols[2], _MM_SHUFFLE(1, 1, 1, 1));
-		const simd::vector4 m2_2 = matrix.matrix[2][2];
-		// _mm_shuffle_ps(matrix.cols[2], matrix.cols[2], _MM_SHUFFLE(3, 2, 2, 2));
-
-		new_origin_x += m2_0 * org_z;
-		new_origin_y += m2_1 * org_z;
-		new_origin_z += m2_2 * org_z;
-
-		new_direction_x += m2_0 * dir_z;
-		new_direction_y += m2_1 * dir_z;
-		new_direction_z += m2_2 * dir_z;
-
-		const simd::vector4 m3_0 = matrix.matrix[3][0];
-		// _mm_shuffle_ps(matrix.cols[3], matrix.cols[3], _MM_SHUFFLE(0, 0, 0, 0));
-		const simd::vector4 m3_1 = matrix.matrix[3][1];
-		// _mm_shuffle_ps(matrix.cols[3], matrix.cols[3], _MM_SHUFFLE(1, 1, 1, 1));
-		const simd::vector4 m3_2 = matrix.matrix[3][2];
-		// _mm_shuffle_ps(matrix.cols[3], matrix.cols[3], _MM_SHUFFLE(3, 2, 2, 2));
-
-		new_origin_x += m3_0 * org_w;
-		new_origin_y += m3_1 * org_w;
-		new_origin_z += m3_2 * org_w;
-
-		const float *ox = reinterpret_cast<float *>(&new_origin_x);
-		const float *oy = reinterpret_cast<float *>(&new_origin_y);
-		const float *oz = reinterpret_cast<float *>(&new_origin_z);
-		const float *dx = reinterpret_cast<float *>(&new_direction_x);
-		const float *dy = reinterpret_cast<float *>(&new_direction_y);
-		const float *dz = reinterpret_cast<float *>(&new_direction_z);
-
-#if PACKET_MBVH
+	const auto intersection = stats::instance_leaves([&](const int instance, __m128 *inst_mask) {
+		simd::vector4 new_origin[3], new_direction[3];
+		transform_packet4(inverse_matrices[instance], origin_x, origin_y, origin_z, direction_x, direction_y,
+						  direction_z, new_origin, new_direction);
+
+		const float *ox = reinterpret_cast<float *>(&new_origin[0]);
+		const float *oy = reinterpret_cast<float *>(&new_origin[1]);
+		const float *oz = reinterpret_cast<float *>(&new_origin[2]);
+		const float *dx = reinterpret_cast<float *>(&new_direction[0]);
+		const float *dy = reinterpret_cast<float *>(&new_direction[1]);
+		const float *dz = reinterpret_cast<float *>(&new_direction[2]);
+
+		const rfwMesh &mesh = *instance_meshes[instance];
+		if (mesh.alpha_test)
+		{
+			// Alpha tested meshes are traversed one ray at a time, hits are passed through the alpha test
+			const HitFilter filter = alpha_filter(mesh);
+			int hitMask = 0;
+			for (int i = 0; i < 4; i++)
+			{
+				const vec3 org = vec3(ox[i], oy[i], oz[i]);
+				const vec3 dir = vec3(dx[i], dy[i], dz[i]);
+				if (mesh.bvh->traverse(org, dir, t_min, &t[i], &primID[i], nullptr, filter))
+					hitMask |= 1 << i;
+			}
+			*inst_mask = _mm_castsi128_ps(_mm_set_epi32(hitMask & 8 ? ~0 : 0, hitMask & 4 ? ~0 : 0,
+														 hitMask & 2 ? ~0 : 0, hitMask & 1 ? ~0 : 0));
+			return hitMask;
+		}
+
+#if PACKET_MBVH && USE_MBVH8
+		if (!instance_meshes[instance]->mbvh8)
+			return instance_meshes[instance]->mbvh->traverse4(ox, oy, oz, dx, dy, dz, t, primID, t_min, inst_mask);
+		return instance_meshes[instance]->mbvh8->traverse4(ox, oy, oz, dx, dy, dz, t, primID, t_min, inst_mask);
+#elif PACKET_MBVH
 		return instance_meshes[instance]->mbvh->traverse4(ox, oy, oz, dx, dy, dz, t, primID, t_min, inst_mask);
 #else
 		return instance_meshes[instance]->bvh->traverse4(ox, oy, oz, dx, dy, dz, t, primID, t_min, inst_mask);
 #endif
-	};
+	});
 
 	__m128 mask = _mm_setzero_ps();
-#if TOP_PACKET_MBVH
+#if TOP_PACKET_MBVH && USE_MBVH8
+	return MBVH8Node::traverse_mbvh4(origin_x, origin_y, origin_z, direction_x, direction_y, direction_z, t, instID,
+									 mbvh8_nodes.data(), prim_indices.data(), &mask, intersection);
+#elif TOP_PACKET_MBVH
 	return MBVHNode::traverse_mbvh4(origin_x, origin_y, origin_z, direction_x, direction_y, direction_z, t, instID,
-									reinterpret_cast<const MBVHNode *>(mbvh.value().nodes), mbvh.value().indices, &mask,
-									intersection);
+									mbvh_nodes.data(), prim_indices.data(), &mask, intersection);
 #else
 	return BVHNode::traverse_bvh4(origin_x, origin_y, origin_z, direction_x, direction_y, direction_z, t, instID,
-								  reinterpret_cast<const BVHNode *>(bvh.value().nodes), bvh.value().indices, &mask,
-								  intersection);
+								  bvh_nodes.data(), prim_indices.data(), &mask, intersection);
 #endif
 }
 
@@ -301,7 +522,6 @@ void TopLevelBVH::set_instance(size_t idx, glm::mat4 transform, rfwMesh *tree, A
 		matrices.push_back(m);
 		normal_matrices.push_back(m);
 		inverse_matrices.push_back(m);
-		centers.emplace_back();
 	}
 
 	aabbs[idx] = boundingBox;
@@ -310,7 +530,6 @@ void TopLevelBVH::set_instance(size_t idx, glm::mat4 transform, rfwMesh *tree, A
 	inverse_matrices[idx] = inverse(transform);
 	normal_matrices[idx] = mat4(transpose(inverse(mat3(transform))));
 	instance_aabbs[idx] = calculate_world_bounds(boundingBox, matrices[idx]);
-	centers[idx] = instance_aabbs[idx].center().vec;
 }
 
 AABB TopLevelBVH::calculate_world_bounds(const AABB &originalBounds, const simd::matrix4 &matrix)
@@ -1,8 +1,7 @@
 #ifndef COMPAT_H
 #define COMPAT_H
 
-#include "tools.h"
-#include "../Settings.h"
+#include "../context/settings.h"
 
 #define INVPI 0.318309886183790671537767526745028724f
 #define PI 3.14159265358979323846264338327950288f
@@ -19,7 +18,7 @@
 #define FLT_MAX 3.402823466e+38f
 #endif
 #ifndef FLT_MIN
-#define FLT_MIN 1 .175494351e-38f
+#define FLT_MIN 1.175494351e-38f
 #endif
 
 #if defined(__CUDACC__) || defined(__NVCC__) || defined(_WIN32) || defined(__linux__)
@@ -38,6 +37,25 @@ using namespace glm;
 #endif
 #define REFERENCE_OF(x) x &
 
+#if !defined(__CUDACC__) && !defined(__NVCC__)
+#include <cstring>
+
+// Host versions of the CUDA bit cast intrinsics
+INLINE_FUNC float __uint_as_float(const uint value)
+{
+	float result;
+	memcpy(&result, &value, sizeof(float));
+	return result;
+}
+
+INLINE_FUNC uint __float_as_uint(const float value)
+{
+	uint result;
+	memcpy(&result, &value, sizeof(uint));
+	return result;
+}
+#endif
+
 template <uint S> INLINE_FUNC float char2flt(const unsigned int value)
 {
 	constexpr float scale = (1.0f / 255.0f);
@@ -87,4 +105,7 @@ struct ShadingData
 #define REFERENCE_OF(x) inout x
 #endif
 
-#endif
\ No newline at end of file
+// Tools depend on the definitions above
+#include "tools.h"
+
+#endif
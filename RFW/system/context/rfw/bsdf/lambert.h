@@ -49,7 +49,7 @@ INLINE_FUNC glm::vec3 SampleBSDF(const ShadingData shadingData, const glm::vec3
 		}
 		else
 		{
-			wi = normalize(tangentToWorld(DiffuseReflectionCosWeighted(RandomFloat(seed), RandomFloat(seed)), T, B, iN));
+			wi = normalize(tangentToWorld(DiffuseReflectionCosWeighted(RandomFloat(seed), RandomFloat(seed)), iN, T, B));
 			if (dot(N, wi) <= 0.0f)
 			{
 				pdf = 0.0f;
@@ -62,7 +62,7 @@ INLINE_FUNC glm::vec3 SampleBSDF(const ShadingData shadingData, const glm::vec3
 	}
 	else
 	{
-		wi = normalize(tangentToWorld(DiffuseReflectionCosWeighted(RandomFloat(seed), RandomFloat(seed)), T, B, iN));
+		wi = normalize(tangentToWorld(DiffuseReflectionCosWeighted(RandomFloat(seed), RandomFloat(seed)), iN, T, B));
 		if (dot(N, wi) <= 0.0f)
 		{
 			pdf = 0.0f;
@@ -0,0 +1,56 @@
+#include "alpha_test.h"
+
+#include <cmath>
+
+namespace rfw
+{
+
+bool is_alpha_tested(const Material &material)
+{
+	return material.hasFlag(HasDiffuseMap) && (material.hasFlag(HasAlpha) || material.hasFlag(HasAlphaMap));
+}
+
+bool uses_alpha_test(const std::vector<Material> &materials, const Triangle *triangles, int triangleCount)
+{
+	for (int i = 0; triangles && i < triangleCount; i++)
+	{
+		const uint material = triangles[i].material;
+		if (material < materials.size() && is_alpha_tested(materials[material]))
+			return true;
+	}
+
+	return false;
+}
+
+bool is_transparent(const std::vector<Material> &materials, const std::vector<TextureData> &textures,
+					const Triangle &tri, float u, float v)
+{
+	const Material &material = materials[tri.material];
+	if (!is_alpha_tested(material))
+		return false;
+
+	const float tu = (1.0f - u - v) * tri.u0 + u * tri.u1 + v * tri.u2;
+	const float tv = (1.0f - u - v) * tri.v0 + u * tri.v1 + v * tri.v2;
+
+	float tx = fmod((tu + material.uoffs0) * material.uscale0, 1.0f);
+	float ty = fmod((tv + material.voffs0) * material.vscale0, 1.0f);
+
+	if (tx < 0.f)
+		tx = 1.f + tx;
+	if (ty < 0.f)
+		ty = 1.f + ty;
+
+	const auto &tex = textures[material.texaddr0];
+
+	const uint ix = uint(tx * static_cast<float>(tex.width - 1));
+	const uint iy = uint(ty * static_cast<float>(tex.height - 1));
+	const auto texel_id = static_cast<int>(iy * tex.width + ix);
+
+	if (tex.type == TextureData::FLOAT4)
+		return reinterpret_cast<vec4 *>(tex.data)[texel_id].w < 0.5f;
+
+	// RGBA
+	return (reinterpret_cast<uint *>(tex.data)[texel_id] >> 24u) < 128u;
+}
+
+} // namespace rfw
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "structs.h"
+
+#include <vector>
+
+namespace rfw
+{
+// Alpha testing shared by the CPU backends, materials with a diffuse map and an alpha channel reject hits on texels
+// with an alpha below 0.5. Alpha is read from the diffuse texture, the alpha mask of HasAlphaMap materials is not part
+// of device materials.
+bool is_alpha_tested(const Material &material);
+// Returns true if any of the triangles uses an alpha tested material
+bool uses_alpha_test(const std::vector<Material> &materials, const Triangle *triangles, int triangleCount);
+// Looks up the diffuse texel of a hit at barycentrics (u, v) of the second and third vertex of tri
+bool is_transparent(const std::vector<Material> &materials, const std::vector<TextureData> &textures,
+					const Triangle &tri, float u, float v);
+} // namespace rfw
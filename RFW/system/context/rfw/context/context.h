@@ -69,6 +69,19 @@ struct RenderStats
 
 	float animationTime;
 	float renderTime;
+
+	// BVH metrics, filled in by backends that use rfw::bvh when BVH_STATS is enabled
+	static constexpr int BVH_HISTOGRAM_SIZE = 32; // The last bucket also holds all larger values
+
+	float topLevelSAH;
+	float bottomLevelSAH; // Averages over all meshes weighted by triangle count
+	float bottomLevelEPO;
+	unsigned int bvhMaxDepth;
+	unsigned int bvhDepthHistogram[BVH_HISTOGRAM_SIZE];	   // Leaves per depth over all meshes
+	unsigned int bvhLeafSizeHistogram[BVH_HISTOGRAM_SIZE]; // Leaves per primitive count over all meshes
+
+	unsigned long long nodeVisits;
+	unsigned long long primitiveTests;
 };
 
 class RenderContext
@@ -89,6 +102,11 @@ class RenderContext
 	{
 		throw std::runtime_error("RenderContext does not support given target type.");
 	};
+	// Host memory of width * height pixels, rendering into a buffer does not require a graphics context
+	virtual void init(glm::vec4 *buffer, uint width, uint height)
+	{
+		throw std::runtime_error("RenderContext does not support given target type.");
+	};
 
 	virtual void cleanup() = 0;
 	virtual void render_frame(const rfw::Camera &camera, rfw::RenderStatus status) = 0;
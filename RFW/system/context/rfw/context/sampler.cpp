@@ -0,0 +1,59 @@
+#include "sampler.h"
+
+#include "blue_noise.h"
+
+namespace rfw
+{
+
+// Tables are 8 bit per entry
+static const auto *sobol = reinterpret_cast<const unsigned char *>(sob256_64);
+static const auto *scrambling = reinterpret_cast<const unsigned char *>(scr256_64);
+static const auto *ranking = reinterpret_cast<const unsigned char *>(rnk256_64);
+
+static inline unsigned int hash(unsigned int s)
+{
+	s = (s ^ 61u) ^ (s >> 16u);
+	s *= 9u;
+	s = s ^ (s >> 4u);
+	s *= 0x27d4eb2du;
+	s = s ^ (s >> 15u);
+	return s;
+}
+
+BlueNoiseSampler::BlueNoiseSampler(int x, int y, unsigned int sample, int dimension)
+	: m_Sample(sample), m_Dimension(dimension)
+{
+	const int offset = ((x & 127) + (y & 127) * 128) * OPTIMIZED_DIMENSIONS;
+	m_Ranking = ranking + offset;
+	m_Scrambling = scrambling + offset;
+	m_Scramble = sample < SAMPLE_COUNT ? 0 : hash(sample / SAMPLE_COUNT);
+}
+
+float BlueNoiseSampler::sample(int x, int y, unsigned int sample, int dimension)
+{
+	return BlueNoiseSampler(x, y, sample).get(dimension);
+}
+
+float BlueNoiseSampler::get(int dimension) const { return static_cast<float>(value(dimension)) * 2.3283064365387e-10f; }
+
+unsigned int BlueNoiseSampler::rand_uint() { return value(m_Dimension++); }
+
+unsigned int BlueNoiseSampler::value(int dimension) const
+{
+	dimension &= DIMENSION_COUNT - 1;
+	const int optimized = dimension & (OPTIMIZED_DIMENSIONS - 1);
+
+	const unsigned int rankedSample = (m_Sample & (SAMPLE_COUNT - 1)) ^ m_Ranking[optimized];
+	unsigned int sequence = sobol[dimension + rankedSample * DIMENSION_COUNT] ^ m_Scrambling[optimized];
+
+	// The first 256 samples return the centre of their stratum, exactly like the GPU kernels
+	if (m_Sample < SAMPLE_COUNT)
+		return (sequence << 24u) | 0x800000u;
+
+	// Xor-scrambling keeps the stratification of the sequence, the remaining bits are jittered
+	const unsigned int scramble = hash(m_Scramble ^ (static_cast<unsigned int>(dimension) * 0x9E3779B9u));
+	sequence ^= scramble >> 24u;
+	return (sequence << 24u) | (scramble & 0xFFFFFFu);
+}
+
+} // namespace rfw
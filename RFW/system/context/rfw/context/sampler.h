@@ -0,0 +1,42 @@
+#pragma once
+
+#include <rfw/utils/rng.h>
+
+namespace rfw
+{
+
+/*
+ * CPU version of the blueNoiseSampler of the GPU kernels: a Sobol sequence that is ranked and scrambled per pixel,
+ * which distributes the error of neighbouring pixels as blue noise. The tables of blue_noise.h are read directly, a
+ * dimension is a single byte and all optimized dimensions of a pixel share a cache line. Only the first 8 dimensions
+ * are optimized and the sequence holds 256 samples, later samples restart it with a different scramble.
+ * As rng, every call returns the next dimension of the sample.
+ */
+class BlueNoiseSampler : public utils::rng
+{
+  public:
+	static constexpr unsigned int SAMPLE_COUNT = 256;
+	static constexpr int DIMENSION_COUNT = 256;
+	static constexpr int OPTIMIZED_DIMENSIONS = 8;
+
+	BlueNoiseSampler(int x, int y, unsigned int sample, int dimension = 0);
+
+	// Value of a single dimension of (x, y, sample)
+	static float sample(int x, int y, unsigned int sample, int dimension);
+
+	// Value of a dimension, does not advance the sampler
+	[[nodiscard]] float get(int dimension) const;
+
+	unsigned int rand_uint() override final;
+
+  private:
+	[[nodiscard]] unsigned int value(int dimension) const;
+
+	const unsigned char *m_Ranking;
+	const unsigned char *m_Scrambling;
+	unsigned int m_Sample;
+	unsigned int m_Scramble;
+	int m_Dimension;
+};
+
+} // namespace rfw
@@ -11,6 +11,8 @@
 #define BILINEAR 1
 #define BLUENOISE 1
 #define CACHE_SKYBOX 1
+#define CACHE_BVH 1
+#define BVH_STATS 0 // Count node visits and primitive tests during BVH traversal
 #define TEST_SKY 0
 #define IBL_WIDTH 512
 #define IBL_HEIGHT 256
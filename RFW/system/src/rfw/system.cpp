@@ -31,15 +31,9 @@ extern "C"
 using namespace rfw;
 using namespace utils;
 
-rfw::system::system()
-	: m_ThreadPool(std::thread::hardware_concurrency()),
-	  m_ToneMapShader("shaders/draw-tex.vert", "shaders/tone-map.frag")
+rfw::system::system() : m_ThreadPool(std::thread::hardware_concurrency())
 {
 	m_Materials = new material_list();
-	glGenFramebuffers(1, &m_FrameBufferID);
-	m_ToneMapShader.bind();
-	m_ToneMapShader.set_uniform("view", mat4(1.0f));
-	m_ToneMapShader.unbind();
 
 	m_TargetWidth = 0;
 	m_TargetHeight = 0;
@@ -58,10 +52,24 @@ rfw::system::~system()
 	delete m_Materials;
 	m_Materials = nullptr;
 
-	glDeleteFramebuffers(1, &m_FrameBufferID);
+	if (m_FrameBufferID)
+		glDeleteFramebuffers(1, &m_FrameBufferID);
 	m_FrameBufferID = 0;
 }
 
+// GL resources are only created for GL targets, headless systems never touch GL
+void system::init_gl_target()
+{
+	if (m_ToneMapShader)
+		return;
+
+	glGenFramebuffers(1, &m_FrameBufferID);
+	m_ToneMapShader = std::make_unique<utils::shader>("shaders/draw-tex.vert", "shaders/tone-map.frag");
+	m_ToneMapShader->bind();
+	m_ToneMapShader->set_uniform("view", mat4(1.0f));
+	m_ToneMapShader->unbind();
+}
+
 void *LoadModule(const char *file)
 {
 	void *module = nullptr;
@@ -155,6 +163,8 @@ void rfw::system::load_render_api(std::string name)
 	}
 
 	m_Context = m_CreateContextFunction();
+	if (!m_BVHCacheDirectory.empty())
+		m_Context->set_setting(RenderSetting("bvh_cache_directory", m_BVHCacheDirectory));
 }
 
 void rfw::system::unload_render_api()
@@ -181,8 +191,10 @@ void system::set_target(GLuint *textureID, uint width, uint height)
 {
 	assert(textureID != nullptr && *textureID != 0);
 
+	init_gl_target();
 	m_Context->init(textureID, width, height);
 	m_TargetID = *textureID;
+	m_TargetBuffer = nullptr;
 	m_TargetWidth = width;
 	m_TargetHeight = height;
 
@@ -201,6 +213,8 @@ void system::set_target(rfw::utils::texture *texture)
 
 	if (texture == nullptr)
 		throw std::runtime_error("Invalid texture.");
+
+	init_gl_target();
 	try
 	{
 		m_Context->init(&texture->m_ID, texture->get_width(), texture->get_height());
@@ -211,6 +225,7 @@ void system::set_target(rfw::utils::texture *texture)
 	}
 
 	m_TargetID = texture->m_ID;
+	m_TargetBuffer = nullptr;
 	m_TargetWidth = texture->get_width();
 	m_TargetHeight = texture->get_height();
 
@@ -222,6 +237,27 @@ void system::set_target(rfw::utils::texture *texture)
 	CheckGL();
 }
 
+void system::set_target(glm::vec4 *buffer, uint width, uint height)
+{
+	assert(buffer != nullptr);
+
+	if (buffer == nullptr)
+		throw std::runtime_error("Invalid buffer.");
+	try
+	{
+		m_Context->init(buffer, width, height);
+	}
+	catch (const std::exception &e)
+	{
+		FAILURE("%s", e.what());
+	}
+
+	m_TargetID = 0;
+	m_TargetBuffer = buffer;
+	m_TargetWidth = width;
+	m_TargetHeight = height;
+}
+
 void system::set_skybox(std::string filename)
 {
 
@@ -681,7 +717,7 @@ int system::add_material(const glm::vec3 &color, float roughness)
 
 void rfw::system::render_frame(const Camera &camera, RenderStatus status, bool toneMap)
 {
-	assert(m_TargetID > 0);
+	assert(m_TargetID > 0 || m_TargetBuffer != nullptr);
 	if (m_UpdateThread.valid())
 		m_UpdateThread.get();
 
@@ -691,15 +727,16 @@ void rfw::system::render_frame(const Camera &camera, RenderStatus status, bool t
 	timer t = {};
 	m_Context->render_frame(camera, status);
 
-	if (toneMap)
+	// Buffer targets receive linear HDR output
+	if (toneMap && m_TargetID > 0)
 	{
 		glBindFramebuffer(GL_FRAMEBUFFER, m_FrameBufferID);
 		glDisable(GL_DEPTH_TEST);
 		CheckGL();
 
-		m_ToneMapShader.bind();
-		m_ToneMapShader.set_uniform("tex", 0);
-		m_ToneMapShader.set_uniform("params", vec4(camera.contrast, camera.brightness, 0, 0));
+		m_ToneMapShader->bind();
+		m_ToneMapShader->set_uniform("tex", 0);
+		m_ToneMapShader->set_uniform("params", vec4(camera.contrast, camera.brightness, 0, 0));
 		CheckGL();
 
 		glActiveTexture(GL_TEXTURE0);
@@ -708,7 +745,7 @@ void rfw::system::render_frame(const Camera &camera, RenderStatus status, bool t
 
 		draw_quad();
 		CheckGL();
-		m_ToneMapShader.unbind();
+		m_ToneMapShader->unbind();
 
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	}
@@ -848,6 +885,14 @@ void system::set_setting(const rfw::RenderSetting &setting) const
 		WARNING("Setting was set while no context was loaded yet.");
 }
 
+void system::set_bvh_cache_directory(std::string directory)
+{
+	// Backends link their own copy of the BVH library, the directory is forwarded once a context is loaded
+	m_BVHCacheDirectory = std::move(directory);
+	if (m_Context)
+		m_Context->set_setting(RenderSetting("bvh_cache_directory", m_BVHCacheDirectory));
+}
+
 #if 0
 AABB rfw::system::calculateSceneBounds() const
 {
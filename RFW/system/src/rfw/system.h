@@ -86,6 +86,8 @@ class system
 
 	void set_target(GLuint *textureID, uint width, uint height);
 	void set_target(rfw::utils::texture *texture);
+	// Renders linear HDR pixels into host memory without tone mapping, no GL context is required
+	void set_target(glm::vec4 *buffer, uint width, uint height);
 	void set_skybox(std::string filename);
 	void set_skybox(rfw::utils::array_proxy<vec3> data, int width, int height);
 	void synchronize();
@@ -123,6 +125,8 @@ class system
 	void set_light_radiance(const light_ref &reference, const glm::vec3 &radiance);
 	AvailableRenderSettings get_available_settings() const;
 	void set_setting(const rfw::RenderSetting &setting) const;
+	// Directory the backends store mesh BVHs in so later loads skip the builder, an empty path disables the cache
+	void set_bvh_cache_directory(std::string directory);
 
 	void set_probe_index(glm::uvec2 pixelIdx);
 	glm::uvec2 get_probe_index() const;
@@ -145,9 +149,13 @@ class system
 
   private:
 	void update_area_lights();
+	// GL resources are only created for GL targets, headless systems never touch GL
+	void init_gl_target();
 
 	utils::thread_pool m_ThreadPool;
+
 	GLuint m_TargetID = 0, m_FrameBufferID = 0;
+	glm::vec4 *m_TargetBuffer = nullptr;
 	GLuint m_TargetWidth = 0, m_TargetHeight = 0;
 	size_t m_EmptyMeshSlots = 0;
 	size_t m_EmptyInstanceSlots = 0;
@@ -199,7 +207,8 @@ class system
 	std::vector<SpotLight> m_SpotLights;
 	std::vector<DirectionalLight> m_DirectionalLights;
 
-	utils::shader m_ToneMapShader;
+	std::unique_ptr<utils::shader> m_ToneMapShader;
+	std::string m_BVHCacheDirectory;
 
 	CreateContextFunction m_CreateContextFunction = nullptr;
 	DestroyContextFunction m_DestroyContextFunction = nullptr;
@@ -10,4 +10,6 @@
 #include "utils/Time.h"
 #include "utils/rng.h"
 #include "utils/xor128.h"
+#include "utils/sample_rng.h"
+#include "utils/alias_table.h"
 #include "utils/mersenne_twister.h"
\ No newline at end of file
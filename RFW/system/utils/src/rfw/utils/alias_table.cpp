@@ -0,0 +1,62 @@
+#include "alias_table.h"
+
+namespace rfw::utils
+{
+
+void alias_table::build(const float *weights, size_t count)
+{
+	m_Entries.resize(count);
+	if (count == 0)
+		return;
+
+	double sum = 0.0;
+	for (size_t i = 0; i < count; i++)
+		sum += weights[i];
+
+	const bool uniform = sum <= 0.0;
+	const double n = static_cast<double>(count);
+
+	// Scaled probabilities, an average index has probability 1
+	std::vector<double> scaled(count);
+	std::vector<unsigned int> small, large;
+	small.reserve(count);
+	large.reserve(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const double p = uniform ? 1.0 / n : static_cast<double>(weights[i]) / sum;
+		m_Entries[i].pdf = static_cast<float>(p);
+		m_Entries[i].alias = static_cast<unsigned int>(i);
+		scaled[i] = p * n;
+		if (scaled[i] < 1.0)
+			small.push_back(static_cast<unsigned int>(i));
+		else
+			large.push_back(static_cast<unsigned int>(i));
+	}
+
+	// Every underfull index is topped up by an overfull one
+	while (!small.empty() && !large.empty())
+	{
+		const unsigned int s = small.back();
+		small.pop_back();
+		const unsigned int l = large.back();
+
+		m_Entries[s].threshold = static_cast<float>(scaled[s]);
+		m_Entries[s].alias = l;
+
+		scaled[l] -= 1.0 - scaled[s];
+		if (scaled[l] < 1.0)
+		{
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+
+	// Remaining indices are full up to rounding errors
+	for (const unsigned int i : large)
+		m_Entries[i].threshold = 1.0f;
+	for (const unsigned int i : small)
+		m_Entries[i].threshold = 1.0f;
+}
+
+} // namespace rfw::utils
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace rfw::utils
+{
+// Walker's alias method: picks an index with a probability proportional to its weight in constant time
+class alias_table
+{
+  public:
+	alias_table() = default;
+
+	// Weights must be non-negative, when all weights are zero indices are picked uniformly
+	void build(const float *weights, size_t count);
+	void clear() { m_Entries.clear(); }
+
+	// Picks an index using a single uniform random number in [0, 1)
+	[[nodiscard]] size_t sample(float r) const
+	{
+		const float scaled = r * static_cast<float>(m_Entries.size());
+		size_t index = static_cast<size_t>(scaled);
+		if (index >= m_Entries.size())
+			index = m_Entries.size() - 1;
+
+		const entry &e = m_Entries[index];
+		return (scaled - static_cast<float>(index)) < e.threshold ? index : e.alias;
+	}
+
+	// Probability of picking an index
+	[[nodiscard]] float pdf(size_t index) const { return m_Entries[index].pdf; }
+
+	[[nodiscard]] size_t size() const { return m_Entries.size(); }
+	[[nodiscard]] bool empty() const { return m_Entries.empty(); }
+
+  private:
+	struct entry
+	{
+		float threshold;
+		unsigned int alias;
+		float pdf;
+	};
+
+	std::vector<entry> m_Entries;
+};
+} // namespace rfw::utils
@@ -3,4 +3,5 @@
 #include "gl/check.h"
 #include "gl/buffer.h"
 #include "gl/shader.h"
-#include "gl/texture.h"
\ No newline at end of file
+#include "gl/texture.h"
+#include "gl/pixel_buffer_ring.h"
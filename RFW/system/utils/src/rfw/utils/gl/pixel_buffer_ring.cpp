@@ -0,0 +1,112 @@
+#include "pixel_buffer_ring.h"
+
+#include "check.h"
+
+namespace rfw::utils
+{
+
+pixel_buffer_ring::~pixel_buffer_ring() { cleanup(); }
+
+void pixel_buffer_ring::resize(size_t sizeInBytes)
+{
+	cleanup();
+
+	m_Persistent = GLEW_ARB_buffer_storage;
+	m_Size = sizeInBytes;
+	m_Current = 0;
+
+	glGenBuffers(SIZE, m_Buffers);
+	for (int i = 0; i < SIZE; i++)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_Buffers[i]);
+		if (m_Persistent)
+		{
+			constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, sizeInBytes, nullptr, flags);
+			m_Mapped[i] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, sizeInBytes, flags);
+		}
+		else
+		{
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, sizeInBytes, nullptr, GL_STREAM_DRAW);
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	CheckGL();
+}
+
+void pixel_buffer_ring::cleanup()
+{
+	if (m_Buffers[0] == 0)
+		return;
+
+	for (int i = 0; i < SIZE; i++)
+	{
+		wait(i);
+		if (m_Mapped[i])
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_Buffers[i]);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			m_Mapped[i] = nullptr;
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	glDeleteBuffers(SIZE, m_Buffers);
+	for (int i = 0; i < SIZE; i++)
+		m_Buffers[i] = 0;
+	m_Size = 0;
+	CheckGL();
+}
+
+void *pixel_buffer_ring::acquire()
+{
+	m_Current = (m_Current + 1) % SIZE;
+	wait(m_Current);
+
+	if (!m_Persistent)
+	{
+		// The fence already guarantees GL is done with the buffer
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_Buffers[m_Current]);
+		m_Mapped[m_Current] =
+			glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, m_Size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		CheckGL();
+	}
+
+	return m_Mapped[m_Current];
+}
+
+void pixel_buffer_ring::upload(GLuint textureID, int width, int height, GLenum format, GLenum type)
+{
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_Buffers[m_Current]);
+	if (!m_Persistent)
+	{
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		m_Mapped[m_Current] = nullptr;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type, nullptr);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	m_Fences[m_Current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	CheckGL();
+}
+
+void pixel_buffer_ring::wait(int index)
+{
+	if (!m_Fences[index])
+		return;
+
+	// Flushing makes sure the fence is eventually signaled
+	GLenum result;
+	do
+	{
+		result = glClientWaitSync(m_Fences[index], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+	} while (result == GL_TIMEOUT_EXPIRED);
+
+	glDeleteSync(m_Fences[index]);
+	m_Fences[index] = nullptr;
+}
+
+} // namespace rfw::utils
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstddef>
+
+namespace rfw::utils
+{
+/*
+ * Ring of pixel unpack buffers for uploading frames rendered on the CPU. A frame is written into the next buffer of
+ * the ring while GL is still uploading the previous ones, fences make sure a buffer is only reused once its upload
+ * finished. Buffers are persistently mapped when ARB_buffer_storage is available and mapped unsynchronized every frame
+ * otherwise.
+ */
+class pixel_buffer_ring
+{
+  public:
+	static constexpr int SIZE = 3;
+
+	pixel_buffer_ring() = default;
+	pixel_buffer_ring(const pixel_buffer_ring &other) = delete;
+	~pixel_buffer_ring();
+
+	// (Re)allocates all buffers, waits for pending uploads first
+	void resize(size_t sizeInBytes);
+	void cleanup();
+
+	// Advances the ring and returns the memory of the next buffer once GL no longer reads from it
+	void *acquire();
+	// Uploads the last acquired buffer to a 2D texture
+	void upload(GLuint textureID, int width, int height, GLenum format, GLenum type);
+
+	[[nodiscard]] size_t get_size() const { return m_Size; }
+
+  private:
+	void wait(int index);
+
+	GLuint m_Buffers[SIZE] = {};
+	GLsync m_Fences[SIZE] = {};
+	void *m_Mapped[SIZE] = {};
+	size_t m_Size = 0;
+	int m_Current = 0;
+	bool m_Persistent = false;
+};
+} // namespace rfw::utils
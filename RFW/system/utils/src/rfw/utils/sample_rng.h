@@ -0,0 +1,44 @@
+#pragma once
+
+#include "rng.h"
+
+namespace rfw::utils
+{
+
+/*
+ * Generator for the random numbers of a single (pixel, sample) pair. The state is derived from the pixel and sample
+ * index only, tasks create their own instance on the stack and results do not depend on how work is scheduled over
+ * threads. Instances are padded to a full cache line so generators of different tasks never share one.
+ */
+class alignas(64) sample_rng : public rfw::utils::rng
+{
+  public:
+	sample_rng(unsigned int pixel, unsigned int sample) : m_State(hash(hash(pixel) ^ (sample * 0x9E3779B9u)))
+	{
+		// Xorshift gets stuck on a zero state
+		if (m_State == 0)
+			m_State = 0x6D2B79F5u;
+	}
+
+	unsigned int rand_uint() override final
+	{
+		m_State ^= m_State << 13;
+		m_State ^= m_State >> 17;
+		m_State ^= m_State << 5;
+		return m_State;
+	}
+
+  private:
+	static unsigned int hash(unsigned int s)
+	{
+		s = (s ^ 61u) ^ (s >> 16u);
+		s *= 9u;
+		s = s ^ (s >> 4u);
+		s *= 0x27d4eb2du;
+		s = s ^ (s >> 15u);
+		return s;
+	}
+
+	unsigned int m_State;
+};
+} // namespace rfw::utils